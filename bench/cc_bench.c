@@ -0,0 +1,457 @@
+// Host benchmark of the crypto_core cipher library (qemu/crypto_core_aes.c),
+// without QEMU or a guest. For every backend, key size, mode and buffer size
+// it reports ns per operation, cycles per byte and MB/s, then the cost of the
+// single primitives: KeyExpansion(), AES_init_ctx(), AES_init_ctx_many() per
+// key, and one Cipher / InvCipher block.
+//
+//	cc_bench [-b BACKEND] [-m MODE] [-k BITS] [-s BYTES] [-t MS]
+//
+//	-b	only this backend: reference, t-table or aes-ni
+//	-m	only this mode: ecb-enc, ecb-dec, cbc-enc, cbc-dec, ctr, gcm, xts-enc, xts-dec, cmac
+//	-k	only this key size: 128, 192 or 256
+//	-s	only this buffer size (a multiple of 16)
+//	-t	time measured per line, in ms (default 20)
+//
+// Cycles are TSC ticks, so they only match core cycles at the nominal
+// frequency; on hosts without a TSC the column is left out. GHASH, SHA-256
+// and the CMAC subkeys do not depend on the backend.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crypto_core_aes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_TSC 1
+#endif
+
+#define BENCH_MAX_SIZE	65536
+
+struct bench
+{
+	struct AES_ctx ctx;
+	struct AES_ctx tweak;
+	GHashKey gk;
+	uint8_t K1[AES_BLOCKLEN];
+	uint8_t K2[AES_BLOCKLEN];
+	uint8_t iv[AES_BLOCKLEN];
+	uint8_t tag[AES_BLOCKLEN];
+	uint8_t key[AES_KEYLEN];
+	unsigned keylen;
+	uint8_t *buf;
+	size_t size;
+	unsigned mode;		// bench_modes index
+};
+
+struct bench_mode
+{
+	const char *name;
+	void (*run)(struct bench *b);
+};
+
+struct bench_result
+{
+	double ns;	// per operation
+	double ticks;
+};
+
+static const size_t bench_sizes[] = { 16, 64, 256, 1024, 4096, 16384, 65536 };
+static const unsigned bench_keylens[] = { 16, 24, 32 };
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint64_t ticks(void)
+{
+#ifdef BENCH_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static void run_ecb_enc(struct bench *b)
+{
+	size_t i;
+
+	for(i = 0; i < b->size; i += AES_BLOCKLEN)
+	{
+		AES_ECB_encrypt(&b->ctx, b->buf + i);
+	}
+}
+
+static void run_ecb_dec(struct bench *b)
+{
+	size_t i;
+
+	for(i = 0; i < b->size; i += AES_BLOCKLEN)
+	{
+		AES_ECB_decrypt(&b->ctx, b->buf + i);
+	}
+}
+
+static void run_cbc_enc(struct bench *b)
+{
+	AES_ctx_set_iv(&b->ctx, b->iv);
+	AES_CBC_encrypt_buffer(&b->ctx, b->buf, b->size);
+}
+
+static void run_cbc_dec(struct bench *b)
+{
+	AES_ctx_set_iv(&b->ctx, b->iv);
+	AES_CBC_decrypt_buffer(&b->ctx, b->buf, b->size);
+}
+
+static void run_ctr(struct bench *b)
+{
+	AES_ctx_set_iv(&b->ctx, b->iv);
+	AES_CTR_xcrypt_buffer(&b->ctx, b->buf, b->size);
+}
+
+// GCM decryption costs the same as encryption: GHASH plus CTR over the buffer.
+static void run_gcm(struct bench *b)
+{
+	AES_GCM_encrypt_buffer(&b->ctx, &b->gk, b->iv, NULL, 0, b->buf, b->size, b->tag);
+}
+
+static void run_xts_enc(struct bench *b)
+{
+	AES_XTS_crypt_unit(&b->ctx, &b->tweak, b->iv, b->buf, b->size, 1);
+}
+
+static void run_xts_dec(struct bench *b)
+{
+	AES_XTS_crypt_unit(&b->ctx, &b->tweak, b->iv, b->buf, b->size, 0);
+}
+
+static void run_cmac(struct bench *b)
+{
+	AES_CMAC(&b->ctx, b->K1, b->K2, b->buf, b->size, b->tag);
+}
+
+static const struct bench_mode bench_modes[] = {
+	{ "ecb-enc", run_ecb_enc },
+	{ "ecb-dec", run_ecb_dec },
+	{ "cbc-enc", run_cbc_enc },
+	{ "cbc-dec", run_cbc_dec },
+	{ "ctr", run_ctr },
+	{ "gcm", run_gcm },
+	{ "xts-enc", run_xts_enc },
+	{ "xts-dec", run_xts_dec },
+	{ "cmac", run_cmac },
+};
+
+#define BENCH_MODES (sizeof(bench_modes) / sizeof(bench_modes[0]))
+
+// Repeats fn in growing batches until min_ns have passed.
+static struct bench_result measure(void (*fn)(void *), void *arg, uint64_t min_ns)
+{
+	struct bench_result r;
+	uint64_t ops = 0, batch = 1, i, t0, c0, ns = 0, tk = 0;
+
+	fn(arg);
+	while(ns < min_ns)
+	{
+		t0 = now_ns();
+		c0 = ticks();
+		for(i = 0; i < batch; i += 1)
+		{
+			fn(arg);
+		}
+		tk += ticks() - c0;
+		ns += now_ns() - t0;
+		ops += batch;
+		if(batch < (1u << 20))
+		{
+			batch *= 2;
+		}
+	}
+	r.ns = (double)ns / ops;
+	r.ticks = (double)tk / ops;
+	return r;
+}
+
+static void bench_mode_fn(void *arg)
+{
+	struct bench *b = arg;
+
+	bench_modes[b->mode].run(b);
+}
+
+// The key schedule and everything derived from it, under the current backend.
+static void bench_set_key(struct bench *b, unsigned keylen)
+{
+	uint8_t H[AES_BLOCKLEN] = { 0 };
+
+	b->keylen = keylen;
+	AES_init_ctx(&b->ctx, b->key, keylen);
+	AES_init_ctx(&b->tweak, b->key + AES_KEYLEN - keylen, keylen);
+	b->ctx.Cipher((state_t*)H, b->ctx.RoundKey);
+	GHASH_init_key(&b->gk, H);
+	AES_CMAC_subkeys(&b->ctx, b->K1, b->K2);
+}
+
+static void print_result(const char *backend, const char *op, unsigned keylen, size_t bytes,
+	struct bench_result r)
+{
+	printf("%-10s %-20s %4u %7zu %12.1f", backend, op, keylen * 8, bytes, r.ns);
+#ifdef BENCH_TSC
+	printf(" %10.2f", r.ticks / bytes);
+#endif
+	printf(" %10.1f\n", bytes * 1e3 / r.ns);
+}
+
+static void print_primitive(const char *backend, const char *op, unsigned keylen, struct bench_result r)
+{
+	printf("%-10s %-20s %4u %12.1f", backend, op, keylen * 8, r.ns);
+#ifdef BENCH_TSC
+	printf(" %10.1f", r.ticks);
+#endif
+	printf("\n");
+}
+
+static struct bench *prim;
+
+static void prim_key_expansion(void *arg)
+{
+	(void)arg;
+	KeyExpansion(prim->ctx.RoundKey, prim->key, prim->keylen / 4);
+}
+
+static void prim_init_ctx(void *arg)
+{
+	(void)arg;
+	AES_init_ctx(&prim->ctx, prim->key, prim->keylen);
+}
+
+#define BENCH_MANY 64
+
+static struct AES_ctx *many[BENCH_MANY];
+static uint8_t many_keys[BENCH_MANY * AES_KEYLEN];
+
+static void prim_init_ctx_many(void *arg)
+{
+	(void)arg;
+	AES_init_ctx_many(many, many_keys, BENCH_MANY, prim->keylen);
+}
+
+// One block at a time, each depending on the previous one: the latency of the round functions.
+static void prim_cipher(void *arg)
+{
+	(void)arg;
+	prim->ctx.Cipher((state_t*)prim->buf, prim->ctx.RoundKey);
+}
+
+static void prim_inv_cipher(void *arg)
+{
+	(void)arg;
+	prim->ctx.InvCipher((state_t*)prim->buf, prim->ctx.DecKey);
+}
+
+// Every backend must give the reference result before it is timed.
+static int self_test(void)
+{
+	static uint8_t ref[4][256], out[4][256];
+	struct AES_ctx ctx;
+	uint8_t key[AES_KEYLEN], iv[AES_BLOCKLEN] = { 0 };
+	unsigned k, i, be;
+	int err = 0;
+
+	for(i = 0; i < AES_KEYLEN; i += 1)
+	{
+		key[i] = (uint8_t)(i * 37 + 1);
+	}
+	for(k = 0; k < 3; k += 1)
+	{
+		for(be = 0; be < AES_BACKENDS; be += 1)
+		{
+			if(AES_set_backend(be) != 0)
+			{
+				continue;
+			}
+			for(i = 0; i < sizeof(out[0]); i += 1)
+			{
+				out[0][i] = (uint8_t)(i * 13 + k);
+			}
+			memcpy(out[1], out[0], sizeof(out[0]));
+			AES_init_ctx(&ctx, key, bench_keylens[k]);
+			for(i = 0; i < sizeof(out[0]); i += AES_BLOCKLEN)
+			{
+				AES_ECB_encrypt(&ctx, out[0] + i);
+			}
+			AES_ctx_set_iv(&ctx, iv);
+			AES_CBC_encrypt_buffer(&ctx, out[1], sizeof(out[1]));
+			memcpy(out[2], out[0], sizeof(out[0]));
+			memcpy(out[3], out[1], sizeof(out[1]));
+			for(i = 0; i < sizeof(out[2]); i += AES_BLOCKLEN)
+			{
+				AES_ECB_decrypt(&ctx, out[2] + i);
+			}
+			AES_ctx_set_iv(&ctx, iv);
+			AES_CBC_decrypt_buffer(&ctx, out[3], sizeof(out[3]));
+			if(be == AES_BACKEND_REF)
+			{
+				memcpy(ref, out, sizeof(ref));
+			} else if(memcmp(ref, out, sizeof(ref)) != 0)
+			{
+				fprintf(stderr, "%s: AES-%u differs from the reference\n", AES_backend_name(be),
+					bench_keylens[k] * 8);
+				err = 1;
+			}
+		}
+	}
+	return err;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-b backend] [-m mode] [-k bits] [-s bytes] [-t ms]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b;
+	struct bench_result r;
+	const char *only_backend = NULL, *only_mode = NULL;
+	unsigned only_bits = 0, features, be, k, m, i;
+	size_t only_size = 0, s;
+	uint64_t min_ns = 20 * 1000000ull;
+	char op[32];
+	int opt;
+
+	while((opt = getopt(argc, argv, "b:m:k:s:t:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'b':
+				only_backend = optarg;
+				break;
+			case 'm':
+				only_mode = optarg;
+				break;
+			case 'k':
+				only_bits = (unsigned)strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				only_size = strtoul(optarg, NULL, 0);
+				break;
+			case 't':
+				min_ns = strtoull(optarg, NULL, 0) * 1000000ull;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(optind != argc || (only_size && (only_size % AES_BLOCKLEN || only_size > BENCH_MAX_SIZE)))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	features = crypto_core_detect_host();
+	if(self_test() != 0)
+	{
+		return 1;
+	}
+
+	memset(&b, 0, sizeof(b));
+	b.buf = aligned_alloc(64, BENCH_MAX_SIZE);
+	for(i = 0; i < AES_KEYLEN; i += 1)
+	{
+		b.key[i] = (uint8_t)(i * 7 + 3);
+	}
+	for(i = 0; i < BENCH_MANY; i += 1)
+	{
+		many[i] = malloc(sizeof(struct AES_ctx));
+	}
+	memset(b.buf, 0x5a, BENCH_MAX_SIZE);
+	memset(many_keys, 0xa5, sizeof(many_keys));
+	prim = &b;
+
+	printf("host features 0x%x\n", features);
+	printf("%-10s %-20s %4s %7s %12s", "backend", "operation", "key", "bytes", "ns/op");
+#ifdef BENCH_TSC
+	printf(" %10s", "cycles/B");
+#endif
+	printf(" %10s\n", "MB/s");
+
+	for(be = 0; be < AES_BACKENDS; be += 1)
+	{
+		if((only_backend && strcmp(only_backend, AES_backend_name(be)) != 0) || AES_set_backend(be) != 0)
+		{
+			continue;
+		}
+		for(k = 0; k < 3; k += 1)
+		{
+			if(only_bits && only_bits != bench_keylens[k] * 8)
+			{
+				continue;
+			}
+			bench_set_key(&b, bench_keylens[k]);
+			for(m = 0; m < BENCH_MODES; m += 1)
+			{
+				if(only_mode && strcmp(only_mode, bench_modes[m].name) != 0)
+				{
+					continue;
+				}
+				for(s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s += 1)
+				{
+					if(only_size && only_size != bench_sizes[s])
+					{
+						continue;
+					}
+					b.size = bench_sizes[s];
+					b.mode = m;
+					r = measure(bench_mode_fn, &b, min_ns);
+					print_result(AES_backend_name(be), bench_modes[m].name, b.keylen, b.size, r);
+				}
+			}
+		}
+	}
+
+	printf("\n%-10s %-20s %4s %12s", "backend", "primitive", "key", "ns/op");
+#ifdef BENCH_TSC
+	printf(" %10s", "cycles/op");
+#endif
+	printf("\n");
+	for(k = 0; k < 3; k += 1)
+	{
+		if(only_bits && only_bits != bench_keylens[k] * 8)
+		{
+			continue;
+		}
+		b.keylen = bench_keylens[k];
+		r = measure(prim_key_expansion, NULL, min_ns);
+		print_primitive("-", "KeyExpansion", b.keylen, r);
+		for(be = 0; be < AES_BACKENDS; be += 1)
+		{
+			if((only_backend && strcmp(only_backend, AES_backend_name(be)) != 0) || AES_set_backend(be) != 0)
+			{
+				continue;
+			}
+			r = measure(prim_init_ctx, NULL, min_ns);
+			print_primitive(AES_backend_name(be), "AES_init_ctx", b.keylen, r);
+			r = measure(prim_init_ctx_many, NULL, min_ns);
+			r.ns /= BENCH_MANY;
+			r.ticks /= BENCH_MANY;
+			snprintf(op, sizeof(op), "AES_init_ctx_many/%u", BENCH_MANY);
+			print_primitive(AES_backend_name(be), op, b.keylen, r);
+			AES_init_ctx(&b.ctx, b.key, b.keylen);
+			r = measure(prim_cipher, NULL, min_ns);
+			print_primitive(AES_backend_name(be), "Cipher", b.keylen, r);
+			r = measure(prim_inv_cipher, NULL, min_ns);
+			print_primitive(AES_backend_name(be), "InvCipher", b.keylen, r);
+		}
+	}
+	return 0;
+}
@@ -1,56 +1,93 @@
+#include <crypto/aes.h>
+#include <crypto/engine.h>
+#include <crypto/internal/hash.h>
+#include <crypto/internal/skcipher.h>
+#include <crypto/scatterwalk.h>
+#include <crypto/sha2.h>
+#include <crypto/xts.h>
+#include <asm/unaligned.h>
+#include <linux/dma-mapping.h>
 #include <linux/err.h>
+#include <linux/eventfd.h>
+#include <linux/hw_random.h>
 #include <linux/io.h>
+#include <linux/io-64-nonatomic-lo-hi.h>
+#include <linux/iopoll.h>
 #include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/math64.h>
+#include <linux/miscdevice.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/of.h>
 #include <linux/platform_device.h>
+#include <linux/sched/mm.h>
 #include <linux/slab.h>
 #include <linux/sysfs.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#include "crypto-core.h"
+#include "../qemu/crypto_core_regs.h"
 
 #define CRYPTO_CORE_ADDR	0x8000000
-#define CRYPTO_CORE_SIZE	0x200
-
-#define REG_ID		0x0
-#define REG_MODE	0x8
-#define REG_FORMAT	0x10
-#define REG_START	0x18
-#define REG_VALID	0x20
-
-#define REG_KEY_0	0x28
-#define REG_KEY_1	0x30
-#define REG_KEY_2	0x38
-#define REG_KEY_3	0x40
-#define REG_KEY_4	0x48
-#define REG_KEY_5	0x50
-#define REG_KEY_6	0x58
-#define REG_KEY_7	0x60
-
-#define REG_IV_0	0x68
-#define REG_IV_1	0x70
-#define REG_IV_2	0x78
-#define REG_IV_3	0x80
-
-#define REG_IN_0	0x88
-#define REG_IN_1	0x90
-#define REG_IN_2	0x98
-#define REG_IN_3	0x100
-
-#define REG_OUT_0	0x108
-#define REG_OUT_1	0x110
-#define REG_OUT_2	0x118
-#define REG_OUT_3	0x120
-
-#define REG_KEY_CHAR	0x128
-#define REG_IV_CHAR	0x130
-#define REG_IN_CHAR	0x138
-#define REG_OUT_CHAR	0x140
+#define CC_BANKS		8
+#define CC_BANK_SIZE		0x1000
+#define CRYPTO_CORE_SIZE	(CC_BANKS * CC_BANK_SIZE)
+
+#define CC_BOUNCE_SIZE	(64 * 1024)	// largest request the crypto API path accepts
+#define CC_JOB_TIMEOUT_US_PER_KB	1000	// on top of job_timeout_ms
+#define CC_ENGINE_QLEN		256	// crypto API requests queued per bank
+#define CC_JOB_SPIN_US		20	// polling VALID before sleeping between reads
+#define CC_JOB_SLEEP_US		50
+
+// Every register bank of the device runs its own jobs, so each one gets its
+// own lock and bounce buffer and requests on different CPUs do not contend.
+// All of its users run in process context (the engine kthread, ioctl, hwrng),
+// so the lock is a mutex and a long job sleeps instead of spinning.
+struct cc_bank
+{
+	void __iomem *base;
+	struct mutex lock;	// one job at a time through this bank's registers
+	struct crypto_engine *engine;	// queue of the crypto API requests
+	void *bounce;
+	dma_addr_t bounce_dma;
+	// a job timed out: the device may still run it and write its buffer, so
+	// the bank is not used again before it reads VALID
+	bool stuck;
+
+	// with latency_stats, device virtual clock time summed over the jobs
+	u64 jobs;
+	u64 queue_ns;		// START to processing
+	u64 device_ns;		// processing to VALID
+	u64 delivery_ns;	// VALID to the driver seeing it
+};
 
 struct crypto_core
 {
 	struct device *dev;
-	void __iomem *base;
+	void __iomem *base;	// bank 0, the one the sysfs attributes use
+
+	struct cc_bank banks[CC_BANKS];
+	unsigned int nbanks;
+
+	struct hwrng rng;
+	struct miscdevice misc;	// /dev/cryptocore
 };
 
+static bool latency_stats;
+module_param(latency_stats, bool, 0644);
+MODULE_PARM_DESC(latency_stats, "read the job timestamps of the device after every job (costs 4 MMIO reads)");
+
+static unsigned int job_timeout_ms = 100;
+module_param(job_timeout_ms, uint, 0644);
+MODULE_PARM_DESC(job_timeout_ms, "time a job may wait behind the other banks, plus 1 ms per KiB, before it is given up");
+
+// the crypto API has no handle on the platform device, so the probed core is kept here
+static struct crypto_core *cc_dev;
+static atomic_t cc_next_slot = ATOMIC_INIT(0);
+
 static void uint32_to_uint8(const uint32_t input32, uint8_t *outputch)
 {
 	outputch[3] = (input32 >> 24) & 0xFF;
@@ -166,6 +203,73 @@ static ssize_t ct_store_valid(
 	return cc_store(dev, attr, buf, len, REG_VALID);
 }
 
+// KEY LENGTH (128, 192 or 256 bits)
+
+static ssize_t ct_show_key_len(
+	struct device *dev, struct device_attribute *attr, char *buf
+)
+{
+	return cc_show(dev, attr, buf, REG_KEY_LEN);
+}
+
+static ssize_t ct_store_key_len(
+	struct device *dev, struct device_attribute *attr, const char *buf, size_t len
+)
+{
+	return cc_store(dev, attr, buf, len, REG_KEY_LEN);
+}
+
+// KEY SLOT
+
+static ssize_t ct_show_key_slot(
+	struct device *dev, struct device_attribute *attr, char *buf
+)
+{
+	return cc_show(dev, attr, buf, REG_KEY_SLOT);
+}
+
+static ssize_t ct_store_key_slot(
+	struct device *dev, struct device_attribute *attr, const char *buf, size_t len
+)
+{
+	return cc_store(dev, attr, buf, len, REG_KEY_SLOT);
+}
+
+// STATUS
+
+static ssize_t ct_show_status(
+	struct device *dev, struct device_attribute *attr, char *buf
+)
+{
+	return cc_show(dev, attr, buf, REG_STATUS);
+}
+
+// LATENCY: average queueing, device and completion delivery time of the
+// crypto API jobs, in ns of the device virtual clock (needs latency_stats)
+
+static ssize_t ct_show_latency(
+	struct device *dev, struct device_attribute *attr, char *buf
+)
+{
+	struct crypto_core *ct = dev_get_drvdata(dev);
+	u64 jobs = 0, queue = 0, device = 0, delivery = 0;
+	unsigned int i;
+
+	for(i = 0; i < ct->nbanks; i += 1)
+	{
+		jobs += ct->banks[i].jobs;
+		queue += ct->banks[i].queue_ns;
+		device += ct->banks[i].device_ns;
+		delivery += ct->banks[i].delivery_ns;
+	}
+	if(jobs == 0)
+	{
+		return scnprintf(buf, PAGE_SIZE, "0 0 0 0\n");
+	}
+	return scnprintf(buf, PAGE_SIZE, "%llu %llu %llu %llu\n", jobs,
+		div64_u64(queue, jobs), div64_u64(device, jobs), div64_u64(delivery, jobs));
+}
+
 // KEY (STORE)
 
 static ssize_t ct_store_key_0(
@@ -390,6 +494,42 @@ static ssize_t ct_show_out_char(
 
 }
 
+// TAG (GCM): computed by encryption, expected by decryption
+
+static ssize_t ct_show_tag_char(
+	struct device *dev, struct device_attribute *attr, char *buf
+)
+{
+	struct crypto_core *ct = dev_get_drvdata(dev);
+	uint8_t c[16];
+	uint32_to_uint8(readl_relaxed(ct->base + REG_TAG_0), c);
+	uint32_to_uint8(readl_relaxed(ct->base + REG_TAG_1), c+4);
+	uint32_to_uint8(readl_relaxed(ct->base + REG_TAG_2), c+8);
+	uint32_to_uint8(readl_relaxed(ct->base + REG_TAG_3), c+12);
+
+	return scnprintf(buf, PAGE_SIZE,
+		"%u %u %u %u %u %u %u %u %u %u %u %u %u %u %u %u\n",
+		c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7],
+		c[8], c[9], c[10], c[11], c[12], c[13], c[14], c[15]
+	);
+}
+
+static ssize_t ct_store_tag_char(
+	struct device *dev, struct device_attribute *attr, const char *buf, size_t len
+)
+{
+	struct crypto_core *ct = dev_get_drvdata(dev);
+	if(len < 16)
+	{
+		return -EINVAL;
+	}
+	writel(char_to_uint32(buf), ct->base + REG_TAG_0);
+	writel(char_to_uint32(buf+4), ct->base + REG_TAG_1);
+	writel(char_to_uint32(buf+8), ct->base + REG_TAG_2);
+	writel(char_to_uint32(buf+12), ct->base + REG_TAG_3);
+	return len;
+}
+
 static ssize_t ct_store_key_char(
 	struct device *dev, struct device_attribute *attr, const char *buf, size_t len
 )
@@ -471,6 +611,10 @@ static DEVICE_ATTR(start, 	S_IRUGO | S_IWUSR, 	ct_show_start, 	ct_store_start);
 static DEVICE_ATTR(mode, 	S_IRUGO | S_IWUSR, 	ct_show_mode, 	ct_store_mode);
 static DEVICE_ATTR(format, 	S_IRUGO | S_IWUSR, 	ct_show_format,	ct_store_format);
 static DEVICE_ATTR(valid, 	S_IRUGO | S_IWUSR, 	ct_show_valid,	ct_store_valid);
+static DEVICE_ATTR(key_len,	S_IRUGO | S_IWUSR,	ct_show_key_len,ct_store_key_len);
+static DEVICE_ATTR(key_slot,	S_IRUGO | S_IWUSR,	ct_show_key_slot,ct_store_key_slot);
+static DEVICE_ATTR(status,	S_IRUGO,		ct_show_status,	NULL);
+static DEVICE_ATTR(latency,	S_IRUGO,		ct_show_latency,NULL);
 
 static DEVICE_ATTR(key_0, 	S_IWUSR, 		NULL, 		ct_store_key_0);
 static DEVICE_ATTR(key_1, 	S_IWUSR, 		NULL, 		ct_store_key_1);
@@ -503,6 +647,8 @@ static DEVICE_ATTR(out_2, 	S_IRUGO, 		ct_show_out_2,	NULL);
 static DEVICE_ATTR(out_3, 	S_IRUGO, 		ct_show_out_3,	NULL);
 
 static DEVICE_ATTR(out_char,	S_IRUGO,		ct_show_out_char,NULL);
+
+static DEVICE_ATTR(tag_char,	S_IRUGO | S_IWUSR,	ct_show_tag_char,ct_store_tag_char);
 /*
 */
 
@@ -512,6 +658,10 @@ static struct attribute *ct_attributes[] = {
 	&dev_attr_format.attr,
 	&dev_attr_start.attr,
 	&dev_attr_valid.attr,
+	&dev_attr_key_len.attr,
+	&dev_attr_key_slot.attr,
+	&dev_attr_status.attr,
+	&dev_attr_latency.attr,
 
 	&dev_attr_key_0.attr,
 	&dev_attr_key_1.attr,
@@ -539,6 +689,8 @@ static struct attribute *ct_attributes[] = {
 	&dev_attr_out_2.attr,
 	&dev_attr_out_3.attr,
 	&dev_attr_out_char.attr,
+
+	&dev_attr_tag_char.attr,
 	NULL,
 };
 
@@ -546,9 +698,1274 @@ static const struct attribute_group ct_attr_group = {
 	.attrs = ct_attributes,
 };
 
-static void ct_init(struct crypto_core *ct)
+// CRYPTO API
+
+// AES requests are queued on the crypto_engine of a bank and run by its
+// kthread: the caller gets -EINPROGRESS and a burst of requests is drained
+// back to back, each one reusing the key schedule kept in its tfm's slot.
+struct cc_aes_ctx
+{
+	struct crypto_engine_ctx enginectx;	// first, the engine looks for it there
+	u8 key[2 * AES_MAX_KEY_SIZE];
+	unsigned int keylen;	// length of each key, XTS has two
+	u32 slot;
+};
+
+struct cc_aes_reqctx
+{
+	struct cc_bank *bank;
+	u32 mode;
+};
+
+struct cc_skcipher_alg
+{
+	u32 format;
+	struct skcipher_alg alg;
+};
+
+// Bank 0 is left to the sysfs interface whenever the device has others.
+static unsigned int cc_first_api_bank(struct crypto_core *ct)
+{
+	return ct->nbanks > 1 ? 1 : 0;
+}
+
+// The bank of this CPU, or the next one that is not held by a timed out job.
+static struct cc_bank *cc_pick_bank(struct crypto_core *ct)
+{
+	unsigned int first = cc_first_api_bank(ct);
+	unsigned int n = ct->nbanks - first;
+	unsigned int cpu = raw_smp_processor_id() % n;
+	struct cc_bank *bank;
+	unsigned int i;
+
+	for(i = 0; i < n; i += 1)
+	{
+		bank = &ct->banks[first + (cpu + i) % n];
+		if(!READ_ONCE(bank->stuck) || readl(bank->base + REG_VALID))
+		{
+			return bank;
+		}
+	}
+	return &ct->banks[first + cpu];
+}
+
+// Called with bank->lock held. A bank whose timed out job has finished in the
+// meantime is put back into use.
+static bool cc_bank_usable(struct cc_bank *bank)
+{
+	if(bank->stuck && readl(bank->base + REG_VALID))
+	{
+		writeq(0, bank->base + REG_LEN);
+		writel(0, bank->base + REG_START);
+		WRITE_ONCE(bank->stuck, false);
+	}
+	return !bank->stuck;
+}
+
+// Locks bank, unless it is still held by a timed out job.
+static bool cc_lock_bank(struct cc_bank *bank)
+{
+	mutex_lock(&bank->lock);
+	if(!cc_bank_usable(bank))
+	{
+		mutex_unlock(&bank->lock);
+		return false;
+	}
+	return true;
+}
+
+// Returns the bank locked, or NULL if every bank is still held by a timed out job.
+static struct cc_bank *cc_get_bank(struct crypto_core *ct)
+{
+	struct cc_bank *bank = cc_pick_bank(ct);
+	return cc_lock_bank(bank) ? bank : NULL;
+}
+
+static void cc_put_bank(struct cc_bank *bank)
+{
+	mutex_unlock(&bank->lock);
+}
+
+static void cc_write_key(struct cc_bank *bank, uint64_t offset, const u8 *key, unsigned int keylen)
+{
+	u8 padded[AES_MAX_KEY_SIZE] = { 0 };
+	unsigned int i;
+	memcpy(padded, key, keylen);
+	for(i = 0; i < AES_MAX_KEY_SIZE / 4; i += 1)
+	{
+		writel(get_unaligned_le32(padded + i*4), bank->base + offset + i*8);
+	}
+	memzero_explicit(padded, sizeof(padded));
+}
+
+static void cc_write_iv(struct cc_bank *bank, const u8 *iv)
+{
+	writel(get_unaligned_le32(iv), bank->base + REG_IV_0);
+	writel(get_unaligned_le32(iv + 4), bank->base + REG_IV_1);
+	writel(get_unaligned_le32(iv + 8), bank->base + REG_IV_2);
+	writel(get_unaligned_le32(iv + 12), bank->base + REG_IV_3);
+}
+
+// ctr += blocks, as a 128-bit big-endian counter
+static void cc_ctr_add(u8 *ctr, u64 blocks)
+{
+	u64 lo = get_unaligned_be64(ctr + 8);
+	u64 hi = get_unaligned_be64(ctr);
+
+	put_unaligned_be64(lo + blocks, ctr + 8);
+	put_unaligned_be64(hi + (lo + blocks < lo), ctr);
+}
+
+static void cc_account_latency(struct cc_bank *bank)
+{
+	u64 now = readq(bank->base + REG_TS_NOW);
+	u64 done = readq(bank->base + REG_TS_DONE);
+	u64 start = readq(bank->base + REG_TS_START);
+	u64 submit = readq(bank->base + REG_TS_SUBMIT);
+
+	bank->jobs += 1;
+	bank->queue_ns += start - submit;
+	bank->device_ns += done - start;
+	bank->delivery_ns += now - done;
+}
+
+// Runs len bytes at dma through the device in place. Called with bank->lock held;
+// sleeps unless the job is done within CC_JOB_SPIN_US. On a timeout the bank is
+// marked stuck and the buffer at dma must be left alone until cc_bank_usable()
+// says the device is done with it.
+static u32 cc_run_job_at(struct cc_bank *bank, dma_addr_t dma, unsigned int len, u32 mode, u32 format)
+{
+	u64 timeout_us = (u64)job_timeout_ms * 1000 + (u64)DIV_ROUND_UP(len, 1024) * CC_JOB_TIMEOUT_US_PER_KB;
+	u32 status, valid;
+
+	writeq(dma, bank->base + REG_SRC_ADDR);
+	writeq(dma, bank->base + REG_DST_ADDR);
+	writeq(len, bank->base + REG_LEN);
+	writel(mode, bank->base + REG_MODE);
+	writel(format, bank->base + REG_FORMAT);
+	writel(1, bank->base + REG_START);
+
+	// jobs above the device's small-job size are queued behind other banks
+	if(readl_poll_timeout_atomic(bank->base + REG_VALID, valid, valid, 1, CC_JOB_SPIN_US) &&
+		readl_poll_timeout(bank->base + REG_VALID, valid, valid, CC_JOB_SLEEP_US, timeout_us))
+	{
+		WRITE_ONCE(bank->stuck, true);
+		pr_warn_ratelimited("crypto-core: %u byte job timed out, bank left alone until it completes\n", len);
+		return U32_MAX;
+	}
+	status = readl(bank->base + REG_STATUS);
+	if(latency_stats)
+	{
+		cc_account_latency(bank);
+	}
+	// leave the register interface as the sysfs users expect it
+	writeq(0, bank->base + REG_LEN);
+	writel(0, bank->base + REG_START);
+	return status;
+}
+
+static u32 cc_run_job(struct cc_bank *bank, unsigned int len, u32 mode, u32 format)
+{
+	return cc_run_job_at(bank, bank->bounce_dma, len, mode, format);
+}
+
+static u32 cc_skcipher_format(struct crypto_skcipher *tfm)
+{
+	return container_of(crypto_skcipher_alg(tfm), struct cc_skcipher_alg, alg)->format;
+}
+
+// Engine callback. The device leaves the CBC and CTR chaining value in the IV
+// registers, so a request longer than the bounce buffer runs as several jobs
+// without rewriting them; req->iv gets the chaining value for the next request.
+static int cc_aes_do_one_request(struct crypto_engine *engine, void *areq)
+{
+	struct skcipher_request *req = container_of(areq, struct skcipher_request, base);
+	struct crypto_skcipher *tfm = crypto_skcipher_reqtfm(req);
+	struct cc_aes_ctx *ctx = crypto_skcipher_ctx(tfm);
+	struct cc_aes_reqctx *rctx = skcipher_request_ctx(req);
+	struct cc_bank *bank = rctx->bank;
+	u32 format = cc_skcipher_format(tfm);
+	u8 last[AES_BLOCK_SIZE];
+	unsigned int off, n = 0;
+	u32 status = 0;
+
+	if(!cc_lock_bank(bank))
+	{
+		crypto_finalize_skcipher_request(engine, req, -EIO);
+		return 0;
+	}
+
+	writel(ctx->slot, bank->base + REG_KEY_SLOT);
+	writel(ctx->keylen * 8, bank->base + REG_KEY_LEN);
+	cc_write_key(bank, REG_KEY_0, ctx->key, ctx->keylen);
+	if(format == FORMAT_XTS)
+	{
+		cc_write_key(bank, REG_KEY2_0, ctx->key + ctx->keylen, ctx->keylen);
+		writel(0, bank->base + REG_SECTOR_SIZE);
+	}
+	if(format != FORMAT_ECB)
+	{
+		cc_write_iv(bank, req->iv);
+	}
+
+	for(off = 0; !status && off < req->cryptlen; off += n)
+	{
+		n = min_t(unsigned int, req->cryptlen - off, CC_BOUNCE_SIZE);
+		scatterwalk_map_and_copy(bank->bounce, req->src, off, n, 0);
+		if(format == FORMAT_CBC && rctx->mode == 1)
+		{
+			memcpy(last, bank->bounce + n - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+		}
+		status = cc_run_job(bank, n, rctx->mode, format);
+		if(!status)
+		{
+			scatterwalk_map_and_copy(bank->bounce, req->dst, off, n, 1);
+			if(format == FORMAT_CBC && rctx->mode == 0)
+			{
+				memcpy(last, bank->bounce + n - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+			}
+		}
+	}
+
+	cc_put_bank(bank);
+
+	if(!status && format == FORMAT_CBC)
+	{
+		memcpy(req->iv, last, AES_BLOCK_SIZE);
+	}
+	if(!status && format == FORMAT_CTR)
+	{
+		cc_ctr_add(req->iv, DIV_ROUND_UP(req->cryptlen, AES_BLOCK_SIZE));
+	}
+	crypto_finalize_skcipher_request(engine, req, status ? -EIO : 0);
+	return 0;
+}
+
+static int cc_aes_init_tfm(struct crypto_skcipher *tfm)
+{
+	struct cc_aes_ctx *ctx = crypto_skcipher_ctx(tfm);
+	ctx->enginectx.op.do_one_request = cc_aes_do_one_request;
+	// spread the transforms over the key slots so the device keeps their schedules
+	ctx->slot = (u32)atomic_inc_return(&cc_next_slot) % CC_KEY_SLOTS;
+	crypto_skcipher_set_reqsize(tfm, sizeof(struct cc_aes_reqctx));
+	return 0;
+}
+
+static int cc_aes_setkey(struct crypto_skcipher *tfm, const u8 *key, unsigned int keylen)
+{
+	struct cc_aes_ctx *ctx = crypto_skcipher_ctx(tfm);
+	int err = aes_check_keylen(keylen);
+	if(err)
+	{
+		return err;
+	}
+	memcpy(ctx->key, key, keylen);
+	ctx->keylen = keylen;
+	return 0;
+}
+
+static int cc_xts_setkey(struct crypto_skcipher *tfm, const u8 *key, unsigned int keylen)
+{
+	struct cc_aes_ctx *ctx = crypto_skcipher_ctx(tfm);
+	int err = xts_verify_key(tfm, key, keylen);
+	if(err)
+	{
+		return err;
+	}
+	if(keylen != 2 * AES_KEYSIZE_128 && keylen != 2 * AES_KEYSIZE_192 && keylen != 2 * AES_KEYSIZE_256)
+	{
+		return -EINVAL;
+	}
+	memcpy(ctx->key, key, keylen);
+	ctx->keylen = keylen / 2;
+	return 0;
+}
+
+static int cc_aes_crypt(struct skcipher_request *req, u32 mode)
+{
+	struct crypto_skcipher *tfm = crypto_skcipher_reqtfm(req);
+	struct cc_aes_reqctx *rctx = skcipher_request_ctx(req);
+	u32 format = cc_skcipher_format(tfm);
+
+	if(format == FORMAT_XTS)
+	{
+		// the device runs the whole request as one XTS data unit with the request IV as tweak input
+		if(req->cryptlen < AES_BLOCK_SIZE || req->cryptlen > CC_BOUNCE_SIZE)
+		{
+			return -EINVAL;
+		}
+	} else if(format != FORMAT_CTR && req->cryptlen % AES_BLOCK_SIZE)
+	{
+		return -EINVAL;
+	}
+	if(req->cryptlen == 0)
+	{
+		return 0;
+	}
+
+	rctx->bank = cc_pick_bank(cc_dev);
+	rctx->mode = mode;
+	return crypto_transfer_skcipher_request_to_engine(rctx->bank->engine, req);
+}
+
+static int cc_aes_encrypt(struct skcipher_request *req)
+{
+	return cc_aes_crypt(req, 0);
+}
+
+static int cc_aes_decrypt(struct skcipher_request *req)
+{
+	return cc_aes_crypt(req, 1);
+}
+
+#define CC_SKCIPHER_BASE(name, driver_name, blocksize) \
+	.base = { \
+		.cra_name		= name, \
+		.cra_driver_name	= driver_name, \
+		.cra_priority		= 300, \
+		.cra_flags		= CRYPTO_ALG_ASYNC | CRYPTO_ALG_KERN_DRIVER_ONLY, \
+		.cra_blocksize		= blocksize, \
+		.cra_ctxsize		= sizeof(struct cc_aes_ctx), \
+		.cra_module		= THIS_MODULE, \
+	}, \
+	.init		= cc_aes_init_tfm, \
+	.encrypt	= cc_aes_encrypt, \
+	.decrypt	= cc_aes_decrypt
+
+static struct cc_skcipher_alg cc_skcipher_algs[] = {
+	{
+		.format = FORMAT_ECB,
+		.alg = {
+			CC_SKCIPHER_BASE("ecb(aes)", "ecb-aes-crypto-core", AES_BLOCK_SIZE),
+			.min_keysize	= AES_MIN_KEY_SIZE,
+			.max_keysize	= AES_MAX_KEY_SIZE,
+			.setkey		= cc_aes_setkey,
+		},
+	},
+	{
+		.format = FORMAT_CBC,
+		.alg = {
+			CC_SKCIPHER_BASE("cbc(aes)", "cbc-aes-crypto-core", AES_BLOCK_SIZE),
+			.min_keysize	= AES_MIN_KEY_SIZE,
+			.max_keysize	= AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= cc_aes_setkey,
+		},
+	},
+	{
+		.format = FORMAT_CTR,
+		.alg = {
+			CC_SKCIPHER_BASE("ctr(aes)", "ctr-aes-crypto-core", 1),
+			.min_keysize	= AES_MIN_KEY_SIZE,
+			.max_keysize	= AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.chunksize	= AES_BLOCK_SIZE,
+			.setkey		= cc_aes_setkey,
+		},
+	},
+	{
+		.format = FORMAT_XTS,
+		.alg = {
+			CC_SKCIPHER_BASE("xts(aes)", "xts-aes-crypto-core", AES_BLOCK_SIZE),
+			.min_keysize	= 2 * AES_MIN_KEY_SIZE,
+			.max_keysize	= 2 * AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= cc_xts_setkey,
+		},
+	},
+};
+
+static void cc_unregister_skciphers(unsigned int count)
+{
+	while(count > 0)
+	{
+		count -= 1;
+		crypto_unregister_skcipher(&cc_skcipher_algs[count].alg);
+	}
+}
+
+static int cc_register_skciphers(void)
+{
+	unsigned int i;
+	int err;
+
+	for(i = 0; i < ARRAY_SIZE(cc_skcipher_algs); i += 1)
+	{
+		err = crypto_register_skcipher(&cc_skcipher_algs[i].alg);
+		if(err)
+		{
+			cc_unregister_skciphers(i);
+			return err;
+		}
+	}
+	return 0;
+}
+
+// Only whole blocks go to the device; the tail waits in the state's buf until
+// the next update or final. Updates that fill no block and every other step
+// that needs no device complete at once; the rest is queued on the engine of a
+// bank, since ahash requests may come from atomic context and the bank lock
+// sleeps. The state comes first in the request context, so export/import are
+// plain copies of it. The digest registers hold the state words as digest bytes.
+
+#define CC_SHA256_UPDATE	(1 << 0)
+#define CC_SHA256_FINAL		(1 << 1)
+
+struct cc_sha256_ctx
+{
+	struct crypto_engine_ctx enginectx;	// first, the engine looks for it there
+};
+
+struct cc_sha256_reqctx
+{
+	struct sha256_state state;
+	struct cc_bank *bank;
+	u32 op;		// CC_SHA256_*
+};
+
+static void cc_sha256_load(struct cc_bank *bank, const struct sha256_state *state)
+{
+	unsigned int i;
+	for(i = 0; i < 8; i += 1)
+	{
+		writel(swab32(state->state[i]), bank->base + REG_DIGEST_0 + i*8);
+	}
+	writeq(state->count & ~(u64)(SHA256_BLOCK_SIZE - 1), bank->base + REG_HASH_COUNT);
+}
+
+static void cc_sha256_save(struct cc_bank *bank, struct sha256_state *state)
+{
+	unsigned int i;
+	for(i = 0; i < 8; i += 1)
+	{
+		state->state[i] = swab32(readl(bank->base + REG_DIGEST_0 + i*8));
+	}
+}
+
+// Runs the whole blocks of req->src, with the buffered tail in front of them,
+// through the device. Called with bank->lock held.
+static u32 cc_sha256_run_update(struct cc_bank *bank, struct ahash_request *req)
+{
+	struct cc_sha256_reqctx *rctx = ahash_request_ctx(req);
+	struct sha256_state *state = &rctx->state;
+	unsigned int partial = state->count % SHA256_BLOCK_SIZE;
+	unsigned int off = 0, fill, n;
+	u32 status = 0;
+
+	if(partial + req->nbytes >= SHA256_BLOCK_SIZE)
+	{
+		cc_sha256_load(bank, state);
+		writel(0, bank->base + REG_HASH_CTRL);
+
+		memcpy(bank->bounce, state->buf, partial);
+		fill = partial;
+		while(!status && req->nbytes - off + fill >= SHA256_BLOCK_SIZE)
+		{
+			n = min_t(unsigned int, req->nbytes - off, CC_BOUNCE_SIZE - fill);
+			n = round_down(fill + n, SHA256_BLOCK_SIZE) - fill;
+			scatterwalk_map_and_copy(bank->bounce + fill, req->src, off, n, 0);
+			status = cc_run_job(bank, fill + n, 0, FORMAT_SHA256);
+			off += n;
+			fill = 0;
+		}
+		if(status)
+		{
+			return status;
+		}
+		cc_sha256_save(bank, state);
+		partial = 0;
+	}
+
+	scatterwalk_map_and_copy(state->buf + partial, req->src, off, req->nbytes - off, 0);
+	state->count += req->nbytes;
+	return 0;
+}
+
+// Pads the buffered tail and leaves the digest in req->result. Called with bank->lock held.
+static u32 cc_sha256_run_final(struct cc_bank *bank, struct ahash_request *req)
+{
+	struct cc_sha256_reqctx *rctx = ahash_request_ctx(req);
+	struct sha256_state *state = &rctx->state;
+	unsigned int partial = state->count % SHA256_BLOCK_SIZE;
+	unsigned int i;
+	u32 status;
+
+	cc_sha256_load(bank, state);
+	writel(HASH_FINAL, bank->base + REG_HASH_CTRL);
+	memcpy(bank->bounce, state->buf, partial);
+	status = cc_run_job(bank, partial, 0, FORMAT_SHA256);
+	if(!status)
+	{
+		for(i = 0; i < 8; i += 1)
+		{
+			put_unaligned_le32(readl(bank->base + REG_DIGEST_0 + i*8), req->result + i*4);
+		}
+	}
+	return status;
+}
+
+// Engine callback: the update and/or final selected by the request context.
+static int cc_sha256_do_one_request(struct crypto_engine *engine, void *areq)
+{
+	struct ahash_request *req = container_of(areq, struct ahash_request, base);
+	struct cc_sha256_reqctx *rctx = ahash_request_ctx(req);
+	struct cc_bank *bank = rctx->bank;
+	u32 status = U32_MAX;
+
+	if(cc_lock_bank(bank))
+	{
+		status = 0;
+		if(rctx->op & CC_SHA256_UPDATE)
+		{
+			status = cc_sha256_run_update(bank, req);
+		}
+		if(!status && rctx->op & CC_SHA256_FINAL)
+		{
+			status = cc_sha256_run_final(bank, req);
+		}
+		cc_put_bank(bank);
+	}
+	if(rctx->op & CC_SHA256_FINAL)
+	{
+		memzero_explicit(&rctx->state, sizeof(rctx->state));
+	}
+	crypto_finalize_hash_request(engine, req, status ? -EIO : 0);
+	return 0;
+}
+
+static int cc_sha256_queue(struct ahash_request *req, u32 op)
 {
+	struct cc_sha256_reqctx *rctx = ahash_request_ctx(req);
 
+	rctx->bank = cc_pick_bank(cc_dev);
+	rctx->op = op;
+	return crypto_transfer_hash_request_to_engine(rctx->bank->engine, req);
+}
+
+static int cc_sha256_init(struct ahash_request *req)
+{
+	struct cc_sha256_reqctx *rctx = ahash_request_ctx(req);
+	sha256_init(&rctx->state);
+	return 0;
+}
+
+static int cc_sha256_update(struct ahash_request *req)
+{
+	struct cc_sha256_reqctx *rctx = ahash_request_ctx(req);
+	unsigned int partial = rctx->state.count % SHA256_BLOCK_SIZE;
+
+	if(partial + req->nbytes >= SHA256_BLOCK_SIZE)
+	{
+		return cc_sha256_queue(req, CC_SHA256_UPDATE);
+	}
+	scatterwalk_map_and_copy(rctx->state.buf + partial, req->src, 0, req->nbytes, 0);
+	rctx->state.count += req->nbytes;
+	return 0;
+}
+
+static int cc_sha256_final(struct ahash_request *req)
+{
+	return cc_sha256_queue(req, CC_SHA256_FINAL);
+}
+
+static int cc_sha256_finup(struct ahash_request *req)
+{
+	return cc_sha256_queue(req, CC_SHA256_UPDATE | CC_SHA256_FINAL);
+}
+
+static int cc_sha256_digest(struct ahash_request *req)
+{
+	cc_sha256_init(req);
+	return cc_sha256_finup(req);
+}
+
+static int cc_sha256_export(struct ahash_request *req, void *out)
+{
+	memcpy(out, ahash_request_ctx(req), sizeof(struct sha256_state));
+	return 0;
+}
+
+static int cc_sha256_import(struct ahash_request *req, const void *in)
+{
+	memcpy(ahash_request_ctx(req), in, sizeof(struct sha256_state));
+	return 0;
+}
+
+static int cc_sha256_cra_init(struct crypto_tfm *tfm)
+{
+	struct cc_sha256_ctx *ctx = crypto_tfm_ctx(tfm);
+	ctx->enginectx.op.do_one_request = cc_sha256_do_one_request;
+	crypto_ahash_set_reqsize(__crypto_ahash_cast(tfm), sizeof(struct cc_sha256_reqctx));
+	return 0;
+}
+
+static struct ahash_alg cc_sha256_alg = {
+	.init	= cc_sha256_init,
+	.update	= cc_sha256_update,
+	.final	= cc_sha256_final,
+	.finup	= cc_sha256_finup,
+	.digest	= cc_sha256_digest,
+	.export	= cc_sha256_export,
+	.import	= cc_sha256_import,
+	.halg	= {
+		.digestsize	= SHA256_DIGEST_SIZE,
+		.statesize	= sizeof(struct sha256_state),
+		.base	= {
+			.cra_name		= "sha256",
+			.cra_driver_name	= "sha256-crypto-core",
+			.cra_priority		= 300,
+			.cra_flags		= CRYPTO_ALG_ASYNC | CRYPTO_ALG_KERN_DRIVER_ONLY,
+			.cra_blocksize		= SHA256_BLOCK_SIZE,
+			.cra_ctxsize		= sizeof(struct cc_sha256_ctx),
+			.cra_module		= THIS_MODULE,
+			.cra_init		= cc_sha256_cra_init,
+		},
+	},
+};
+
+// HWRNG
+
+// The device DRBG writes straight into the bounce buffer; it reseeds itself from the host.
+static int cc_rng_read(struct hwrng *rng, void *buf, size_t max, bool wait)
+{
+	struct crypto_core *ct = container_of(rng, struct crypto_core, rng);
+	struct cc_bank *bank;
+	size_t len = min_t(size_t, max, CC_BOUNCE_SIZE);
+	u32 status;
+
+	bank = cc_get_bank(ct);
+	if(!bank)
+	{
+		return -EIO;
+	}
+	writeq(0, bank->base + REG_AAD_LEN);
+	status = cc_run_job(bank, len, 0, FORMAT_DRBG);
+	if(!status)
+	{
+		memcpy(buf, bank->bounce, len);
+	}
+	if(status != U32_MAX)
+	{
+		memzero_explicit(bank->bounce, len);
+	}
+	cc_put_bank(bank);
+
+	return status ? -EIO : len;
+}
+
+// CHARACTER DEVICE
+
+// Every open file has its own DMA buffer and key slot, so the operations of a
+// batch only hold a bank while the device runs them, and repeated operations
+// with the same key keep its schedule in the device.
+struct cc_ring
+{
+	void *mem;		// vmalloc_user, mapped by user space
+	size_t size;
+	struct cc_ring_hdr *hdr;
+	struct cc_sqe *sqes;
+	struct cc_cqe *cqes;
+	// the driver's own copies of the sizes and of its indices: user space
+	// can write the whole header
+	u32 sq_entries;
+	u32 cq_entries;
+	u32 sq_head;
+	u32 cq_tail;
+
+	struct eventfd_ctx *eventfd;
+
+	// CC_RING_SQPOLL
+	struct task_struct *sqpoll;
+	struct mm_struct *mm;	// of the process that set up the ring
+	wait_queue_head_t wait;
+	unsigned long idle;	// jiffies
+};
+
+struct cc_file
+{
+	struct crypto_core *ct;
+	struct mutex lock;	// one batch or ring run at a time through buf
+	void *buf;		// data of the operation, followed by its AAD
+	dma_addr_t buf_dma;
+	struct cc_bank *buf_bank;	// set while a timed out job may still write buf
+	u32 slot;
+	struct cc_ring *ring;	// set once by CC_IOC_RING_SETUP
+};
+
+static bool cc_op_has_tag(u32 format)
+{
+	return format == FORMAT_GCM || format == FORMAT_CMAC || format == FORMAT_CBC_MAC ||
+		format == FORMAT_CHACHA20_POLY1305;
+}
+
+static bool cc_op_valid(const struct cc_op *op)
+{
+	bool aead = op->format == FORMAT_GCM || op->format == FORMAT_CHACHA20_POLY1305;
+
+	if(op->format > FORMAT_CHACHA20_POLY1305 || op->format == FORMAT_SHA256 || op->mode > 1)
+	{
+		return false;
+	}
+	if(op->key_len != 128 && op->key_len != 192 && op->key_len != 256)
+	{
+		return false;
+	}
+	if(op->format == FORMAT_CHACHA20_POLY1305 && op->key_len != 256)
+	{
+		return false;
+	}
+	if(!aead && op->aad_len != 0)
+	{
+		return false;
+	}
+	// a job with no length runs on the IN/OUT registers instead of by DMA
+	return op->len != 0 && (u64)op->len + op->aad_len <= CC_OP_MAX_LEN;
+}
+
+// Runs op on the data in cf->buf; the IV and tag of op are updated in place.
+static u32 cc_dev_run_op(struct cc_file *cf, struct cc_op *op)
+{
+	bool tag = cc_op_has_tag(op->format);
+	u8 last[AES_BLOCK_SIZE];
+	struct cc_bank *bank;
+	unsigned int i;
+	u32 status;
+
+	if(op->format == FORMAT_CBC && op->mode == 1)
+	{
+		memcpy(last, cf->buf + round_down(op->len - 1, AES_BLOCK_SIZE), AES_BLOCK_SIZE);
+	}
+
+	bank = cc_get_bank(cf->ct);
+	if(!bank)
+	{
+		return CC_STATUS_TIMEOUT;
+	}
+
+	writel(cf->slot, bank->base + REG_KEY_SLOT);
+	writel(op->key_len, bank->base + REG_KEY_LEN);
+	cc_write_key(bank, REG_KEY_0, op->key, op->key_len / 8);
+	if(op->format == FORMAT_XTS)
+	{
+		cc_write_key(bank, REG_KEY2_0, op->key2, op->key_len / 8);
+		writel(0, bank->base + REG_SECTOR_SIZE);
+	}
+	cc_write_iv(bank, op->iv);
+	writeq(cf->buf_dma + op->len, bank->base + REG_AAD_ADDR);
+	writeq(op->aad_len, bank->base + REG_AAD_LEN);
+	if(tag && op->mode == 1)
+	{
+		for(i = 0; i < 4; i += 1)
+		{
+			writel(get_unaligned_le32(op->tag + i*4), bank->base + REG_TAG_0 + i*8);
+		}
+	}
+
+	status = cc_run_job_at(bank, cf->buf_dma, op->len, op->mode, op->format);
+	if(status == U32_MAX)
+	{
+		cf->buf_bank = bank;
+	}
+	if(!status && tag && op->mode == 0)
+	{
+		for(i = 0; i < 4; i += 1)
+		{
+			put_unaligned_le32(readl(bank->base + REG_TAG_0 + i*8), op->tag + i*4);
+		}
+	}
+	writeq(0, bank->base + REG_AAD_LEN);
+
+	cc_put_bank(bank);
+
+	if(!status && op->format == FORMAT_CBC)
+	{
+		if(op->mode == 0)
+		{
+			memcpy(last, cf->buf + round_down(op->len - 1, AES_BLOCK_SIZE), AES_BLOCK_SIZE);
+		}
+		memcpy(op->iv, last, AES_BLOCK_SIZE);
+	}
+	if(!status && op->format == FORMAT_CTR)
+	{
+		cc_ctr_add(op->iv, DIV_ROUND_UP(op->len, AES_BLOCK_SIZE));
+	}
+	return status;
+}
+
+// False while the bank of a timed out job of this file may still write cf->buf.
+static bool cc_dev_buf_free(struct cc_file *cf)
+{
+	if(!cf->buf_bank)
+	{
+		return true;
+	}
+	if(!cc_lock_bank(cf->buf_bank))
+	{
+		return false;
+	}
+	cc_put_bank(cf->buf_bank);
+	cf->buf_bank = NULL;
+	return true;
+}
+
+// Copies the data of op in, runs it and copies the result out. Called with
+// cf->lock held. A device error is left in op->status and is not an error here.
+static int cc_dev_op(struct cc_file *cf, struct cc_op *op)
+{
+	if(!cc_op_valid(op))
+	{
+		return -EINVAL;
+	}
+	if(!cc_dev_buf_free(cf))
+	{
+		op->status = CC_STATUS_TIMEOUT;
+		return 0;
+	}
+	if(copy_from_user(cf->buf, u64_to_user_ptr(op->in), op->len) ||
+		copy_from_user(cf->buf + op->len, u64_to_user_ptr(op->aad), op->aad_len))
+	{
+		return -EFAULT;
+	}
+	op->status = cc_dev_run_op(cf, op);
+	if(!op->status && op->format != FORMAT_CMAC && op->format != FORMAT_CBC_MAC &&
+		copy_to_user(u64_to_user_ptr(op->out), cf->buf, op->len))
+	{
+		return -EFAULT;
+	}
+	return 0;
+}
+
+// CC_IOC_BATCH: the operations run in order. A device error only sets the
+// status of its operation; a bad operation or address stops the batch there.
+static long cc_dev_batch(struct cc_file *cf, struct cc_batch __user *ubatch)
+{
+	struct cc_op __user *uops;
+	struct cc_batch batch;
+	struct cc_op op;
+	long err = 0;
+
+	if(copy_from_user(&batch, ubatch, sizeof(batch)))
+	{
+		return -EFAULT;
+	}
+	if(batch.count > CC_BATCH_MAX)
+	{
+		return -EINVAL;
+	}
+	uops = u64_to_user_ptr(batch.ops);
+
+	mutex_lock(&cf->lock);
+	for(batch.done = 0; batch.done < batch.count; batch.done += 1)
+	{
+		if(copy_from_user(&op, &uops[batch.done], sizeof(op)))
+		{
+			err = -EFAULT;
+			break;
+		}
+		err = cc_dev_op(cf, &op);
+		if(err)
+		{
+			break;
+		}
+		if(copy_to_user(&uops[batch.done], &op, sizeof(op)))
+		{
+			err = -EFAULT;
+			break;
+		}
+	}
+	mutex_unlock(&cf->lock);
+	memzero_explicit(&op, sizeof(op));
+
+	if(put_user(batch.done, &ubatch->done))
+	{
+		return -EFAULT;
+	}
+	return err;
+}
+
+// Runs the SQ entries submitted so far, as long as the CQ has room for their
+// completions, and publishes both indices once at the end. Returns how many
+// ran. Called with cf->lock held, in the context of the process that owns
+// the buffers of the operations (or a kthread that adopted its mm).
+static int cc_ring_run(struct cc_file *cf)
+{
+	struct cc_ring *ring = cf->ring;
+	struct cc_ring_hdr *hdr = ring->hdr;
+	u32 sq_mask = ring->sq_entries - 1, cq_mask = ring->cq_entries - 1;
+	u32 sq_tail = smp_load_acquire(&hdr->sq_tail);
+	u32 cq_head = smp_load_acquire(&hdr->cq_head);
+	struct cc_cqe *cqe;
+	struct cc_sqe sqe;
+	int done = 0;
+
+	while(ring->sq_head != sq_tail && ring->cq_tail - cq_head < ring->cq_entries)
+	{
+		// the entry is shared with user space, check and use a private copy
+		memcpy(&sqe, &ring->sqes[ring->sq_head & sq_mask], sizeof(sqe));
+		cqe = &ring->cqes[ring->cq_tail & cq_mask];
+		cqe->user_data = sqe.user_data;
+		sqe.op.status = 0;
+		cqe->res = cc_dev_op(cf, &sqe.op);
+		cqe->status = sqe.op.status;
+		memcpy(cqe->iv, sqe.op.iv, sizeof(cqe->iv));
+		memcpy(cqe->tag, sqe.op.tag, sizeof(cqe->tag));
+		ring->sq_head += 1;
+		ring->cq_tail += 1;
+		done += 1;
+	}
+	memzero_explicit(&sqe, sizeof(sqe));
+
+	if(done)
+	{
+		smp_store_release(&hdr->sq_head, ring->sq_head);
+		smp_store_release(&hdr->cq_tail, ring->cq_tail);
+		if(ring->eventfd)
+		{
+			eventfd_signal(ring->eventfd, done);
+		}
+	}
+	return done;
+}
+
+static bool cc_ring_pending(struct cc_ring *ring)
+{
+	return ring->sq_head != smp_load_acquire(&ring->hdr->sq_tail);
+}
+
+// CC_RING_SQPOLL: runs the SQ with the mm of the process that set it up, so
+// the addresses in the operations are resolved as in CC_IOC_BATCH.
+static int cc_sqpoll_thread(void *data)
+{
+	struct cc_file *cf = data;
+	struct cc_ring *ring = cf->ring;
+	unsigned long idle_end = jiffies + ring->idle;
+	int done;
+
+	while(!kthread_should_stop())
+	{
+		if(cc_ring_pending(ring))
+		{
+			if(!mmget_not_zero(ring->mm))
+			{
+				// the process is exiting, nothing left to run for it
+				wait_event_interruptible(ring->wait, kthread_should_stop());
+				break;
+			}
+			kthread_use_mm(ring->mm);
+			mutex_lock(&cf->lock);
+			done = cc_ring_run(cf);
+			mutex_unlock(&cf->lock);
+			kthread_unuse_mm(ring->mm);
+			mmput(ring->mm);
+			if(done)
+			{
+				idle_end = jiffies + ring->idle;
+				cond_resched();
+			} else
+			{
+				// CQ full: wait for user space to reap it
+				schedule_timeout_interruptible(1);
+			}
+			continue;
+		}
+		if(time_before(jiffies, idle_end))
+		{
+			cond_resched();
+			continue;
+		}
+
+		// from here on user space has to call CC_IOC_RING_ENTER after submitting
+		WRITE_ONCE(ring->hdr->sq_flags, CC_SQ_NEED_WAKEUP);
+		smp_mb();
+		wait_event_interruptible(ring->wait, cc_ring_pending(ring) || kthread_should_stop());
+		WRITE_ONCE(ring->hdr->sq_flags, 0);
+		idle_end = jiffies + ring->idle;
+	}
+	return 0;
+}
+
+static void cc_ring_free(struct cc_ring *ring)
+{
+	if(ring->sqpoll)
+	{
+		kthread_stop(ring->sqpoll);
+	}
+	if(ring->mm)
+	{
+		mmdrop(ring->mm);
+	}
+	if(ring->eventfd)
+	{
+		eventfd_ctx_put(ring->eventfd);
+	}
+	vfree(ring->mem);
+	kfree(ring);
+}
+
+static long cc_ring_setup(struct cc_file *cf, struct cc_ring_params __user *uparams)
+{
+	struct cc_ring_params params;
+	struct cc_ring *ring;
+	long err;
+
+	if(copy_from_user(&params, uparams, sizeof(params)))
+	{
+		return -EFAULT;
+	}
+	if(!is_power_of_2(params.entries) || params.entries > CC_RING_MAX_ENTRIES ||
+		params.flags & ~CC_RING_SQPOLL)
+	{
+		return -EINVAL;
+	}
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if(!ring)
+	{
+		return -ENOMEM;
+	}
+	init_waitqueue_head(&ring->wait);
+	params.sq_off = ALIGN(sizeof(struct cc_ring_hdr), 64);
+	params.cq_off = ALIGN(params.sq_off + params.entries * sizeof(struct cc_sqe), 64);
+	params.size = PAGE_ALIGN(params.cq_off + 2 * params.entries * sizeof(struct cc_cqe));
+	ring->size = params.size;
+	ring->mem = vmalloc_user(ring->size);
+	if(!ring->mem)
+	{
+		kfree(ring);
+		return -ENOMEM;
+	}
+	ring->hdr = ring->mem;
+	ring->sqes = ring->mem + params.sq_off;
+	ring->cqes = ring->mem + params.cq_off;
+	ring->sq_entries = params.entries;
+	ring->cq_entries = 2 * params.entries;
+	ring->hdr->sq_entries = ring->sq_entries;
+	ring->hdr->cq_entries = ring->cq_entries;
+
+	if(params.eventfd >= 0)
+	{
+		ring->eventfd = eventfd_ctx_fdget(params.eventfd);
+		if(IS_ERR(ring->eventfd))
+		{
+			err = PTR_ERR(ring->eventfd);
+			ring->eventfd = NULL;
+			cc_ring_free(ring);
+			return err;
+		}
+	}
+
+	mutex_lock(&cf->lock);
+	if(cf->ring)
+	{
+		mutex_unlock(&cf->lock);
+		cc_ring_free(ring);
+		return -EBUSY;
+	}
+	cf->ring = ring;
+	if(params.flags & CC_RING_SQPOLL)
+	{
+		ring->idle = msecs_to_jiffies(params.sq_idle_ms ? params.sq_idle_ms : 1000);
+		mmgrab(current->mm);
+		ring->mm = current->mm;
+		ring->sqpoll = kthread_run(cc_sqpoll_thread, cf, "cryptocore-sq");
+		if(IS_ERR(ring->sqpoll))
+		{
+			err = PTR_ERR(ring->sqpoll);
+			ring->sqpoll = NULL;
+			cf->ring = NULL;
+			mutex_unlock(&cf->lock);
+			cc_ring_free(ring);
+			return err;
+		}
+	}
+	mutex_unlock(&cf->lock);
+
+	if(copy_to_user(uparams, &params, sizeof(params)))
+	{
+		return -EFAULT;
+	}
+	return 0;
+}
+
+// CC_IOC_RING_ENTER: runs the SQ, or wakes the polling thread up.
+static long cc_ring_enter(struct cc_file *cf)
+{
+	struct cc_ring *ring;
+	long done;
+
+	mutex_lock(&cf->lock);
+	ring = cf->ring;
+	if(!ring)
+	{
+		mutex_unlock(&cf->lock);
+		return -ENXIO;
+	}
+	if(ring->sqpoll)
+	{
+		mutex_unlock(&cf->lock);
+		wake_up(&ring->wait);
+		return 0;
+	}
+	done = cc_ring_run(cf);
+	mutex_unlock(&cf->lock);
+	return done;
+}
+
+static long cc_dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	switch(cmd)
+	{
+		case CC_IOC_BATCH:
+			return cc_dev_batch(file->private_data, (struct cc_batch __user *)arg);
+		case CC_IOC_RING_SETUP:
+			return cc_ring_setup(file->private_data, (struct cc_ring_params __user *)arg);
+		case CC_IOC_RING_ENTER:
+			return cc_ring_enter(file->private_data);
+		default:
+			return -ENOTTY;
+	}
+}
+
+static int cc_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct cc_file *cf = file->private_data;
+	struct cc_ring *ring;
+	int err = -ENXIO;
+
+	mutex_lock(&cf->lock);
+	ring = cf->ring;
+	if(ring)
+	{
+		err = -EINVAL;
+		if(vma->vm_pgoff == 0 && vma->vm_end - vma->vm_start <= ring->size)
+		{
+			err = remap_vmalloc_range(vma, ring->mem, 0);
+		}
+	}
+	mutex_unlock(&cf->lock);
+	return err;
+}
+
+static int cc_dev_open(struct inode *inode, struct file *file)
+{
+	struct crypto_core *ct = container_of(file->private_data, struct crypto_core, misc);
+	struct cc_file *cf;
+
+	cf = kzalloc(sizeof(*cf), GFP_KERNEL);
+	if(!cf)
+	{
+		return -ENOMEM;
+	}
+	cf->buf = dma_alloc_coherent(ct->dev, CC_OP_MAX_LEN, &cf->buf_dma, GFP_KERNEL);
+	if(!cf->buf)
+	{
+		kfree(cf);
+		return -ENOMEM;
+	}
+	cf->ct = ct;
+	mutex_init(&cf->lock);
+	cf->slot = (u32)atomic_inc_return(&cc_next_slot) % CC_KEY_SLOTS;
+	file->private_data = cf;
+	return 0;
+}
+
+static int cc_dev_release(struct inode *inode, struct file *file)
+{
+	struct cc_file *cf = file->private_data;
+
+	if(cf->ring)
+	{
+		cc_ring_free(cf->ring);
+	}
+	if(cc_dev_buf_free(cf))
+	{
+		memzero_explicit(cf->buf, CC_OP_MAX_LEN);
+		dma_free_coherent(cf->ct->dev, CC_OP_MAX_LEN, cf->buf, cf->buf_dma);
+	} else
+	{
+		// the device may still write it: better lost than reused
+		dev_warn(cf->ct->dev, "leaking the DMA buffer of a timed out job\n");
+	}
+	kfree(cf);
+	return 0;
+}
+
+static const struct file_operations cc_dev_fops = {
+	.owner		= THIS_MODULE,
+	.open		= cc_dev_open,
+	.release	= cc_dev_release,
+	.unlocked_ioctl	= cc_dev_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
+	.mmap		= cc_dev_mmap,
+};
+
+static void cc_engines_exit(void *data)
+{
+	struct crypto_core *ct = data;
+	unsigned int i;
+
+	for(i = 0; i < ct->nbanks; i += 1)
+	{
+		if(ct->banks[i].engine)
+		{
+			crypto_engine_exit(ct->banks[i].engine);
+		}
+	}
+}
+
+static int ct_init(struct crypto_core *ct)
+{
+	struct cc_bank *bank;
+	unsigned int i;
+	u32 n;
+	int err;
+
+	if(dma_set_mask_and_coherent(ct->dev, DMA_BIT_MASK(64)))
+	{
+		return -EIO;
+	}
+	// a device from before the banks has a single one and no REG_BANK_COUNT
+	n = readl(ct->base + REG_BANK_COUNT);
+	ct->nbanks = n == CC_NO_REG ? 1 : clamp_t(unsigned int, n, 1, CC_BANKS);
+	for(i = 0; i < ct->nbanks; i += 1)
+	{
+		bank = &ct->banks[i];
+		bank->base = ct->base + i * CC_BANK_SIZE;
+		mutex_init(&bank->lock);
+		bank->bounce = dmam_alloc_coherent(ct->dev, CC_BOUNCE_SIZE, &bank->bounce_dma, GFP_KERNEL);
+		if(!bank->bounce)
+		{
+			return -ENOMEM;
+		}
+	}
+	err = devm_add_action_or_reset(ct->dev, cc_engines_exit, ct);
+	if(err)
+	{
+		return err;
+	}
+	for(i = cc_first_api_bank(ct); i < ct->nbanks; i += 1)
+	{
+		bank = &ct->banks[i];
+		bank->engine = crypto_engine_alloc_init_and_set(ct->dev, false, NULL, true, CC_ENGINE_QLEN);
+		if(!bank->engine)
+		{
+			return -ENOMEM;
+		}
+		err = crypto_engine_start(bank->engine);
+		if(err)
+		{
+			return err;
+		}
+	}
+	// the sysfs register interface does not wait for VALID, keep its jobs in the latency class
+	writel(1, ct->base + REG_BANK_PRIO);
+	ct->rng.name = "crypto-core";
+	ct->rng.read = cc_rng_read;
+	ct->misc.minor = MISC_DYNAMIC_MINOR;
+	ct->misc.name = "cryptocore";
+	ct->misc.fops = &cc_dev_fops;
+	ct->misc.parent = ct->dev;
+	return 0;
 }
 
 static int ct_probe(struct platform_device *pdev)
@@ -556,6 +1973,7 @@ static int ct_probe(struct platform_device *pdev)
 	struct device *dev = &pdev->dev;
 	//struct resource *res;
 	struct crypto_core *ct;
+	int err;
 	ct = devm_kzalloc(dev, sizeof(*ct), GFP_KERNEL);
 	if(!ct)
 	{
@@ -568,14 +1986,57 @@ static int ct_probe(struct platform_device *pdev)
 		return -EINVAL;
 	}
 	platform_set_drvdata(pdev, ct);
-	ct_init(ct);
+	err = ct_init(ct);
+	if(err)
+	{
+		return err;
+	}
+	err = devm_hwrng_register(dev, &ct->rng);
+	if(err)
+	{
+		return err;
+	}
+	err = sysfs_create_group(&dev->kobj, &ct_attr_group);
+	if(err)
+	{
+		return err;
+	}
+	cc_dev = ct;
+	err = cc_register_skciphers();
+	if(err)
+	{
+		cc_dev = NULL;
+		sysfs_remove_group(&dev->kobj, &ct_attr_group);
+		return err;
+	}
+	err = crypto_register_ahash(&cc_sha256_alg);
+	if(err)
+	{
+		cc_unregister_skciphers(ARRAY_SIZE(cc_skcipher_algs));
+		cc_dev = NULL;
+		sysfs_remove_group(&dev->kobj, &ct_attr_group);
+		return err;
+	}
+	err = misc_register(&ct->misc);
+	if(err)
+	{
+		crypto_unregister_ahash(&cc_sha256_alg);
+		cc_unregister_skciphers(ARRAY_SIZE(cc_skcipher_algs));
+		cc_dev = NULL;
+		sysfs_remove_group(&dev->kobj, &ct_attr_group);
+		return err;
+	}
 	printk(KERN_INFO "Driver loaded!\n");
-	return sysfs_create_group(&dev->kobj, &ct_attr_group);
+	return 0;
 }
 
 static int ct_remove(struct platform_device *pdev)
 {
 	struct crypto_core *ct = platform_get_drvdata(pdev);
+	misc_deregister(&ct->misc);
+	crypto_unregister_ahash(&cc_sha256_alg);
+	cc_unregister_skciphers(ARRAY_SIZE(cc_skcipher_algs));
+	cc_dev = NULL;
 	sysfs_remove_group(&ct->dev->kobj, &ct_attr_group);
 	return 0;
 }
@@ -0,0 +1,109 @@
+#ifndef CRYPTO_CORE_H
+#define CRYPTO_CORE_H
+
+// Interface of /dev/cryptocore, shared by the driver and user programs.
+// CC_IOC_BATCH runs an array of operations through the device in one
+// system call; each one is a DMA job of the device with its own key, IV,
+// mode and format. The same operations can also be queued on shared rings.
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define CC_DEV_PATH	"/dev/cryptocore"
+
+#define CC_OP_MAX_LEN	(64 * 1024)	// len + aad_len of one operation
+#define CC_BATCH_MAX	1024		// operations per CC_IOC_BATCH
+
+// cc_op.status
+#define CC_STATUS_AUTH_FAIL	(1 << 0)	// tag mismatch, nothing was written
+#define CC_STATUS_DMA_ERROR	(1 << 1)
+#define CC_STATUS_BAD_LEN	(1 << 2)	// length not allowed for the format
+#define CC_STATUS_TIMEOUT	0xFFFFFFFF	// the device did not answer
+
+struct cc_op
+{
+	__u32 format;	// as the format register: 0 ECB, 1 CBC, 2 CTR, 3 GCM, 4 XTS, 5 CMAC, 6 CBC-MAC, 8 ChaCha20-Poly1305
+	__u32 mode;	// 0 to encrypt (or compute the tag), 1 to decrypt (or verify it)
+	__u32 key_len;	// 128, 192 or 256 bits; ChaCha20-Poly1305 takes 256
+	__u32 len;	// bytes at in and out; out is not written by CMAC and CBC-MAC
+	__u8 key[32];
+	__u8 key2[32];	// XTS tweak key, same length as key
+	__u8 iv[16];	// CBC and CTR get back the chaining value for the next operation
+	__u8 tag[16];	// written by mode 0, expected by mode 1 (GCM, CMAC, CBC-MAC, ChaCha20-Poly1305)
+	__u64 in;	// user addresses
+	__u64 out;
+	__u64 aad;	// GCM and ChaCha20-Poly1305 only
+	__u32 aad_len;
+	__u32 status;	// out: STATUS_* bits of the device, 0 on success
+};
+
+struct cc_batch
+{
+	__u64 ops;	// user address of count struct cc_op
+	__u32 count;
+	__u32 done;	// out: operations run, the status of each one is in its cc_op
+};
+
+// Rings: CC_IOC_RING_SETUP gives the file a submission queue (SQ) of struct
+// cc_sqe and a completion queue (CQ) of struct cc_cqe, both mapped with
+// mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0). User space
+// fills SQ entries and advances sq_tail; the driver runs them in order,
+// advances sq_head and appends one CQ entry per operation at cq_tail.
+// Indices run freely and are taken modulo the number of entries; the side
+// that writes an index publishes it with a release store.
+//
+// Without CC_RING_SQPOLL, CC_IOC_RING_ENTER runs whatever is in the SQ.
+// With it a kernel thread polls the SQ and user space makes no system calls
+// while it is busy; after sq_idle_ms without work the thread sets
+// CC_SQ_NEED_WAKEUP in sq_flags and sleeps until CC_IOC_RING_ENTER.
+
+#define CC_RING_MAX_ENTRIES	4096
+
+#define CC_RING_SQPOLL		(1 << 0)	// cc_ring_params.flags
+#define CC_SQ_NEED_WAKEUP	(1 << 0)	// cc_ring_hdr.sq_flags
+
+struct cc_ring_params
+{
+	__u32 entries;		// SQ entries, a power of 2; the CQ has twice as many
+	__u32 flags;		// CC_RING_*
+	__s32 eventfd;		// signalled after every run of completions, -1 for none
+	__u32 sq_idle_ms;	// CC_RING_SQPOLL: polling time before sleeping, 0 for 1000
+	__u32 sq_off;		// out: offsets of the rings in the mapping
+	__u32 cq_off;
+	__u64 size;		// out: length of the mapping
+};
+
+// at offset 0 of the mapping
+struct cc_ring_hdr
+{
+	__u32 sq_head;		// written by the driver
+	__u32 sq_tail;		// written by user space
+	__u32 sq_flags;		// written by the driver
+	__u32 sq_entries;
+	__u32 cq_head;		// written by user space
+	__u32 cq_tail;		// written by the driver
+	__u32 cq_entries;
+	__u32 resv;
+};
+
+struct cc_sqe
+{
+	struct cc_op op;	// op.status, op.iv and op.tag are not written back
+	__u64 user_data;	// copied to the completion
+};
+
+struct cc_cqe
+{
+	__u64 user_data;
+	__s32 res;		// 0, or -EINVAL / -EFAULT if the operation did not run
+	__u32 status;		// as cc_op.status
+	__u8 iv[16];		// as cc_op.iv and cc_op.tag after the operation
+	__u8 tag[16];
+};
+
+#define CC_IOC_MAGIC	'c'
+#define CC_IOC_BATCH	_IOWR(CC_IOC_MAGIC, 1, struct cc_batch)
+#define CC_IOC_RING_SETUP	_IOWR(CC_IOC_MAGIC, 2, struct cc_ring_params)
+#define CC_IOC_RING_ENTER	_IO(CC_IOC_MAGIC, 3)
+
+#endif
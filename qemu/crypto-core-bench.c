@@ -0,0 +1,252 @@
+/*
+ * MMIO benchmark of the crypto_core device, driven through its register
+ * protocol with libqtest: no guest kernel, no driver, only QEMU.
+ *
+ * Without arguments it runs a smoke test of every format. With -m perf it
+ * also measures, for every format and with or without a key change before
+ * each START, the operations per second and the time per START as seen by
+ * the register interface, and the host time the device spent in the cipher
+ * code (REG_STAT_CIPHER_NS) over the same jobs. Jobs of 16 bytes go through
+ * the IN/OUT registers, longer ones by DMA from guest RAM.
+ *
+ * Every register access is a qtest round trip, so the absolute times are
+ * those of the qtest socket; "mmio" gives the cost of one access to compare.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "hw/misc/crypto_core_regs.h"
+
+#define CC_BASE		0x8000000	// VIRT_CRYPTO_CORE in hw/riscv/virt.c
+#define CC_RAM		0x80000000	// guest RAM, source and destination of the DMA jobs
+#define CC_BUF_SIZE	4096
+
+#define BENCH_SECONDS	0.2	// per case
+
+typedef struct BenchFormat
+{
+	const char *name;
+	uint32_t format;
+	bool keyed;	// takes its key from the key registers
+	bool regs;	// also runs on the IN/OUT registers
+} BenchFormat;
+
+static const BenchFormat bench_formats[] = {
+	{ "ecb", FORMAT_ECB, true, true },
+	{ "cbc", FORMAT_CBC, true, true },
+	{ "ctr", FORMAT_CTR, true, true },
+	{ "gcm", FORMAT_GCM, true, false },
+	{ "xts", FORMAT_XTS, true, false },
+	{ "cmac", FORMAT_CMAC, true, false },
+	{ "cbc-mac", FORMAT_CBC_MAC, true, false },
+	{ "sha256", FORMAT_SHA256, false, false },
+	{ "chacha20-poly1305", FORMAT_CHACHA20_POLY1305, true, false },
+	{ "drbg", FORMAT_DRBG, false, false },
+	{ "keyload", FORMAT_KEYLOAD, false, false },
+};
+
+static const uint32_t bench_lens[] = { 0, 64, CC_BUF_SIZE };	// 0 = IN/OUT registers
+
+typedef struct BenchCase
+{
+	const BenchFormat *fmt;
+	uint32_t len;
+	bool rekey;
+} BenchCase;
+
+static const uint32_t in_regs[4] = { REG_IN_0, REG_IN_1, REG_IN_2, REG_IN_3 };
+static const uint32_t out_regs[4] = { REG_OUT_0, REG_OUT_1, REG_OUT_2, REG_OUT_3 };
+
+static QTestState *qts;
+
+static void cc_writel(uint32_t reg, uint32_t value)
+{
+	qtest_writel(qts, CC_BASE + reg, value);
+}
+
+static uint32_t cc_readl(uint32_t reg)
+{
+	return qtest_readl(qts, CC_BASE + reg);
+}
+
+// Job registers for fmt: AES-256 keys, MODE 0, one data unit, a whole message.
+static void cc_setup(const BenchFormat *fmt, uint32_t len)
+{
+	int i;
+
+	for(i = 0; i < 8; i++)
+	{
+		cc_writel(REG_KEY_0 + i * 8, 0x03020100u + i * 0x04040404u);
+		cc_writel(REG_KEY2_0 + i * 8, 0x13121110u + i * 0x04040404u);
+	}
+	for(i = 0; i < 4; i++)
+	{
+		cc_writel(REG_IV_0 + i * 8, 0);
+		cc_writel(in_regs[i], 0x33221100u + i * 0x44444444u);
+	}
+	cc_writel(REG_KEY_LEN, 256);
+	cc_writel(REG_KEY_SLOT, 0);
+	cc_writel(REG_MODE, 0);
+	cc_writel(REG_FORMAT, fmt->format);
+	cc_writel(REG_HASH_CTRL, HASH_INIT | HASH_FINAL);
+	qtest_writeq(qts, CC_BASE + REG_SECTOR_SIZE, 0);
+	qtest_writeq(qts, CC_BASE + REG_AAD_LEN, 0);
+	qtest_writeq(qts, CC_BASE + REG_SRC_ADDR, CC_RAM);
+	qtest_writeq(qts, CC_BASE + REG_DST_ADDR, CC_RAM + CC_BUF_SIZE);
+	qtest_writeq(qts, CC_BASE + REG_LEN, len);
+}
+
+// One operation as a driver does it: START, poll VALID, collect the result.
+static uint32_t cc_op(const BenchCase *bc, uint32_t seq)
+{
+	uint32_t status;
+	int i;
+
+	if(bc->rekey)
+	{
+		cc_writel(REG_KEY_0, seq);
+	}
+	if(bc->len == 0)
+	{
+		cc_writel(REG_IN_0, seq);
+	}
+	cc_writel(REG_START, 1);
+	while(!cc_readl(REG_VALID))
+	{
+	}
+	if(bc->len == 0)
+	{
+		for(i = 0; i < 4; i++)
+		{
+			cc_readl(out_regs[i]);
+		}
+	}
+	status = cc_readl(REG_STATUS);
+	cc_writel(REG_START, 0);
+	return status;
+}
+
+static void test_smoke(void)
+{
+	static const uint8_t expect[16] = {
+		0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf,
+		0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89,
+	};	// FIPS-197 C.3
+	uint8_t out[16];
+	BenchCase bc = { 0 };
+	uint32_t v;
+	size_t i;
+	int j;
+
+	g_assert_cmphex(cc_readl(REG_ID), !=, 0);
+
+	bc.fmt = &bench_formats[0];
+	cc_setup(bc.fmt, 0);
+	cc_writel(REG_START, 1);
+	g_assert_cmpuint(cc_readl(REG_VALID), ==, 1);
+	for(j = 0; j < 4; j++)
+	{
+		v = cc_readl(out_regs[j]);
+		out[4 * j] = v;
+		out[4 * j + 1] = v >> 8;
+		out[4 * j + 2] = v >> 16;
+		out[4 * j + 3] = v >> 24;
+	}
+	cc_writel(REG_START, 0);
+	g_assert(memcmp(out, expect, sizeof(out)) == 0);
+
+	for(i = 0; i < G_N_ELEMENTS(bench_formats); i++)
+	{
+		bc.fmt = &bench_formats[i];
+		bc.len = 64;
+		cc_setup(bc.fmt, bc.len);
+		g_assert_cmphex(cc_op(&bc, 0), ==, 0);
+	}
+}
+
+static void test_mmio(void)
+{
+	uint64_t n = 0;
+	double t;
+
+	g_test_timer_start();
+	do
+	{
+		cc_readl(REG_ID);
+		n++;
+	} while((t = g_test_timer_elapsed()) < BENCH_SECONDS);
+	g_test_message("mmio: %.2f us per register access", t * 1e6 / n);
+}
+
+static void test_bench(const void *opaque)
+{
+	const BenchCase *bc = opaque;
+	uint64_t exp0, ns0, n = 0;
+	double t;
+
+	cc_setup(bc->fmt, bc->len);
+	cc_op(bc, 0);	// expand the key once
+	exp0 = qtest_readq(qts, CC_BASE + REG_STAT_KEY_EXPANSIONS);
+	ns0 = qtest_readq(qts, CC_BASE + REG_STAT_CIPHER_NS);
+
+	g_test_timer_start();
+	do
+	{
+		g_assert_cmphex(cc_op(bc, ++n), ==, 0);
+	} while((t = g_test_timer_elapsed()) < BENCH_SECONDS);
+
+	g_test_message("%s %u bytes%s: %.0f ops/s, %.2f us per START, device %.0f ns per job, "
+		"%.2f key expansions per job", bc->fmt->name, bc->len ? bc->len : 16,
+		bc->len ? "" : " (registers)", n / t, t * 1e6 / n,
+		(double)(qtest_readq(qts, CC_BASE + REG_STAT_CIPHER_NS) - ns0) / n,
+		(double)(qtest_readq(qts, CC_BASE + REG_STAT_KEY_EXPANSIONS) - exp0) / n);
+}
+
+int main(int argc, char **argv)
+{
+	BenchCase *bc;
+	size_t i, j;
+	int k, ret;
+
+	g_test_init(&argc, &argv, NULL);
+
+	qtest_add_func("crypto-core/smoke", test_smoke);
+	if(g_test_perf())
+	{
+		qtest_add_func("crypto-core/perf/mmio", test_mmio);
+		for(i = 0; i < G_N_ELEMENTS(bench_formats); i++)
+		{
+			for(j = 0; j < G_N_ELEMENTS(bench_lens); j++)
+			{
+				if(bench_lens[j] == 0 && !bench_formats[i].regs)
+				{
+					continue;
+				}
+				for(k = 0; k < (bench_formats[i].keyed ? 2 : 1); k++)
+				{
+					g_autofree char *path = NULL;
+
+					bc = g_new0(BenchCase, 1);
+					bc->fmt = &bench_formats[i];
+					bc->len = bench_lens[j];
+					bc->rekey = k;
+					if(bc->len)
+					{
+						path = g_strdup_printf("crypto-core/perf/%s/%u/%s", bc->fmt->name,
+							bc->len, bc->rekey ? "rekey" : "samekey");
+					} else
+					{
+						path = g_strdup_printf("crypto-core/perf/%s/regs/%s", bc->fmt->name,
+							bc->rekey ? "rekey" : "samekey");
+					}
+					qtest_add_data_func_full(path, bc, test_bench, g_free);
+				}
+			}
+		}
+	}
+
+	qts = qtest_init("-machine virt -bios none");
+	ret = g_test_run();
+	qtest_quit(qts);
+	return ret;
+}
@@ -1,83 +1,33 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qemu/error-report.h"
 #include "hw/sysbus.h"
+#include "hw/qdev-properties.h"
 #include "hw/misc/crypto_core.h"
-
-#include <string.h> // CBC mode, for memset
-#include <stdint.h>
-#include <stddef.h>
+#include "exec/address-spaces.h"
+#include "qemu/bswap.h"
+#include "sysemu/dma.h"
+#include "qemu/guest-random.h"
+#include "crypto/cipher.h"
+#include "qemu/main-loop.h"
+#include "qemu/sockets.h"
+#include "qemu/timer.h"
+#include "qapi/type-helpers.h"
+#include "monitor/monitor.h"
+#include "trace.h"
+
+#include "crypto_core_aes.h"
+#include "crypto_core_regs.h"
 
 #define TYPE_CRYPTO_CORE "crypto_core"
 
-#define REG_ID 		0x0
-#define REG_MODE 	0x8
-#define REG_FORMAT 	0x10
-#define REG_START	0x18
-#define REG_VALID	0x20
-
-#define REG_KEY_0	0x28
-#define REG_KEY_1	0x30
-#define REG_KEY_2	0x38
-#define REG_KEY_3	0x40
-#define REG_KEY_4	0x48
-#define REG_KEY_5	0x50
-#define REG_KEY_6	0x58
-#define REG_KEY_7	0x60	// each var is 32 bit. The key is 256 bit. So we need 8 vars
-
-#define REG_IV_0	0x68
-#define REG_IV_1	0x70
-#define REG_IV_2	0x78
-#define REG_IV_3	0x80	// IV is 128 bit only (16 byte)
-
-#define REG_IN_0	0x88
-#define REG_IN_1	0x90
-#define REG_IN_2	0x98
-#define REG_IN_3	0x100
-
-#define REG_OUT_0	0x108
-#define REG_OUT_1	0x110
-#define REG_OUT_2	0x118
-#define REG_OUT_3	0x120
-
-#define REG_KEY_CHAR	0x128
-#define REG_IV_CHAR	0x130
-#define REG_IN_CHAR	0x138
-#define REG_OUT_CHAR	0x140
-
-// The number of columns comprising a state in AES. This is a constant in AES. Value=4
-#define CBC 1
-#define ECB 1
-#define CTR 1
-
-#define AES256 1
-#define AES_BLOCKLEN 16
-
-#define AES_KEYLEN 32
-#define AES_keyExpSize 240
-
-#define Nb 4
-
-#if defined(AES256) && (AES256 == 1)
-    #define Nk 8
-    #define Nr 14
-#elif defined(AES192) && (AES192 == 1)
-    #define Nk 6
-    #define Nr 12
-#else
-    #define Nk 4        // The number of 32 bit words in a key.
-    #define Nr 10       // The number of rounds in AES Cipher.
-#endif
-
-// jcallan@github points out that declaring Multiply as a function 
-// reduces code size considerably with the Keil ARM compiler.
-// See this link for more information: https://github.com/kokke/tiny-AES-C/pull/3
-#ifndef MULTIPLY_AS_A_FUNCTION
-  #define MULTIPLY_AS_A_FUNCTION 0
-#endif
+// The key size is selected at run time through REG_KEY_LEN.
+// Nk is the number of 32 bit words in a key, Nr = Nk + 6 the number of rounds.
+#define AES_DEFAULT_KEY_LEN 256
 
 // device variables
-typedef uint8_t state_t[4][4];
 typedef struct CryptoCoreState CryptoCoreState;
+typedef struct CryptoCoreBank CryptoCoreBank;
 DECLARE_INSTANCE_CHECKER(CryptoCoreState, CRYPTO_CORE, TYPE_CRYPTO_CORE)
 
 typedef union
@@ -88,92 +38,39 @@ typedef union
 } regarr;
 
 
-/*****************************************************************************/
-/* Private variables:                                                        */
-/*****************************************************************************/
-// state - array holding the intermediate results during decryption.
-
-
-// The lookup-tables are marked const so they can be placed in read-only storage instead of RAM
-// The numbers below can be computed dynamically trading ROM for RAM - 
-// This can be useful in (embedded) bootloader applications, where ROM is often limited.
-static const uint8_t sbox[256] = {
-  //0     1    2      3     4    5     6     7      8    9     A      B    C     D     E     F
-  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
-  0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
-  0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
-  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
-  0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
-  0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
-  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
-  0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
-  0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
-  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
-  0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
-  0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
-  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
-  0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
-  0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
-  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16 };
-
-#if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
-static const uint8_t rsbox[256] = {
-  0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
-  0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
-  0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
-  0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
-  0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
-  0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
-  0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
-  0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
-  0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
-  0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
-  0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
-  0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
-  0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
-  0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
-  0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
-  0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d };
-#endif
-
-// The round constant word array, Rcon[i], contains the values given by 
-// x to the power (i-1) being powers of x (x is denoted as {02}) in the field GF(2^8)
-static const uint8_t Rcon[11] = {
-  0x8d, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
-
-/*
- * Jordan Goulder points out in PR #12 (https://github.com/kokke/tiny-AES-C/pull/12),
- * that you can remove most of the elements in the Rcon array, because they are unused.
- *
- * From Wikipedia's article on the Rijndael key schedule @ https://en.wikipedia.org/wiki/Rijndael_key_schedule#Rcon
- * 
- * "Only the first some of these constants are actually used – up to rcon[10] for AES-128 (as 11 round keys are needed), 
- *  up to rcon[8] for AES-192, up to rcon[7] for AES-256. rcon[0] is not used in AES algorithm."
- */
-
-
-/*****************************************************************************/
-/* Private functions:                                                        */
-/*****************************************************************************/
-/*
-static uint8_t getSBoxValue(uint8_t num)
-{
-  return sbox[num];
-}
-*/
-#define getSBoxValue(num) (sbox[(num)])
-
-struct AES_ctx
-{
-	uint8_t RoundKey[AES_keyExpSize];
-	uint8_t Iv[AES_BLOCKLEN];
-};
+static const char *const crypto_core_format_names[CC_FORMATS] = CC_FORMAT_NAMES;
 
-struct CryptoCoreState
+// The device keeps CC_KEY_SLOTS expanded keys. START uses the slot selected
+// by REG_KEY_SLOT and only expands the key registers again when they differ
+// from what the slot already holds, so a stream of jobs under the same key
+// pays for KeyExpansion() and the GHASH precomputation once.
+typedef struct CryptoCoreKeySlot
 {
-	SysBusDevice parent_obj;
-	MemoryRegion iomem;
-	uint32_t proc_id;
+	bool valid;
+	bool ghash_valid;
+	bool tweak_valid;
+	bool cmac_valid;
+	unsigned keylen;
+	uint8_t key[AES_KEYLEN];
+	uint8_t key2[AES_KEYLEN];
+	struct AES_ctx ctx;
+	struct AES_ctx tweak;	// KEY2: XTS tweak key or encrypt-then-MAC CMAC key
+	GHashKey ghash;
+	uint8_t cmac_k1[AES_BLOCKLEN];
+	uint8_t cmac_k2[AES_BLOCKLEN];
+	bool hmac_valid;
+	uint8_t hmac_key[AES_KEYLEN];
+	SHA256_ctx hmac_inner;	// states after the ipad and opad blocks
+	SHA256_ctx hmac_outer;
+	// backend=qcrypto: host library ciphers of the key, by format (ECB, CBC,
+	// CTR and XTS), created on the first job that needs them
+	QCryptoCipher *qcipher[FORMAT_XTS + 1];
+} CryptoCoreKeySlot;
+
+// One register bank: everything a job reads or leaves behind.
+struct CryptoCoreBank
+{
+	CryptoCoreState *core;
 	uint32_t mode;
 	uint32_t format;
 	uint32_t valid;
@@ -205,470 +102,1947 @@ struct CryptoCoreState
 	uint32_t out_2;
 	uint32_t out_3;
 	uint32_t out_char;
+
+	uint32_t key_len;
+	uint32_t key_slot;
+	bool key_slot_preloaded;
+
+	uint64_t src_addr;
+	uint64_t dst_addr;
+	uint64_t len;
+	uint64_t aad_addr;
+	uint64_t aad_len;
+
+	uint32_t tag_0;
+	uint32_t tag_1;
+	uint32_t tag_2;
+	uint32_t tag_3;
+
+	uint32_t status;
+
+	uint32_t key2_0;
+	uint32_t key2_1;
+	uint32_t key2_2;
+	uint32_t key2_3;
+	uint32_t key2_4;
+	uint32_t key2_5;
+	uint32_t key2_6;
+	uint32_t key2_7;
+	uint32_t sector_size;
+
+	uint64_t desc_addr;
+	uint32_t desc_count;
+
+	uint32_t hash_ctrl;
+	SHA256_ctx sha;
+
+	uint32_t mac_alg;
+
+	uint64_t ctx_addr;
+	uint32_t ctx_ctrl;
+	// CTR keystream left over from a job that ended inside a block; a
+	// following job continues with it unless the IV was written meanwhile
+	uint8_t ctr_ks[AES_BLOCKLEN];
+	uint32_t ctr_used;
+
+	uint32_t weight;
+	uint32_t prio;
+	// queued job: progress, and the registers the slices move through it
+	bool busy;
+	int64_t deficit;
+	uint64_t job_cost;
+	uint64_t job_done;
+	uint64_t job_unit;	// slice granularity, 0 if the job runs whole
+	uint64_t job_src;	// batches: the descriptors
+	uint64_t job_dst;
+	uint64_t job_len;	// batches: in descriptors
+	uint32_t job_hash_ctrl;
+	uint32_t job_status;	// batches: STATUS_* of the descriptors run so far
+	// host time of the current job, for the traces and the histograms
+	int64_t job_t0;
+	int64_t job_ns;		// running the job, key expansion included
+	int64_t job_key_ns;	// expanding keys
+
+	int64_t ts_submit;
+	int64_t ts_start;
+	int64_t ts_done;
+
+	uint32_t job_key_exp;	// key schedules expanded by the current job
+	uint64_t job_bytes;	// bytes processed by the current job
+	uint32_t wl_gap;	// workload trace: ns since the previous START
+	bool pending;		// done, VALID waits for the timing model
+	QEMUTimer *model_timer;
+	bool remote;		// sent to the remote backend, waiting for CC_REMOTE_DONE
 };
 
-static struct AES_ctx actx;
-static uint8_t key[32];
-static uint8_t vec[16];
-static uint8_t to_enc_dec[16];
-
-// This function produces Nb(Nr+1) round keys. The round keys are used in each round to decrypt the states. 
-static void KeyExpansion(uint8_t* RoundKey, const uint8_t* Key)
-{
-  unsigned i, j, k;
-  uint8_t tempa[4]; // Used for the column/row operations
-  
-  // The first round key is the key itself.
-  for (i = 0; i < Nk; ++i)
-  {
-    RoundKey[(i * 4) + 0] = Key[(i * 4) + 0];
-    RoundKey[(i * 4) + 1] = Key[(i * 4) + 1];
-    RoundKey[(i * 4) + 2] = Key[(i * 4) + 2];
-    RoundKey[(i * 4) + 3] = Key[(i * 4) + 3];
-  }
-
-  // All other round keys are found from the previous round keys.
-  for (i = Nk; i < Nb * (Nr + 1); ++i)
-  {
-    {
-      k = (i - 1) * 4;
-      tempa[0]=RoundKey[k + 0];
-      tempa[1]=RoundKey[k + 1];
-      tempa[2]=RoundKey[k + 2];
-      tempa[3]=RoundKey[k + 3];
-
-    }
-
-    if (i % Nk == 0)
-    {
-      // This function shifts the 4 bytes in a word to the left once.
-      // [a0,a1,a2,a3] becomes [a1,a2,a3,a0]
-
-      // Function RotWord()
-      {
-        const uint8_t u8tmp = tempa[0];
-        tempa[0] = tempa[1];
-        tempa[1] = tempa[2];
-        tempa[2] = tempa[3];
-        tempa[3] = u8tmp;
-      }
-
-      // SubWord() is a function that takes a four-byte input word and 
-      // applies the S-box to each of the four bytes to produce an output word.
-
-      // Function Subword()
-      {
-        tempa[0] = getSBoxValue(tempa[0]);
-        tempa[1] = getSBoxValue(tempa[1]);
-        tempa[2] = getSBoxValue(tempa[2]);
-        tempa[3] = getSBoxValue(tempa[3]);
-      }
-
-      tempa[0] = tempa[0] ^ Rcon[i/Nk];
-    }
-#if defined(AES256) && (AES256 == 1)
-    if (i % Nk == 4)
-    {
-      // Function Subword()
-      {
-        tempa[0] = getSBoxValue(tempa[0]);
-        tempa[1] = getSBoxValue(tempa[1]);
-        tempa[2] = getSBoxValue(tempa[2]);
-        tempa[3] = getSBoxValue(tempa[3]);
-      }
-    }
-#endif
-    j = i * 4; k=(i - Nk) * 4;
-    RoundKey[j + 0] = RoundKey[k + 0] ^ tempa[0];
-    RoundKey[j + 1] = RoundKey[k + 1] ^ tempa[1];
-    RoundKey[j + 2] = RoundKey[k + 2] ^ tempa[2];
-    RoundKey[j + 3] = RoundKey[k + 3] ^ tempa[3];
-  }
-}
-
-//static void AES_init_ctx(struct AES_ctx* ctx, const uint8_t* key)
-//{
-//  KeyExpansion(ctx->RoundKey, key);
-//}
-#if (defined(CBC) && (CBC == 1)) || (defined(CTR) && (CTR == 1))
-static void AES_init_ctx_iv(struct AES_ctx* ctx, const uint8_t* key, const uint8_t* iv)
-{
-  KeyExpansion(ctx->RoundKey, key);
-  memcpy (ctx->Iv, iv, AES_BLOCKLEN);
-}
-//static void AES_ctx_set_iv(struct AES_ctx* ctx, const uint8_t* iv)
-//{
-//  memcpy (ctx->Iv, iv, AES_BLOCKLEN);
-//}
-#endif
-
-// This function adds the round key to state.
-// The round key is added to the state by an XOR function.
-static void AddRoundKey(uint8_t round, state_t* state, const uint8_t* RoundKey)
-{
-  uint8_t i,j;
-  for (i = 0; i < 4; ++i)
-  {
-    for (j = 0; j < 4; ++j)
-    {
-      (*state)[i][j] ^= RoundKey[(round * Nb * 4) + (i * Nb) + j];
-    }
-  }
-}
-
-// The SubBytes Function Substitutes the values in the
-// state matrix with values in an S-box.
-static void SubBytes(state_t* state)
-{
-  uint8_t i, j;
-  for (i = 0; i < 4; ++i)
-  {
-    for (j = 0; j < 4; ++j)
-    {
-      (*state)[j][i] = getSBoxValue((*state)[j][i]);
-    }
-  }
-}
-
-// The ShiftRows() function shifts the rows in the state to the left.
-// Each row is shifted with different offset.
-// Offset = Row number. So the first row is not shifted.
-static void ShiftRows(state_t* state)
-{
-  uint8_t temp;
-
-  // Rotate first row 1 columns to left  
-  temp           = (*state)[0][1];
-  (*state)[0][1] = (*state)[1][1];
-  (*state)[1][1] = (*state)[2][1];
-  (*state)[2][1] = (*state)[3][1];
-  (*state)[3][1] = temp;
-
-  // Rotate second row 2 columns to left  
-  temp           = (*state)[0][2];
-  (*state)[0][2] = (*state)[2][2];
-  (*state)[2][2] = temp;
-
-  temp           = (*state)[1][2];
-  (*state)[1][2] = (*state)[3][2];
-  (*state)[3][2] = temp;
-
-  // Rotate third row 3 columns to left
-  temp           = (*state)[0][3];
-  (*state)[0][3] = (*state)[3][3];
-  (*state)[3][3] = (*state)[2][3];
-  (*state)[2][3] = (*state)[1][3];
-  (*state)[1][3] = temp;
-}
-
-static uint8_t xtime(uint8_t x)
-{
-  return ((x<<1) ^ (((x>>7) & 1) * 0x1b));
-}
-
-// MixColumns function mixes the columns of the state matrix
-static void MixColumns(state_t* state)
-{
-  uint8_t i;
-  uint8_t Tmp, Tm, t;
-  for (i = 0; i < 4; ++i)
-  {  
-    t   = (*state)[i][0];
-    Tmp = (*state)[i][0] ^ (*state)[i][1] ^ (*state)[i][2] ^ (*state)[i][3] ;
-    Tm  = (*state)[i][0] ^ (*state)[i][1] ; Tm = xtime(Tm);  (*state)[i][0] ^= Tm ^ Tmp ;
-    Tm  = (*state)[i][1] ^ (*state)[i][2] ; Tm = xtime(Tm);  (*state)[i][1] ^= Tm ^ Tmp ;
-    Tm  = (*state)[i][2] ^ (*state)[i][3] ; Tm = xtime(Tm);  (*state)[i][2] ^= Tm ^ Tmp ;
-    Tm  = (*state)[i][3] ^ t ;              Tm = xtime(Tm);  (*state)[i][3] ^= Tm ^ Tmp ;
-  }
-}
-
-// Multiply is used to multiply numbers in the field GF(2^8)
-// Note: The last call to xtime() is unneeded, but often ends up generating a smaller binary
-//       The compiler seems to be able to vectorize the operation better this way.
-//       See https://github.com/kokke/tiny-AES-c/pull/34
-#if MULTIPLY_AS_A_FUNCTION
-static uint8_t Multiply(uint8_t x, uint8_t y)
-{
-  return (((y & 1) * x) ^
-       ((y>>1 & 1) * xtime(x)) ^
-       ((y>>2 & 1) * xtime(xtime(x))) ^
-       ((y>>3 & 1) * xtime(xtime(xtime(x)))) ^
-       ((y>>4 & 1) * xtime(xtime(xtime(xtime(x)))))); /* this last call to xtime() can be omitted */
-  }
-#else
-#define Multiply(x, y)                                \
-      (  ((y & 1) * x) ^                              \
-      ((y>>1 & 1) * xtime(x)) ^                       \
-      ((y>>2 & 1) * xtime(xtime(x))) ^                \
-      ((y>>3 & 1) * xtime(xtime(xtime(x)))) ^         \
-      ((y>>4 & 1) * xtime(xtime(xtime(xtime(x))))))   \
-
-#endif
-
-#if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
-/*
-static uint8_t getSBoxInvert(uint8_t num)
-{
-  return rsbox[num];
-}
-*/
-#define getSBoxInvert(num) (rsbox[(num)])
-
-// MixColumns function mixes the columns of the state matrix.
-// The method used to multiply may be difficult to understand for the inexperienced.
-// Please use the references to gain more information.
-static void InvMixColumns(state_t* state)
-{
-  int i;
-  uint8_t a, b, c, d;
-  for (i = 0; i < 4; ++i)
-  { 
-    a = (*state)[i][0];
-    b = (*state)[i][1];
-    c = (*state)[i][2];
-    d = (*state)[i][3];
-
-    (*state)[i][0] = Multiply(a, 0x0e) ^ Multiply(b, 0x0b) ^ Multiply(c, 0x0d) ^ Multiply(d, 0x09);
-    (*state)[i][1] = Multiply(a, 0x09) ^ Multiply(b, 0x0e) ^ Multiply(c, 0x0b) ^ Multiply(d, 0x0d);
-    (*state)[i][2] = Multiply(a, 0x0d) ^ Multiply(b, 0x09) ^ Multiply(c, 0x0e) ^ Multiply(d, 0x0b);
-    (*state)[i][3] = Multiply(a, 0x0b) ^ Multiply(b, 0x0d) ^ Multiply(c, 0x09) ^ Multiply(d, 0x0e);
-  }
-}
-
-
-// The SubBytes Function Substitutes the values in the
-// state matrix with values in an S-box.
-static void InvSubBytes(state_t* state)
-{
-  uint8_t i, j;
-  for (i = 0; i < 4; ++i)
-  {
-    for (j = 0; j < 4; ++j)
-    {
-      (*state)[j][i] = getSBoxInvert((*state)[j][i]);
-    }
-  }
+typedef struct CryptoCoreStats
+{
+	uint64_t starts;
+	uint64_t bytes;
+	uint64_t key_expansions;
+	uint64_t key_hits;
+	uint64_t queue_hwm;
+	uint64_t cipher_ns;
+	uint64_t blocks[CC_FORMATS][2];	// encrypt, decrypt
+	uint64_t latency[CC_FORMATS][CC_LAT_BUCKETS];
+} CryptoCoreStats;
+
+struct CryptoCoreState
+{
+	SysBusDevice parent_obj;
+	MemoryRegion iomem;
+	uint32_t proc_id;
+
+	CryptoCoreBank banks[CRYPTO_CORE_BANKS];
+	CryptoCoreKeySlot key_slots[CC_KEY_SLOTS];
+	DRBG_ctx drbg;
+
+	QEMUBH *sched_bh;
+	unsigned sched_next;	// bank the next round robin pass starts at
+	unsigned queued;	// banks with a queued job
+
+	CryptoCoreStats stats;
+
+	bool model;
+	uint32_t model_setup_ns;
+	uint32_t model_clock_mhz;
+	uint32_t model_key_cycles;
+	uint32_t model_lanes;
+	uint32_t model_cpb[CC_FORMATS];
+	int64_t lane_free[CC_MAX_LANES];	// virtual time each lane finishes its last job
+
+	char *wl_path;
+	FILE *wl_file;
+	int64_t wl_last_submit;
+
+	char *backend;
+	bool qcrypto;		// backend=qcrypto
+
+	char *remote_path;
+	int remote_fd;		// -1 without a remote backend
+	MemoryListener remote_listener;
+	uint8_t remote_table[CC_RMEM_TABLE_SIZE];	// as last sent
+	int remote_fds[CC_REMOTE_MAX_REGIONS];
+	uint8_t remote_next[CC_RMEM_TABLE_SIZE];	// being collected by the listener
+	int remote_next_fds[CC_REMOTE_MAX_REGIONS];
+	uint8_t remote_in[CC_REMOTE_HDR_SIZE + CC_RDONE_SIZE];	// answer being received
+	size_t remote_got;
+};
+
+static void uint32_to_uint8(const uint32_t input32, uint8_t *output8)
+{
+	output8[0] = (uint8_t)(input32 & 0xFF);
+	output8[1] = (uint8_t)((input32 >> 8) & 0xFF);
+	output8[2] = (uint8_t)((input32 >> 16) & 0xFF);
+	output8[3] = (uint8_t)((input32 >> 24) & 0xFF);
+}
+
+static uint32_t uint8_to_uint32(const uint8_t *input8)
+{
+	uint32_t result = 0;
+	result |= (uint32_t)input8[0];
+	result |= ((uint32_t)input8[1] << 8);
+	result |= ((uint32_t)input8[2] << 16);
+	result |= ((uint32_t)input8[3] << 24);
+
+	return result;
+}
+
+
+// REG_KEY_LEN holds the key length in bits; anything else falls back to AES-256.
+static unsigned crypto_core_key_bytes(uint32_t key_len)
+{
+	switch(key_len)
+	{
+		case 128:
+			return 16;
+		case 192:
+			return 24;
+		default:
+			return AES_KEYLEN;
+	}
+}
+
+// All eight key registers as key bytes.
+static void crypto_core_key_regs(CryptoCoreBank *s, uint8_t *key)
+{
+	uint32_to_uint8(s->key_0, key);
+	uint32_to_uint8(s->key_1, key+4);
+	uint32_to_uint8(s->key_2, key+8);
+	uint32_to_uint8(s->key_3, key+12);
+	uint32_to_uint8(s->key_4, key+16);
+	uint32_to_uint8(s->key_5, key+20);
+	uint32_to_uint8(s->key_6, key+24);
+	uint32_to_uint8(s->key_7, key+28);
+}
+
+// Drops the host library cipher of format, or all of them for CC_FORMATS,
+// after the key they were made from changed.
+static void crypto_core_qcipher_reset(CryptoCoreKeySlot *slot, uint32_t format)
+{
+	uint32_t f;
+
+	for(f = 0; f <= FORMAT_XTS; f += 1)
+	{
+		if(format == CC_FORMATS || format == f)
+		{
+			qcrypto_cipher_free(slot->qcipher[f]);
+			slot->qcipher[f] = NULL;
+		}
+	}
+}
+
+// Host library cipher for format under the key of the slot (key || key2 for
+// XTS). NULL if the library cannot do it: the caller then uses the built-in code.
+static QCryptoCipher *crypto_core_qcipher(CryptoCoreKeySlot *slot, uint32_t format)
+{
+	static const QCryptoCipherMode modes[FORMAT_XTS + 1] = {
+		[FORMAT_ECB] = QCRYPTO_CIPHER_MODE_ECB,
+		[FORMAT_CBC] = QCRYPTO_CIPHER_MODE_CBC,
+		[FORMAT_CTR] = QCRYPTO_CIPHER_MODE_CTR,
+		[FORMAT_XTS] = QCRYPTO_CIPHER_MODE_XTS,
+	};
+	QCryptoCipherAlgorithm alg;
+	uint8_t key[2 * AES_KEYLEN];
+	size_t nkey = slot->keylen;
+
+	if(slot->qcipher[format])
+	{
+		return slot->qcipher[format];
+	}
+	switch(slot->keylen)
+	{
+		case 16:
+			alg = QCRYPTO_CIPHER_ALG_AES_128;
+			break;
+		case 24:
+			alg = QCRYPTO_CIPHER_ALG_AES_192;
+			break;
+		default:
+			alg = QCRYPTO_CIPHER_ALG_AES_256;
+			break;
+	}
+	if(!qcrypto_cipher_supports(alg, modes[format]))
+	{
+		return NULL;
+	}
+
+	memcpy(key, slot->key, nkey);
+	if(format == FORMAT_XTS)
+	{
+		memcpy(key + nkey, slot->key2, nkey);
+		nkey *= 2;
+	}
+	slot->qcipher[format] = qcrypto_cipher_new(alg, modes[format], key, nkey, NULL);
+	memset(key, 0, sizeof(key));
+	return slot->qcipher[format];
+}
+
+// Adds blocks to the 128 bit big-endian CTR counter, as the built-in code
+// leaves it after that many blocks.
+static void crypto_core_ctr_add(uint8_t *ctr, uint64_t blocks)
+{
+	int i;
+
+	for(i = AES_BLOCKLEN - 1; i >= 0 && blocks != 0; i -= 1)
+	{
+		blocks += ctr[i];
+		ctr[i] = (uint8_t)blocks;
+		blocks >>= 8;
+	}
+}
+
+// backend=qcrypto: runs the whole blocks at the start of buf through the host
+// library (one data unit for XTS) and leaves ctx->Iv as the built-in code would.
+// Returns the bytes done; the caller runs the rest with the built-in code.
+static size_t crypto_core_qcrypto_crypt(CryptoCoreBank *s, CryptoCoreKeySlot *slot,
+	uint32_t format, uint8_t *buf, size_t length)
+{
+	struct AES_ctx *ctx = &slot->ctx;
+	bool encrypt = s->mode == (uint32_t)0 || format == FORMAT_CTR;
+	uint8_t next_iv[AES_BLOCKLEN];
+	QCryptoCipher *cipher;
+	size_t full = length & ~(size_t)(AES_BLOCKLEN - 1);
+
+	if(!s->core->qcrypto || full == 0 || (format == FORMAT_XTS && full != length))
+	{
+		return 0;
+	}
+	cipher = crypto_core_qcipher(slot, format);
+	if(!cipher)
+	{
+		return 0;
+	}
+
+	if(format != FORMAT_ECB)
+	{
+		qcrypto_cipher_setiv(cipher, ctx->Iv, AES_BLOCKLEN, &error_abort);
+	}
+	if(format == FORMAT_CBC && !encrypt)
+	{
+		memcpy(next_iv, buf + full - AES_BLOCKLEN, AES_BLOCKLEN);
+	}
+	if(encrypt)
+	{
+		qcrypto_cipher_encrypt(cipher, buf, buf, full, &error_abort);
+	} else
+	{
+		qcrypto_cipher_decrypt(cipher, buf, buf, full, &error_abort);
+	}
+
+	switch(format)
+	{
+		case FORMAT_CBC:
+			memcpy(ctx->Iv, encrypt ? buf + full - AES_BLOCKLEN : next_iv, AES_BLOCKLEN);
+			break;
+		case FORMAT_CTR:
+			crypto_core_ctr_add(ctx->Iv, full / AES_BLOCKLEN);
+			break;
+	}
+	return full;
+}
+
+// Returns the key slot selected by REG_KEY_SLOT, expanding the key registers
+// into it only when they differ from the key it already holds.
+static CryptoCoreKeySlot *crypto_core_load_key(CryptoCoreBank *s)
+{
+	CryptoCoreKeySlot *slot = &s->core->key_slots[s->key_slot];
+	unsigned keylen = crypto_core_key_bytes(s->key_len);
+	uint8_t key[AES_KEYLEN];
+	int64_t t0;
+
+	if(s->key_slot_preloaded && slot->valid)
+	{
+		s->core->stats.key_hits += 1;
+		return slot;
+	}
+	crypto_core_key_regs(s, key);
+
+	if(slot->valid && slot->keylen == keylen && memcmp(slot->key, key, keylen) == 0)
+	{
+		s->core->stats.key_hits += 1;
+		return slot;
+	}
+	s->core->stats.key_expansions += 1;
+	s->job_key_exp += 1;
+	t0 = get_clock();
+
+	memcpy(slot->key, key, keylen);
+	slot->keylen = keylen;
+	AES_init_ctx(&slot->ctx, key, keylen);
+	s->job_key_ns += get_clock() - t0;
+	slot->ghash_valid = false;
+	slot->tweak_valid = false;
+	slot->cmac_valid = false;
+	slot->hmac_valid = false;
+	crypto_core_qcipher_reset(slot, CC_FORMATS);
+	slot->valid = true;
+	return slot;
+}
+
+// XTS tweak key of the slot, from the KEY2 registers.
+static const struct AES_ctx *crypto_core_load_tweak_key(CryptoCoreBank *s, CryptoCoreKeySlot *slot)
+{
+	uint8_t key2[AES_KEYLEN];
+	int64_t t0;
+
+	uint32_to_uint8(s->key2_0, key2);
+	uint32_to_uint8(s->key2_1, key2+4);
+	uint32_to_uint8(s->key2_2, key2+8);
+	uint32_to_uint8(s->key2_3, key2+12);
+	uint32_to_uint8(s->key2_4, key2+16);
+	uint32_to_uint8(s->key2_5, key2+20);
+	uint32_to_uint8(s->key2_6, key2+24);
+	uint32_to_uint8(s->key2_7, key2+28);
+
+	if(!slot->tweak_valid || memcmp(slot->key2, key2, slot->keylen) != 0)
+	{
+		t0 = get_clock();
+		memcpy(slot->key2, key2, slot->keylen);
+		AES_init_ctx(&slot->tweak, key2, slot->keylen);
+		crypto_core_qcipher_reset(slot, FORMAT_XTS);
+		slot->tweak_valid = true;
+		s->core->stats.key_expansions += 1;
+		s->job_key_exp += 1;
+		s->job_key_ns += get_clock() - t0;
+	}
+	return &slot->tweak;
+}
+
+// H depends only on the key, so it is computed on the first GCM job of a slot.
+static const GHashKey *crypto_core_ghash_key(CryptoCoreKeySlot *slot)
+{
+	uint8_t H[AES_BLOCKLEN] = { 0 };
+
+	if(!slot->ghash_valid)
+	{
+		slot->ctx.Cipher((state_t*)H, slot->ctx.RoundKey);
+		GHASH_init_key(&slot->ghash, H);
+		slot->ghash_valid = true;
+	}
+	return &slot->ghash;
+}
+
+static bool crypto_core_format_is_mac(uint32_t format)
+{
+	return format == FORMAT_CMAC || format == FORMAT_CBC_MAC;
+}
+
+// Formats that leave the chaining value for a following job in ctx->Iv.
+static bool crypto_core_format_chains(uint32_t format)
+{
+	switch(format)
+	{
+		case FORMAT_ECB:
+		case FORMAT_GCM:
+		case FORMAT_CMAC:
+		case FORMAT_CHACHA20_POLY1305:
+			return false;
+		default:
+			return true;
+	}
+}
+
+// Tag of a MAC format over buf. CBC-MAC starts from the IV and needs whole blocks.
+static uint32_t crypto_core_mac(
+	CryptoCoreBank *s, CryptoCoreKeySlot *slot, const uint8_t *iv,
+	const uint8_t *buf, size_t length, uint8_t *tag
+)
+{
+	struct AES_ctx *ctx = &slot->ctx;
+
+	if(s->format == FORMAT_CBC_MAC)
+	{
+		if(length == 0 || length % AES_BLOCKLEN)
+		{
+			return STATUS_BAD_LEN;
+		}
+		AES_ctx_set_iv(ctx, iv);
+		AES_CBC_MAC_update(ctx, buf, length);
+		memcpy(tag, ctx->Iv, AES_BLOCKLEN);
+		return 0;
+	}
+
+	if(!slot->cmac_valid)
+	{
+		AES_CMAC_subkeys(ctx, slot->cmac_k1, slot->cmac_k2);
+		slot->cmac_valid = true;
+	}
+	AES_CMAC(ctx, slot->cmac_k1, slot->cmac_k2, buf, length, tag);
+	return 0;
+}
+
+// The tag registers as the 16 tag bytes.
+static void crypto_core_get_tag(CryptoCoreBank *s, uint8_t *tag)
+{
+	uint32_to_uint8(s->tag_0, tag);
+	uint32_to_uint8(s->tag_1, tag+4);
+	uint32_to_uint8(s->tag_2, tag+8);
+	uint32_to_uint8(s->tag_3, tag+12);
+}
+
+static void crypto_core_set_tag(CryptoCoreBank *s, const uint8_t *tag)
+{
+	s->tag_0 = uint8_to_uint32(tag);
+	s->tag_1 = uint8_to_uint32(tag+4);
+	s->tag_2 = uint8_to_uint32(tag+8);
+	s->tag_3 = uint8_to_uint32(tag+12);
+}
+
+static bool crypto_core_tag_equal(const uint8_t *a, const uint8_t *b)
+{
+	uint8_t diff = 0;
+	size_t i;
+
+	for(i = 0; i < AES_BLOCKLEN; i += 1)
+	{
+		diff |= a[i] ^ b[i];
+	}
+	return diff == 0;
+}
+
+static bool crypto_core_etm_active(CryptoCoreBank *s)
+{
+	return s->mac_alg != MAC_NONE &&
+		(s->format == FORMAT_CBC || s->format == FORMAT_CTR);
+}
+
+static bool crypto_core_format_is_aead(CryptoCoreBank *s)
+{
+	return s->format == FORMAT_GCM || s->format == FORMAT_CHACHA20_POLY1305 ||
+		crypto_core_etm_active(s);
+}
+
+// HMAC key of the slot, from all eight KEY2 registers.
+static void crypto_core_load_hmac_key(CryptoCoreBank *s, CryptoCoreKeySlot *slot)
+{
+	uint8_t key2[AES_KEYLEN];
+
+	uint32_to_uint8(s->key2_0, key2);
+	uint32_to_uint8(s->key2_1, key2+4);
+	uint32_to_uint8(s->key2_2, key2+8);
+	uint32_to_uint8(s->key2_3, key2+12);
+	uint32_to_uint8(s->key2_4, key2+16);
+	uint32_to_uint8(s->key2_5, key2+20);
+	uint32_to_uint8(s->key2_6, key2+24);
+	uint32_to_uint8(s->key2_7, key2+28);
+
+	if(!slot->hmac_valid || memcmp(slot->hmac_key, key2, AES_KEYLEN) != 0)
+	{
+		memcpy(slot->hmac_key, key2, AES_KEYLEN);
+		HMAC_SHA256_init_key(&slot->hmac_inner, &slot->hmac_outer, key2, AES_KEYLEN);
+		slot->hmac_valid = true;
+	}
+}
+
+// Encrypt-then-MAC job in place on buf: MODE 0 encrypts and writes the tag
+// registers, MODE 1 decrypts and reports STATUS_AUTH_FAIL if the tag differs.
+// The MAC covers IV || AAD || ciphertext || be64(AAD bytes) || be64(ciphertext
+// bytes), so neither the IV nor the split between AAD and data can be changed.
+static uint32_t crypto_core_etm(
+	CryptoCoreBank *s, CryptoCoreKeySlot *slot, const uint8_t *iv,
+	const uint8_t *aad, size_t aad_len, uint8_t *buf, size_t length
+)
+{
+	bool cbc = s->format == FORMAT_CBC;
+	bool encrypt = s->mode == (uint32_t)0;
+	uint8_t tag[AES_BLOCKLEN];
+	uint8_t expected[AES_BLOCKLEN];
+	uint8_t L[AES_BLOCKLEN] = { 0 };
+	uint8_t lens[16];
+	ETM_mac mac;
+
+	if((cbc && length % AES_BLOCKLEN) ||
+		(s->mac_alg != MAC_HMAC_SHA256 && s->mac_alg != MAC_CMAC))
+	{
+		return STATUS_BAD_LEN;
+	}
+
+	memset(&mac, 0, sizeof(mac));
+	mac.alg = s->mac_alg;
+	if(mac.alg == MAC_HMAC_SHA256)
+	{
+		crypto_core_load_hmac_key(s, slot);
+		mac.sha = slot->hmac_inner;
+		mac.outer = &slot->hmac_outer;
+	} else
+	{
+		mac.cmac = crypto_core_load_tweak_key(s, slot);
+		mac.cmac->Cipher((state_t*)L, mac.cmac->RoundKey);
+		CMAC_double(mac.K1, L);
+		CMAC_double(mac.K2, mac.K1);
+	}
+
+	ETM_mac_update(&mac, iv, AES_BLOCKLEN);
+	ETM_mac_update(&mac, aad, aad_len);
+	AES_ETM_crypt_buffer(&slot->ctx, &mac, buf, length, cbc, encrypt);
+	stq_be_p(lens, aad_len);
+	stq_be_p(lens + 8, length);
+	ETM_mac_update(&mac, lens, sizeof(lens));
+	ETM_mac_final(&mac, tag);
+
+	if(encrypt)
+	{
+		crypto_core_set_tag(s, tag);
+		return 0;
+	}
+	crypto_core_get_tag(s, expected);
+	return crypto_core_tag_equal(tag, expected) ? 0 : STATUS_AUTH_FAIL;
+}
+
+// Runs the operation selected by MODE and FORMAT in place on buf.
+// Returns the STATUS_* bits of the result.
+static uint32_t crypto_core_process(
+	CryptoCoreBank *s, CryptoCoreKeySlot *slot, const uint8_t *iv,
+	const uint8_t *aad, size_t aad_len, uint8_t *buf, size_t length
+)
+{
+	struct AES_ctx *ctx = &slot->ctx;
+	const struct AES_ctx *tweak;
+	uint8_t tag[AES_BLOCKLEN];
+	uint8_t expected[AES_BLOCKLEN];
+	uint8_t key[AES_KEYLEN];
+	uint32_t status;
+	size_t i, unit;
+
+	AES_ctx_set_iv(ctx, iv);
+
+	if(crypto_core_format_is_mac(s->format))
+	{
+		status = crypto_core_mac(s, slot, iv, buf, length, tag);
+		if(status)
+		{
+			return status;
+		}
+		if(s->mode == (uint32_t)0)
+		{
+			crypto_core_set_tag(s, tag);
+			return 0;
+		}
+		crypto_core_get_tag(s, expected);
+		return crypto_core_tag_equal(tag, expected) ? 0 : STATUS_AUTH_FAIL;
+	}
+
+	if(crypto_core_etm_active(s))
+	{
+		return crypto_core_etm(s, slot, iv, aad, aad_len, buf, length);
+	}
+
+	switch(s->format)
+	{
+		case FORMAT_ECB:
+			if(length % AES_BLOCKLEN)
+			{
+				return STATUS_BAD_LEN;
+			}
+			for(i = crypto_core_qcrypto_crypt(s, slot, FORMAT_ECB, buf, length); i < length; i += AES_BLOCKLEN)
+			{
+				if(s->mode == (uint32_t)0)
+				{
+					AES_ECB_encrypt(ctx, buf + i);
+				} else
+				{
+					AES_ECB_decrypt(ctx, buf + i);
+				}
+			}
+			break;
+
+		case FORMAT_CBC:
+			if(length % AES_BLOCKLEN)
+			{
+				return STATUS_BAD_LEN;
+			}
+			if(crypto_core_qcrypto_crypt(s, slot, FORMAT_CBC, buf, length) == length)
+			{
+				break;
+			}
+			if(s->mode == (uint32_t)0)
+			{
+				AES_CBC_encrypt_buffer(ctx, buf, length);
+			} else
+			{
+				AES_CBC_decrypt_buffer(ctx, buf, length);
+			}
+			break;
+
+		case FORMAT_GCM:
+			if(s->mode == (uint32_t)0)
+			{
+				AES_GCM_encrypt_buffer(ctx, crypto_core_ghash_key(slot), iv,
+					aad, aad_len, buf, length, tag);
+				crypto_core_set_tag(s, tag);
+			} else
+			{
+				crypto_core_get_tag(s, tag);
+				if(AES_GCM_decrypt_buffer(ctx, crypto_core_ghash_key(slot), iv,
+					aad, aad_len, buf, length, tag))
+				{
+					return STATUS_AUTH_FAIL;
+				}
+			}
+			break;
+
+		case FORMAT_XTS:
+			unit = s->sector_size ? s->sector_size : length;
+			if(unit < AES_BLOCKLEN || length % unit ||
+				(unit % AES_BLOCKLEN && unit != length))
+			{
+				return STATUS_BAD_LEN;
+			}
+			tweak = crypto_core_load_tweak_key(s, slot);
+			// ctx->Iv carries the tweak input from one unit to the next
+			for(i = 0; i < length; i += unit)
+			{
+				if(crypto_core_qcrypto_crypt(s, slot, FORMAT_XTS, buf + i, unit) == 0)
+				{
+					AES_XTS_crypt_unit(ctx, tweak, ctx->Iv, buf + i, unit, s->mode == (uint32_t)0);
+				}
+				XTS_next_unit(ctx->Iv);
+			}
+			break;
+
+		case FORMAT_CHACHA20_POLY1305:
+			crypto_core_key_regs(s, key);
+			if(s->mode == (uint32_t)0)
+			{
+				ChaChaPoly_encrypt_buffer(key, iv, aad, aad_len, buf, length, tag);
+				crypto_core_set_tag(s, tag);
+			} else
+			{
+				crypto_core_get_tag(s, tag);
+				if(ChaChaPoly_decrypt_buffer(key, iv, aad, aad_len, buf, length, tag))
+				{
+					return STATUS_AUTH_FAIL;
+				}
+			}
+			break;
+
+		default:	// CTR, symmetrical
+			i = crypto_core_qcrypto_crypt(s, slot, FORMAT_CTR, buf, length);
+			AES_CTR_xcrypt_buffer(ctx, buf + i, length - i);
+			break;
+	}
+	return 0;
+}
+
+// CTR over a stream split into jobs of any length: the unused keystream of a
+// partial last block is kept and used first by the next job.
+static void crypto_core_ctr_stream(CryptoCoreBank *s, CryptoCoreKeySlot *slot,
+	const uint8_t *iv, uint8_t *buf, size_t length)
+{
+	struct AES_ctx *ctx = &slot->ctx;
+	size_t i = 0, full;
+
+	AES_ctx_set_iv(ctx, iv);
+	for(; i < length && s->ctr_used != 0 && s->ctr_used < AES_BLOCKLEN; i += 1)
+	{
+		buf[i] ^= s->ctr_ks[s->ctr_used++];
+	}
+
+	full = (length - i) & ~(size_t)(AES_BLOCKLEN - 1);
+	if(crypto_core_qcrypto_crypt(s, slot, FORMAT_CTR, buf + i, full) != full)
+	{
+		AES_CTR_xcrypt_buffer(ctx, buf + i, full);
+	}
+	i += full;
+
+	if(i < length)
+	{
+		memset(s->ctr_ks, 0, AES_BLOCKLEN);
+		AES_CTR_xcrypt_buffer(ctx, s->ctr_ks, AES_BLOCKLEN);
+		for(s->ctr_used = 0; i < length; i += 1)
+		{
+			buf[i] ^= s->ctr_ks[s->ctr_used++];
+		}
+	}
+}
+
+// DMA job: REG_LEN bytes from REG_SRC_ADDR are processed into REG_DST_ADDR.
+// For CBC and CTR the IV registers are left holding the next chaining value,
+// so a long stream can be split over several jobs.
+static uint32_t crypto_core_run_dma(
+	CryptoCoreBank *s, CryptoCoreKeySlot *slot, const uint8_t *iv,
+	const uint8_t *aad, size_t aad_len
+)
+{
+	uint8_t *buf;
+	uint32_t status;
+
+	if(s->len > CC_MAX_JOB_LEN)
+	{
+		return STATUS_BAD_LEN;
+	}
+
+	buf = g_malloc(s->len);
+	if(dma_memory_read(&address_space_memory, s->src_addr, buf, s->len,
+		MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+	{
+		g_free(buf);
+		return STATUS_DMA_ERROR;
+	}
+
+	if(s->format == FORMAT_CTR && !crypto_core_etm_active(s))
+	{
+		crypto_core_ctr_stream(s, slot, iv, buf, s->len);
+		status = 0;
+	} else
+	{
+		status = crypto_core_process(s, slot, iv, aad, aad_len, buf, s->len);
+	}
+	if(status == 0)
+	{
+		if(!crypto_core_format_is_mac(s->format) &&
+			dma_memory_write(&address_space_memory, s->dst_addr, buf, s->len,
+			MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+		{
+			status = STATUS_DMA_ERROR;
+		}
+		if(crypto_core_format_chains(s->format))
+		{
+			s->iv_0 = uint8_to_uint32(slot->ctx.Iv);
+			s->iv_1 = uint8_to_uint32(slot->ctx.Iv+4);
+			s->iv_2 = uint8_to_uint32(slot->ctx.Iv+8);
+			s->iv_3 = uint8_to_uint32(slot->ctx.Iv+12);
+		}
+	}
+	g_free(buf);
+	return status;
+}
+
+// Descriptor batches: formats that take their data from REG_DESC_ADDR.
+static bool crypto_core_is_batch(CryptoCoreBank *s)
+{
+	return s->desc_count != 0 && s->format != FORMAT_SHA256 &&
+		s->format != FORMAT_DRBG && s->format != FORMAT_KEYLOAD;
+}
+
+static void crypto_core_count(CryptoCoreBank *s, uint64_t bytes)
+{
+	CryptoCoreStats *st = &s->core->stats;
+	uint32_t format = s->format < CC_FORMATS ? s->format : FORMAT_CTR;
+
+	st->bytes += bytes;
+	st->blocks[format][s->mode != 0] += DIV_ROUND_UP(bytes, AES_BLOCKLEN);
+	s->job_bytes += bytes;
+}
+
+// MAC batch: one tag per descriptor, all under the current key slot.
+// The descriptor array is read and written back with one DMA transfer each.
+static uint32_t crypto_core_run_mac_batch(
+	CryptoCoreBank *s, CryptoCoreKeySlot *slot, const uint8_t *iv
+)
+{
+	size_t table_len = (size_t)s->desc_count * CC_MAC_DESC_SIZE;
+	uint8_t *table, *desc;
+	uint8_t *msg = NULL;
+	size_t msg_size = 0;
+	uint8_t tag[AES_BLOCKLEN];
+	uint8_t expected[AES_BLOCKLEN];
+	uint32_t status = 0, st, len;
+	uint32_t i;
+
+	if(s->desc_count > CC_MAX_DESC)
+	{
+		return STATUS_BAD_LEN;
+	}
+
+	table = g_malloc(table_len);
+	if(dma_memory_read(&address_space_memory, s->desc_addr, table, table_len,
+		MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+	{
+		g_free(table);
+		return STATUS_DMA_ERROR;
+	}
+
+	for(i = 0, desc = table; i < s->desc_count; i += 1, desc += CC_MAC_DESC_SIZE)
+	{
+		len = ldl_le_p(desc + CC_MAC_DESC_LEN);
+		if(len > CC_SCHED_CHUNK)
+		{
+			st = STATUS_BAD_LEN;
+			goto next;
+		}
+		if(len > msg_size)
+		{
+			msg_size = len;
+			msg = g_realloc(msg, msg_size);
+		}
+		if(dma_memory_read(&address_space_memory, ldq_le_p(desc + CC_MAC_DESC_SRC),
+			msg, len, MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+		{
+			st = STATUS_DMA_ERROR;
+			goto next;
+		}
+		crypto_core_count(s, len);
+		st = crypto_core_mac(s, slot, iv, msg, len, tag);
+		if(st)
+		{
+			goto next;
+		}
+		if(s->mode == (uint32_t)0)
+		{
+			if(dma_memory_write(&address_space_memory, ldq_le_p(desc + CC_MAC_DESC_TAG),
+				tag, AES_BLOCKLEN, MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+			{
+				st = STATUS_DMA_ERROR;
+			}
+		} else if(dma_memory_read(&address_space_memory, ldq_le_p(desc + CC_MAC_DESC_TAG),
+			expected, AES_BLOCKLEN, MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+		{
+			st = STATUS_DMA_ERROR;
+		} else if(!crypto_core_tag_equal(tag, expected))
+		{
+			st = STATUS_AUTH_FAIL;
+		}
+next:
+		stl_le_p(desc + CC_MAC_DESC_STATUS, st);
+		status |= st;
+	}
+
+	if(dma_memory_write(&address_space_memory, s->desc_addr, table, table_len,
+		MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+	{
+		status |= STATUS_DMA_ERROR;
+	}
+	g_free(msg);
+	g_free(table);
+	return status;
+}
+
+// Packet batch: every descriptor is a packet with its own IV, processed with
+// the current format into its own output buffer. The tag registers are left
+// as they were; per-packet tags travel with the packets.
+static uint32_t crypto_core_run_packet_batch(CryptoCoreBank *s, CryptoCoreKeySlot *slot)
+{
+	size_t table_len = (size_t)s->desc_count * CC_PKT_DESC_SIZE;
+	bool aead = crypto_core_format_is_aead(s);
+	bool encrypt = s->mode == (uint32_t)0;
+	size_t tag_len = aead ? AES_BLOCKLEN : 0;
+	uint8_t saved_tag[AES_BLOCKLEN];
+	uint8_t *table, *desc;
+	uint8_t *pkt = NULL;
+	size_t pkt_size = 0;
+	uint64_t total;
+	uint32_t status = 0, st, offset, len;
+	uint32_t i;
+
+	if(s->desc_count > CC_MAX_DESC)
+	{
+		return STATUS_BAD_LEN;
+	}
+
+	table = g_malloc(table_len);
+	if(dma_memory_read(&address_space_memory, s->desc_addr, table, table_len,
+		MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+	{
+		g_free(table);
+		return STATUS_DMA_ERROR;
+	}
+	crypto_core_get_tag(s, saved_tag);
+
+	for(i = 0, desc = table; i < s->desc_count; i += 1, desc += CC_PKT_DESC_SIZE)
+	{
+		offset = ldl_le_p(desc + CC_PKT_DESC_OFFSET);
+		len = ldl_le_p(desc + CC_PKT_DESC_LEN);
+		total = (uint64_t)offset + len;
+		if(total + tag_len > CC_SCHED_CHUNK)
+		{
+			st = STATUS_BAD_LEN;
+			goto next;
+		}
+		if(total + tag_len > pkt_size)
+		{
+			pkt_size = total + tag_len;
+			pkt = g_realloc(pkt, pkt_size);
+		}
+		if(dma_memory_read(&address_space_memory, ldq_le_p(desc + CC_PKT_DESC_SRC),
+			pkt, total + (encrypt ? 0 : tag_len), MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+		{
+			st = STATUS_DMA_ERROR;
+			goto next;
+		}
+		if(aead && !encrypt)
+		{
+			crypto_core_set_tag(s, pkt + total);
+		}
+		crypto_core_count(s, len);
+		st = crypto_core_process(s, slot, desc + CC_PKT_DESC_IV, pkt, offset, pkt + offset, len);
+		if(st)
+		{
+			goto next;
+		}
+		if(aead && encrypt)
+		{
+			crypto_core_get_tag(s, pkt + total);
+		}
+		if(dma_memory_write(&address_space_memory, ldq_le_p(desc + CC_PKT_DESC_DST),
+			pkt, total + (encrypt ? tag_len : 0), MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+		{
+			st = STATUS_DMA_ERROR;
+		}
+next:
+		stl_le_p(desc + CC_PKT_DESC_STATUS, st);
+		status |= st;
+	}
+
+	crypto_core_set_tag(s, saved_tag);
+	if(dma_memory_write(&address_space_memory, s->desc_addr, table, table_len,
+		MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+	{
+		status |= STATUS_DMA_ERROR;
+	}
+	g_free(pkt);
+	g_free(table);
+	return status;
+}
+
+// SHA-256 job: HASH_INIT, the REG_LEN bytes at REG_SRC_ADDR, HASH_FINAL.
+static uint32_t crypto_core_run_hash(CryptoCoreBank *s)
+{
+	uint8_t *buf;
+
+	if(s->len > CC_MAX_JOB_LEN)
+	{
+		return STATUS_BAD_LEN;
+	}
+
+	if(s->hash_ctrl & HASH_INIT)
+	{
+		SHA256_init(&s->sha);
+	}
+	if(s->len != 0)
+	{
+		buf = g_malloc(s->len);
+		if(dma_memory_read(&address_space_memory, s->src_addr, buf, s->len,
+			MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+		{
+			g_free(buf);
+			return STATUS_DMA_ERROR;
+		}
+		SHA256_update(&s->sha, buf, s->len);
+		g_free(buf);
+	}
+	if(s->hash_ctrl & HASH_FINAL)
+	{
+		SHA256_final(&s->sha);
+	}
+	return 0;
+}
+
+#define DRBG_RESEED_INTERVAL	(1 << 16)
+
+// DRBG job: REG_LEN random bytes to REG_DST_ADDR, one generate request per 64 KiB.
+static uint32_t crypto_core_run_drbg(CryptoCoreBank *s)
+{
+	uint8_t seed[DRBG_SEEDLEN];
+	uint8_t addl[DRBG_SEEDLEN] = { 0 };
+	uint8_t *buf;
+	uint64_t done;
+	size_t n, i;
+	uint32_t status = 0;
+
+	if(s->len > CC_MAX_JOB_LEN || s->aad_len > DRBG_SEEDLEN)
+	{
+		return STATUS_BAD_LEN;
+	}
+	if(s->aad_len != 0 &&
+		dma_memory_read(&address_space_memory, s->aad_addr, addl, s->aad_len,
+		MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+	{
+		return STATUS_DMA_ERROR;
+	}
+
+	// a queued job is sliced between generate requests; MODE 1 reseeds before the first
+	if(!s->core->drbg.seeded || (s->mode == (uint32_t)1 && s->job_done == 0) ||
+		s->core->drbg.reseed_counter > DRBG_RESEED_INTERVAL)
+	{
+		qemu_guest_getrandom_nofail(seed, sizeof(seed));
+		for(i = 0; i < DRBG_SEEDLEN; i += 1)
+		{
+			seed[i] ^= addl[i];
+		}
+		DRBG_seed(&s->core->drbg, seed);
+		memset(seed, 0, sizeof(seed));
+	}
+
+	buf = g_malloc(MIN(s->len, DRBG_MAX_REQUEST));
+	for(done = 0; done < s->len && status == 0; done += n)
+	{
+		n = MIN(s->len - done, DRBG_MAX_REQUEST);
+		DRBG_generate(&s->core->drbg, s->aad_len ? addl : NULL, buf, n);
+		if(dma_memory_write(&address_space_memory, s->dst_addr + done, buf, n,
+			MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+		{
+			status = STATUS_DMA_ERROR;
+		}
+	}
+	memset(buf, 0, MIN(s->len, DRBG_MAX_REQUEST));
+	g_free(buf);
+	return status;
+}
+
+// Key load job: REG_LEN bytes of KEY_LEN keys go into consecutive slots from
+// REG_KEY_SLOT on, expanded several at a time. Jobs then select a slot with
+// KEY_SLOT_PRELOADED and leave the key registers alone.
+static uint32_t crypto_core_run_keyload(CryptoCoreBank *s)
+{
+	unsigned keylen = crypto_core_key_bytes(s->key_len);
+	struct AES_ctx *ctxs[CC_KEY_SLOTS];
+	uint8_t *keys;
+	CryptoCoreKeySlot *slot;
+	size_t count, i;
+	int64_t t0;
+
+	count = s->len / keylen;
+	if(s->len == 0 || s->len % keylen || count > CC_KEY_SLOTS - s->key_slot)
+	{
+		return STATUS_BAD_LEN;
+	}
+
+	keys = g_malloc(s->len);
+	if(dma_memory_read(&address_space_memory, s->src_addr, keys, s->len,
+		MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+	{
+		g_free(keys);
+		return STATUS_DMA_ERROR;
+	}
+
+	for(i = 0; i < count; i += 1)
+	{
+		ctxs[i] = &s->core->key_slots[s->key_slot + i].ctx;
+	}
+	t0 = get_clock();
+	AES_init_ctx_many(ctxs, keys, count, keylen);
+	s->core->stats.key_expansions += count;
+	s->job_key_exp += count;
+	s->job_key_ns += get_clock() - t0;
+
+	for(i = 0; i < count; i += 1)
+	{
+		slot = &s->core->key_slots[s->key_slot + i];
+		memcpy(slot->key, keys + i * keylen, keylen);
+		slot->keylen = keylen;
+		slot->ghash_valid = false;
+		slot->tweak_valid = false;
+		slot->cmac_valid = false;
+		slot->hmac_valid = false;
+		crypto_core_qcipher_reset(slot, CC_FORMATS);
+		slot->valid = true;
+	}
+	memset(keys, 0, s->len);
+	g_free(keys);
+	return 0;
+}
+
+// The digest registers pack the big-endian state words as bytes, like OUT and TAG.
+static uint32_t crypto_core_digest_reg(CryptoCoreBank *s, unsigned i)
+{
+	return bswap32(s->sha.H[i]);
+}
+
+static uint32_t crypto_core_ctx_restore(CryptoCoreBank *s)
+{
+	uint8_t c[CC_CTX_SIZE];
+	uint32_t key_slot;
+
+	if(dma_memory_read(&address_space_memory, s->ctx_addr, c, sizeof(c),
+		MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+	{
+		return STATUS_DMA_ERROR;
+	}
+	key_slot = ldl_le_p(c + CC_CTX_KEY_SLOT);
+	if(ldl_le_p(c + CC_CTX_MAGIC_OFF) != CC_CTX_MAGIC || key_slot >= CC_KEY_SLOTS ||
+		ldl_le_p(c + CC_CTX_KEYSTREAM_USED) > AES_BLOCKLEN)
+	{
+		return STATUS_BAD_CTX;
+	}
+	// The context names its key by slot only. Without a key in it the job
+	// would run with whatever the key registers hold, so refuse it.
+	if(!s->core->key_slots[key_slot].valid ||
+		s->core->key_slots[key_slot].keylen != crypto_core_key_bytes(ldl_le_p(c + CC_CTX_KEY_LEN)))
+	{
+		return STATUS_BAD_CTX;
+	}
+
+	s->key_slot = key_slot;
+	s->key_slot_preloaded = true;
+	s->key_len = ldl_le_p(c + CC_CTX_KEY_LEN);
+	s->mode = ldl_le_p(c + CC_CTX_MODE);
+	s->format = ldl_le_p(c + CC_CTX_FORMAT);
+	s->mac_alg = ldl_le_p(c + CC_CTX_MAC_ALG);
+	s->iv_0 = uint8_to_uint32(c + CC_CTX_IV);
+	s->iv_1 = uint8_to_uint32(c + CC_CTX_IV + 4);
+	s->iv_2 = uint8_to_uint32(c + CC_CTX_IV + 8);
+	s->iv_3 = uint8_to_uint32(c + CC_CTX_IV + 12);
+	memcpy(s->ctr_ks, c + CC_CTX_KEYSTREAM, AES_BLOCKLEN);
+	s->ctr_used = ldl_le_p(c + CC_CTX_KEYSTREAM_USED);
+	s->sector_size = ldl_le_p(c + CC_CTX_SECTOR_SIZE);
+	return 0;
+}
+
+static uint32_t crypto_core_ctx_save(CryptoCoreBank *s)
+{
+	uint8_t c[CC_CTX_SIZE] = { 0 };
+
+	stl_le_p(c + CC_CTX_MAGIC_OFF, CC_CTX_MAGIC);
+	stl_le_p(c + CC_CTX_KEY_SLOT, s->key_slot);
+	stl_le_p(c + CC_CTX_KEY_LEN, s->key_len);
+	stl_le_p(c + CC_CTX_MODE, s->mode);
+	stl_le_p(c + CC_CTX_FORMAT, s->format);
+	stl_le_p(c + CC_CTX_MAC_ALG, s->mac_alg);
+	uint32_to_uint8(s->iv_0, c + CC_CTX_IV);
+	uint32_to_uint8(s->iv_1, c + CC_CTX_IV + 4);
+	uint32_to_uint8(s->iv_2, c + CC_CTX_IV + 8);
+	uint32_to_uint8(s->iv_3, c + CC_CTX_IV + 12);
+	memcpy(c + CC_CTX_KEYSTREAM, s->ctr_ks, AES_BLOCKLEN);
+	stl_le_p(c + CC_CTX_KEYSTREAM_USED, s->ctr_used);
+	stl_le_p(c + CC_CTX_SECTOR_SIZE, s->sector_size);
+
+	if(dma_memory_write(&address_space_memory, s->ctx_addr, c, sizeof(c),
+		MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+	{
+		return STATUS_DMA_ERROR;
+	}
+	return 0;
+}
+
+static void crypto_core_exec_job(CryptoCoreBank *s)
+{
+	CryptoCoreKeySlot *slot;
+	uint8_t vec[AES_BLOCKLEN];
+	uint8_t to_enc_dec[AES_BLOCKLEN];
+	uint8_t *aad = NULL;
+	size_t aad_len = 0;
+
+	if(s->format == FORMAT_SHA256)
+	{
+		s->status = crypto_core_run_hash(s);
+		return;
+	}
+	if(s->format == FORMAT_DRBG)
+	{
+		s->status = crypto_core_run_drbg(s);
+		return;
+	}
+	if(s->format == FORMAT_KEYLOAD)
+	{
+		s->status = crypto_core_run_keyload(s);
+		return;
+	}
+
+	slot = crypto_core_load_key(s);
+
+	uint32_to_uint8(s->iv_0, vec);
+	uint32_to_uint8(s->iv_1, vec+4);
+	uint32_to_uint8(s->iv_2, vec+8);
+	uint32_to_uint8(s->iv_3, vec+12);
+
+	if(crypto_core_format_is_aead(s) && s->aad_len != 0 && s->desc_count == 0)
+	{
+		if(s->aad_len > CC_MAX_JOB_LEN)
+		{
+			s->status = STATUS_BAD_LEN;
+			goto done;
+		}
+		aad_len = s->aad_len;
+		aad = g_malloc(aad_len);
+		if(dma_memory_read(&address_space_memory, s->aad_addr, aad, aad_len,
+			MEMTXATTRS_UNSPECIFIED) != MEMTX_OK)
+		{
+			s->status = STATUS_DMA_ERROR;
+			goto done;
+		}
+	}
+
+	if(s->desc_count != 0)
+	{
+		s->status = crypto_core_format_is_mac(s->format) ?
+			crypto_core_run_mac_batch(s, slot, vec) :
+			crypto_core_run_packet_batch(s, slot);
+		goto done;
+	}
+
+	if(s->len != 0)
+	{
+		s->status = crypto_core_run_dma(s, slot, vec, aad, aad_len);
+		goto done;
+	}
+
+	// register operation: IN -> OUT
+
+	uint32_to_uint8(s->in_0, to_enc_dec);
+	uint32_to_uint8(s->in_1, to_enc_dec+4);
+	uint32_to_uint8(s->in_2, to_enc_dec+8);
+	uint32_to_uint8(s->in_3, to_enc_dec+12);
+
+	s->status = crypto_core_process(s, slot, vec, aad, aad_len, to_enc_dec, AES_BLOCKLEN);
+	if(s->status == 0)
+	{
+		s->out_0 = uint8_to_uint32(to_enc_dec);
+		s->out_1 = uint8_to_uint32(to_enc_dec+4);
+		s->out_2 = uint8_to_uint32(to_enc_dec+8);
+		s->out_3 = uint8_to_uint32(to_enc_dec+12);
+	}
+
+done:
+	g_free(aad);
+}
+
+// Bytes a job will process, for scheduling only; batches are estimated.
+static uint64_t crypto_core_job_cost(CryptoCoreBank *s)
+{
+	if(crypto_core_is_batch(s))
+	{
+		return (uint64_t)s->desc_count * 256;
+	}
+	if(s->format == FORMAT_SHA256 || s->format == FORMAT_DRBG ||
+		s->format == FORMAT_KEYLOAD)
+	{
+		return s->len;
+	}
+	return s->len ? s->len : AES_BLOCKLEN;
+}
+
+// Runs the job in the bank's registers and accounts it in the statistics.
+// Batches count every descriptor themselves.
+static void crypto_core_run_job(CryptoCoreBank *s)
+{
+	int64_t t0 = get_clock(), ns;
+
+	crypto_core_exec_job(s);
+	if(!crypto_core_is_batch(s))
+	{
+		crypto_core_count(s, crypto_core_job_cost(s));
+	}
+	ns = get_clock() - t0;
+	s->core->stats.cipher_ns += ns;
+	s->job_ns += ns;
+}
+
+// Granularity a DMA job can be sliced at without changing its result: the
+// formats whose state between slices is kept in the bank's registers.
+// Descriptor batches are sliced one descriptor at a time.
+static uint64_t crypto_core_job_unit(CryptoCoreBank *s)
+{
+	if(crypto_core_is_batch(s))
+	{
+		return 1;
+	}
+	if(s->len == 0 || s->desc_count != 0 || crypto_core_etm_active(s))
+	{
+		return 0;
+	}
+	switch(s->format)
+	{
+		case FORMAT_ECB:
+		case FORMAT_CBC:
+			return s->len % AES_BLOCKLEN ? 0 : AES_BLOCKLEN;
+		case FORMAT_CTR:
+			return 1;
+		case FORMAT_XTS:
+			return s->sector_size && s->len % s->sector_size == 0 ? s->sector_size : 0;
+		case FORMAT_SHA256:
+			return 64;
+		case FORMAT_DRBG:
+			return DRBG_MAX_REQUEST;
+		default:
+			return 0;
+	}
+}
+
+// A job that cannot be sliced holds the device for its whole length, so it
+// may be at most CC_SCHED_CHUNK bytes long, AAD included.
+static bool crypto_core_job_too_long(CryptoCoreBank *s)
+{
+	uint64_t len;
+
+	if(crypto_core_is_batch(s))
+	{
+		return s->desc_count > CC_MAX_DESC;
+	}
+	if(crypto_core_job_unit(s) != 0)
+	{
+		return false;
+	}
+	len = crypto_core_job_cost(s);
+	if(crypto_core_format_is_aead(s))
+	{
+		len += s->aad_len;
+	}
+	return len > CC_SCHED_CHUNK;
+}
+
+static void crypto_core_complete(CryptoCoreBank *s)
+{
+	CryptoCoreStats *st = &s->core->stats;
+	uint32_t format = s->format < CC_FORMATS ? s->format : FORMAT_CTR;
+	int64_t ns;
+
+	s->valid = 1;
+	s->ts_done = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+	ns = get_clock() - s->job_t0;
+	st->latency[format][MIN(ns > 1 ? 63 - clz64(ns) : 0, CC_LAT_BUCKETS - 1)] += 1;
+	trace_crypto_core_job_done(s - s->core->banks, s->format, s->status,
+		ns, s->job_ns - s->job_key_ns, s->job_key_ns);
+}
+
+static void crypto_core_model_timer(void *opaque)
+{
+	CryptoCoreBank *s = opaque;
+
+	s->pending = false;
+	crypto_core_complete(s);
+}
+
+// Virtual time the modelled pipeline needs for the job just run.
+static int64_t crypto_core_model_ns(CryptoCoreBank *s)
+{
+	CryptoCoreState *cs = s->core;
+	uint32_t format = s->format < CC_FORMATS ? s->format : FORMAT_CTR;
+	uint64_t cycles;
+
+	cycles = DIV_ROUND_UP(crypto_core_job_cost(s), AES_BLOCKLEN) * cs->model_cpb[format] +
+		(uint64_t)s->job_key_exp * cs->model_key_cycles;
+	return cs->model_setup_ns + muldiv64(cycles, 1000, MAX(cs->model_clock_mhz, 1));
+}
+
+static void crypto_core_wl_record(CryptoCoreBank *s)
+{
+	uint8_t rec[CC_WL_REC_SIZE] = { 0 };
+
+	stl_le_p(rec + CC_WL_GAP, s->wl_gap);
+	stl_le_p(rec + CC_WL_BYTES, MIN(s->job_bytes, UINT32_MAX));
+	rec[CC_WL_FORMAT] = s->format;
+	rec[CC_WL_MODE] = s->mode != 0;
+	rec[CC_WL_KEY_LEN] = s->key_len / 64;
+	rec[CC_WL_KEY_EXP] = MIN(s->job_key_exp, UINT8_MAX);
+	rec[CC_WL_MAC_ALG] = s->mac_alg;
+	rec[CC_WL_BANK] = s - s->core->banks;
+	stw_le_p(rec + CC_WL_SECTOR, MIN(s->sector_size / AES_BLOCKLEN, UINT16_MAX));
+	if(fwrite(rec, sizeof(rec), 1, s->core->wl_file) != 1)
+	{
+		warn_report("crypto_core: workload trace write failed, tracing stopped");
+		fclose(s->core->wl_file);
+		s->core->wl_file = NULL;
+	}
+}
+
+static void crypto_core_finish(CryptoCoreBank *s)
+{
+	CryptoCoreState *cs = s->core;
+	int64_t now, begin;
+	unsigned lanes, lane, i;
+
+	if((s->ctx_ctrl & CTX_SAVE) && s->status == 0)
+	{
+		s->status = crypto_core_ctx_save(s);
+	}
+	if(cs->wl_file)
+	{
+		crypto_core_wl_record(s);
+	}
+	if(!cs->model)
+	{
+		crypto_core_complete(s);
+		return;
+	}
+
+	// the job occupies the lane that frees up first from its submission on
+	lanes = MIN(MAX(cs->model_lanes, 1), CC_MAX_LANES);
+	for(lane = 0, i = 1; i < lanes; i += 1)
+	{
+		if(cs->lane_free[i] < cs->lane_free[lane])
+		{
+			lane = i;
+		}
+	}
+	now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	begin = MAX(s->ts_submit, cs->lane_free[lane]);
+	cs->lane_free[lane] = begin + crypto_core_model_ns(s);
+	s->ts_start = begin;
+	s->pending = true;
+	timer_mod(s->model_timer, MAX(cs->lane_free[lane], now));
+}
+
+// Runs the next descriptor of a queued batch and returns the bytes used. The
+// descriptors are independent, so the batch gives the same result as run whole.
+static uint64_t crypto_core_run_batch_slice(CryptoCoreBank *s)
+{
+	uint64_t size = crypto_core_format_is_mac(s->format) ? CC_MAC_DESC_SIZE : CC_PKT_DESC_SIZE;
+	uint64_t bytes = s->job_bytes;
+
+	s->desc_addr = s->job_src + s->job_done * size;
+	s->desc_count = 1;
+
+	crypto_core_run_job(s);
+
+	s->desc_addr = s->job_src;
+	s->desc_count = s->job_len;
+	s->job_status |= s->status;
+	s->status = s->job_status;
+	s->job_done += 1;
+	return s->job_bytes - bytes + size;
+}
+
+// Runs up to about budget bytes of a queued job and returns the bytes used.
+// A job that cannot be sliced runs whole, whatever the budget: it is at most
+// CC_SCHED_CHUNK long.
+static uint64_t crypto_core_run_slice(CryptoCoreBank *s, uint64_t budget)
+{
+	uint64_t n;
+
+	if(crypto_core_is_batch(s))
+	{
+		return crypto_core_run_batch_slice(s);
+	}
+	if(s->job_unit == 0)
+	{
+		crypto_core_run_job(s);
+		s->job_done = s->job_cost;
+		return s->job_cost;
+	}
+
+	n = MIN(MIN(budget, CC_SCHED_CHUNK), s->job_len - s->job_done);
+	n = MAX(n - n % s->job_unit, MIN(s->job_unit, s->job_len - s->job_done));
+	if(s->job_done + n < s->job_len && s->job_len - s->job_done - n < s->job_unit)
+	{
+		n = s->job_len - s->job_done;	// no slice smaller than a unit at the end
+	}
+
+	s->src_addr = s->job_src + s->job_done;
+	s->dst_addr = s->job_dst + s->job_done;
+	s->len = n;
+	s->hash_ctrl = s->job_hash_ctrl;
+	if(s->job_done != 0)
+	{
+		s->hash_ctrl &= ~HASH_INIT;
+	}
+	if(s->job_done + n != s->job_len)
+	{
+		s->hash_ctrl &= ~HASH_FINAL;
+	}
+
+	crypto_core_run_job(s);
+
+	s->src_addr = s->job_src;
+	s->dst_addr = s->job_dst;
+	s->len = s->job_len;
+	s->hash_ctrl = s->job_hash_ctrl;
+	s->job_done = s->status ? s->job_len : s->job_done + n;
+	return n;
+}
+
+// Deficit round robin over the banks with a queued job.
+static void crypto_core_sched_bh(void *opaque)
+{
+	CryptoCoreState *cs = opaque;
+	CryptoCoreBank *s;
+	uint64_t budget = CC_SCHED_BUDGET, n;
+	unsigned i;
+
+	while(cs->queued != 0 && budget > 0)
+	{
+		i = cs->sched_next;
+		cs->sched_next = (i + 1) % CRYPTO_CORE_BANKS;
+		s = &cs->banks[i];
+		if(!s->busy)
+		{
+			continue;
+		}
+
+		s->deficit += (int64_t)CC_SCHED_QUANTUM * s->weight;
+		if(s->ts_start == 0)
+		{
+			s->ts_start = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+		}
+		while(s->busy && s->deficit > 0 && budget > 0)
+		{
+			n = crypto_core_run_slice(s, MIN((uint64_t)s->deficit, budget));
+			s->deficit -= n;
+			budget -= MIN(n, budget);
+			if(s->job_done >= (s->job_unit ? s->job_len : s->job_cost))
+			{
+				s->busy = false;
+				s->deficit = 0;
+				cs->queued -= 1;
+				crypto_core_finish(s);
+			}
+		}
+		if(s->busy && budget == 0)
+		{
+			cs->sched_next = i;	// resume this bank with what is left of its deficit
+		}
+	}
+
+	if(cs->queued != 0)
+	{
+		qemu_bh_schedule(cs->sched_bh);
+	}
+}
+
+static int crypto_core_remote_send(CryptoCoreState *cs, uint32_t request,
+	const uint8_t *payload, uint32_t size, const int *fds, unsigned nfds)
+{
+	uint8_t hdr[CC_REMOTE_HDR_SIZE];
+	struct iovec iov[2] = {
+		{ .iov_base = hdr, .iov_len = sizeof(hdr) },
+		{ .iov_base = (void *)payload, .iov_len = size },
+	};
+	union
+	{
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * CC_REMOTE_MAX_REGIONS)];
+	} control;
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+	struct cmsghdr *cmsg;
+	ssize_t n;
+
+	stl_le_p(hdr, request);
+	stl_le_p(hdr + 4, size);
+	if(nfds != 0)
+	{
+		memset(&control, 0, sizeof(control));
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+	}
+	do
+	{
+		n = sendmsg(cs->remote_fd, &msg, MSG_NOSIGNAL);
+	} while(n < 0 && errno == EINTR);
+	return n == (ssize_t)(sizeof(hdr) + size) ? 0 : -1;
 }
 
-static void InvShiftRows(state_t* state)
+// Drops the connection. The jobs still out fail with STATUS_DMA_ERROR, since
+// the backend may have written part of their output; later jobs run in QEMU.
+static void crypto_core_remote_close(CryptoCoreState *cs)
 {
-  uint8_t temp;
-
-  // Rotate first row 1 columns to right  
-  temp = (*state)[3][1];
-  (*state)[3][1] = (*state)[2][1];
-  (*state)[2][1] = (*state)[1][1];
-  (*state)[1][1] = (*state)[0][1];
-  (*state)[0][1] = temp;
-
-  // Rotate second row 2 columns to right 
-  temp = (*state)[0][2];
-  (*state)[0][2] = (*state)[2][2];
-  (*state)[2][2] = temp;
-
-  temp = (*state)[1][2];
-  (*state)[1][2] = (*state)[3][2];
-  (*state)[3][2] = temp;
+	unsigned i;
 
-  // Rotate third row 3 columns to right
-  temp = (*state)[0][3];
-  (*state)[0][3] = (*state)[1][3];
-  (*state)[1][3] = (*state)[2][3];
-  (*state)[2][3] = (*state)[3][3];
-  (*state)[3][3] = temp;
+	error_report("crypto_core: lost the remote backend, running jobs in QEMU from now on");
+	qemu_set_fd_handler(cs->remote_fd, NULL, NULL, NULL);
+	close(cs->remote_fd);
+	cs->remote_fd = -1;
+	for(i = 0; i < CRYPTO_CORE_BANKS; i += 1)
+	{
+		if(cs->banks[i].remote)
+		{
+			cs->banks[i].remote = false;
+			cs->banks[i].status = STATUS_DMA_ERROR;
+			crypto_core_finish(&cs->banks[i]);
+		}
+	}
 }
-#endif // #if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
 
-// Cipher is the main function that encrypts the PlainText.
-static void Cipher(state_t* state, const uint8_t* RoundKey)
+static void crypto_core_remote_begin(MemoryListener *listener)
 {
-  uint8_t round = 0;
+	CryptoCoreState *cs = container_of(listener, CryptoCoreState, remote_listener);
 
-  // Add the First round key to the state before starting the rounds.
-  AddRoundKey(0, state, RoundKey);
-
-  // There will be Nr rounds.
-  // The first Nr-1 rounds are identical.
-  // These Nr rounds are executed in the loop below.
-  // Last one without MixColumns()
-  for (round = 1; ; ++round)
-  {
-    SubBytes(state);
-    ShiftRows(state);
-    if (round == Nr) {
-      break;
-    }
-    MixColumns(state);
-    AddRoundKey(round, state, RoundKey);
-  }
-  // Add round key to last round
-  AddRoundKey(Nr, state, RoundKey);
+	memset(cs->remote_next, 0, sizeof(cs->remote_next));
 }
 
-#if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
-static void InvCipher(state_t* state, const uint8_t* RoundKey)
+// Guest RAM the backend can map: RAM sections backed by an fd.
+static void crypto_core_remote_region(MemoryListener *listener, MemoryRegionSection *section)
 {
-  uint8_t round = 0;
-
-  // Add the First round key to the state before starting the rounds.
-  AddRoundKey(Nr, state, RoundKey);
-
-  // There will be Nr rounds.
-  // The first Nr-1 rounds are identical.
-  // These Nr rounds are executed in the loop below.
-  // Last one without InvMixColumn()
-  for (round = (Nr - 1); ; --round)
-  {
-    InvShiftRows(state);
-    InvSubBytes(state);
-    AddRoundKey(round, state, RoundKey);
-    if (round == 0) {
-      break;
-    }
-    InvMixColumns(state);
-  }
+	CryptoCoreState *cs = container_of(listener, CryptoCoreState, remote_listener);
+	uint32_t n = ldl_le_p(cs->remote_next);
+	uint8_t *r = cs->remote_next + 8 + n * CC_RMEM_LEN;
+	MemoryRegion *mr;
+	ram_addr_t offset;
+	void *host;
+	int fd;
+
+	if(!memory_region_is_ram(section->mr) || memory_region_is_rom(section->mr))
+	{
+		return;
+	}
+	host = memory_region_get_ram_ptr(section->mr) + section->offset_within_region;
+	mr = memory_region_from_host(host, &offset);
+	fd = mr ? memory_region_get_fd(mr) : -1;
+	if(fd < 0)
+	{
+		return;
+	}
+	if(n == CC_REMOTE_MAX_REGIONS)
+	{
+		warn_report_once("crypto_core: more than %d shared RAM regions, "
+			"jobs on the others run in QEMU", CC_REMOTE_MAX_REGIONS);
+		return;
+	}
 
+	stq_le_p(r + CC_RMEM_GPA, section->offset_within_address_space);
+	stq_le_p(r + CC_RMEM_SIZE, int128_get64(section->size));
+	stq_le_p(r + CC_RMEM_OFFSET, offset);
+	cs->remote_next_fds[n] = fd;
+	stl_le_p(cs->remote_next, n + 1);
 }
-#endif // #if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
-
-/*****************************************************************************/
-/* Public functions:                                                         */
-/*****************************************************************************/
-#if defined(ECB) && (ECB == 1)
 
-
-static void AES_ECB_encrypt(const struct AES_ctx* ctx, uint8_t* buf)
+// Sends the new memory table if the memory map changed it.
+static void crypto_core_remote_commit(MemoryListener *listener)
 {
-  // The next function call encrypts the PlainText with the Key using AES algorithm.
-  Cipher((state_t*)buf, ctx->RoundKey);
-}
+	CryptoCoreState *cs = container_of(listener, CryptoCoreState, remote_listener);
+	uint32_t n = ldl_le_p(cs->remote_next);
 
-static void AES_ECB_decrypt(const struct AES_ctx* ctx, uint8_t* buf)
-{
-  // The next function call decrypts the PlainText with the Key using AES algorithm.
-  InvCipher((state_t*)buf, ctx->RoundKey);
+	if(cs->remote_fd < 0 || (memcmp(cs->remote_next, cs->remote_table, sizeof(cs->remote_table)) == 0 &&
+		memcmp(cs->remote_next_fds, cs->remote_fds, n * sizeof(int)) == 0))
+	{
+		return;
+	}
+	memcpy(cs->remote_table, cs->remote_next, sizeof(cs->remote_table));
+	memcpy(cs->remote_fds, cs->remote_next_fds, sizeof(cs->remote_fds));
+	if(crypto_core_remote_send(cs, CC_REMOTE_MEM_TABLE, cs->remote_table,
+		sizeof(cs->remote_table), cs->remote_fds, n) < 0)
+	{
+		crypto_core_remote_close(cs);
+	}
 }
 
+// True if [addr, addr + len) lies in one of the regions the backend maps.
+static bool crypto_core_remote_maps(CryptoCoreState *cs, uint64_t addr, uint64_t len)
+{
+	uint32_t i, n = ldl_le_p(cs->remote_table);
+	const uint8_t *r;
+	uint64_t gpa, size;
 
-#endif // #if defined(ECB) && (ECB == 1)
-
-
-
-
-
-#if defined(CBC) && (CBC == 1)
-
+	for(i = 0, r = cs->remote_table + 8; i < n; i += 1, r += CC_RMEM_LEN)
+	{
+		gpa = ldq_le_p(r + CC_RMEM_GPA);
+		size = ldq_le_p(r + CC_RMEM_SIZE);
+		if(addr >= gpa && len <= size && addr - gpa <= size - len)
+		{
+			return true;
+		}
+	}
+	return false;
+}
 
-static void XorWithIv(uint8_t* buf, const uint8_t* Iv)
+// Jobs the backend runs: single DMA jobs of the AES, MAC and ChaCha20-Poly1305
+// formats on shared memory, without encrypt-then-MAC.
+static bool crypto_core_remote_job(CryptoCoreBank *s)
 {
-  uint8_t i;
-  for (i = 0; i < AES_BLOCKLEN; ++i) // The block in AES is always 128bit no matter the key size
-  {
-    buf[i] ^= Iv[i];
-  }
+	CryptoCoreState *cs = s->core;
+
+	if(cs->remote_fd < 0 || s->len == 0 || s->len > CC_MAX_JOB_LEN ||
+		s->desc_count != 0 || crypto_core_etm_active(s))
+	{
+		return false;
+	}
+	switch(s->format)
+	{
+		case FORMAT_ECB:
+		case FORMAT_CBC:
+		case FORMAT_CTR:
+		case FORMAT_GCM:
+		case FORMAT_XTS:
+		case FORMAT_CMAC:
+		case FORMAT_CBC_MAC:
+		case FORMAT_CHACHA20_POLY1305:
+			break;
+		default:
+			return false;
+	}
+	if(crypto_core_format_is_aead(s) && s->aad_len != 0 &&
+		(s->aad_len > CC_MAX_JOB_LEN || !crypto_core_remote_maps(cs, s->aad_addr, s->aad_len)))
+	{
+		return false;
+	}
+	return crypto_core_remote_maps(cs, s->src_addr, s->len) &&
+		(crypto_core_format_is_mac(s->format) || crypto_core_remote_maps(cs, s->dst_addr, s->len));
 }
 
-static void AES_CBC_encrypt_buffer(struct AES_ctx *ctx, uint8_t* buf, size_t length)
+// The key still goes through the device's own slot, so KEY_SLOT_PRELOADED,
+// the saved contexts and the fallback to QEMU see the same keys as before.
+// Returns false if the job could not be sent; it is then still to be run.
+static bool crypto_core_remote_submit(CryptoCoreBank *s)
 {
-  size_t i;
-  uint8_t *Iv = ctx->Iv;
-  for (i = 0; i < length; i += AES_BLOCKLEN)
-  {
-    XorWithIv(buf, Iv);
-    Cipher((state_t*)buf, ctx->RoundKey);
-    Iv = buf;
-    buf += AES_BLOCKLEN;
-  }
-  /* store Iv in ctx for next call */
-  memcpy(ctx->Iv, Iv, AES_BLOCKLEN);
+	CryptoCoreKeySlot *slot = crypto_core_load_key(s);
+	uint8_t job[CC_RJOB_SIZE] = { 0 };
+
+	stl_le_p(job + CC_RJOB_ID, s - s->core->banks);
+	stl_le_p(job + CC_RJOB_FORMAT, s->format);
+	stl_le_p(job + CC_RJOB_MODE, s->mode);
+	stl_le_p(job + CC_RJOB_KEY_SLOT, s->key_slot);
+	stl_le_p(job + CC_RJOB_KEY_LEN, slot->keylen);
+	stl_le_p(job + CC_RJOB_SECTOR_SIZE, s->sector_size);
+	stq_le_p(job + CC_RJOB_SRC, s->src_addr);
+	stq_le_p(job + CC_RJOB_DST, s->dst_addr);
+	stq_le_p(job + CC_RJOB_LEN, s->len);
+	if(crypto_core_format_is_aead(s))
+	{
+		stq_le_p(job + CC_RJOB_AAD_ADDR, s->aad_addr);
+		stq_le_p(job + CC_RJOB_AAD_LEN, s->aad_len);
+	}
+	if(s->format == FORMAT_CHACHA20_POLY1305)
+	{
+		crypto_core_key_regs(s, job + CC_RJOB_KEY);
+	} else
+	{
+		memcpy(job + CC_RJOB_KEY, slot->key, slot->keylen);
+	}
+	uint32_to_uint8(s->key2_0, job + CC_RJOB_KEY2);
+	uint32_to_uint8(s->key2_1, job + CC_RJOB_KEY2 + 4);
+	uint32_to_uint8(s->key2_2, job + CC_RJOB_KEY2 + 8);
+	uint32_to_uint8(s->key2_3, job + CC_RJOB_KEY2 + 12);
+	uint32_to_uint8(s->key2_4, job + CC_RJOB_KEY2 + 16);
+	uint32_to_uint8(s->key2_5, job + CC_RJOB_KEY2 + 20);
+	uint32_to_uint8(s->key2_6, job + CC_RJOB_KEY2 + 24);
+	uint32_to_uint8(s->key2_7, job + CC_RJOB_KEY2 + 28);
+	uint32_to_uint8(s->iv_0, job + CC_RJOB_IV);
+	uint32_to_uint8(s->iv_1, job + CC_RJOB_IV + 4);
+	uint32_to_uint8(s->iv_2, job + CC_RJOB_IV + 8);
+	uint32_to_uint8(s->iv_3, job + CC_RJOB_IV + 12);
+	crypto_core_get_tag(s, job + CC_RJOB_TAG);
+	memcpy(job + CC_RJOB_KEYSTREAM, s->ctr_ks, AES_BLOCKLEN);
+	stl_le_p(job + CC_RJOB_KEYSTREAM_USED, s->ctr_used);
+
+	if(crypto_core_remote_send(s->core, CC_REMOTE_JOB, job, sizeof(job), NULL, 0) < 0)
+	{
+		crypto_core_remote_close(s->core);
+		return false;
+	}
+	s->remote = true;
+	return true;
 }
 
-static void AES_CBC_decrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, size_t length)
+static void crypto_core_remote_done(CryptoCoreBank *s, const uint8_t *done)
 {
-  size_t i;
-  uint8_t storeNextIv[AES_BLOCKLEN];
-  for (i = 0; i < length; i += AES_BLOCKLEN)
-  {
-    memcpy(storeNextIv, buf, AES_BLOCKLEN);
-    InvCipher((state_t*)buf, ctx->RoundKey);
-    XorWithIv(buf, ctx->Iv);
-    memcpy(ctx->Iv, storeNextIv, AES_BLOCKLEN);
-    buf += AES_BLOCKLEN;
-  }
+	int64_t ns = ldq_le_p(done + CC_RDONE_NS);
 
+	s->remote = false;
+	s->status = ldl_le_p(done + CC_RDONE_STATUS);
+	if(s->status == 0)
+	{
+		if(crypto_core_format_chains(s->format))
+		{
+			s->iv_0 = uint8_to_uint32(done + CC_RDONE_IV);
+			s->iv_1 = uint8_to_uint32(done + CC_RDONE_IV + 4);
+			s->iv_2 = uint8_to_uint32(done + CC_RDONE_IV + 8);
+			s->iv_3 = uint8_to_uint32(done + CC_RDONE_IV + 12);
+		}
+		if(s->mode == (uint32_t)0 && (crypto_core_format_is_mac(s->format) || crypto_core_format_is_aead(s)))
+		{
+			crypto_core_set_tag(s, done + CC_RDONE_TAG);
+		}
+		if(s->format == FORMAT_CTR)
+		{
+			memcpy(s->ctr_ks, done + CC_RDONE_KEYSTREAM, AES_BLOCKLEN);
+			s->ctr_used = MIN(ldl_le_p(done + CC_RDONE_KEYSTREAM_USED), AES_BLOCKLEN);
+		}
+	}
+	crypto_core_count(s, s->len);
+	s->core->stats.cipher_ns += ns;
+	s->job_ns += ns;
+	crypto_core_finish(s);
 }
 
-#endif // #if defined(CBC) && (CBC == 1)
-
-
-
-#if defined(CTR) && (CTR == 1)
-
-/* Symmetrical operation: same function for encrypting as for decrypting. Note any IV/nonce should never be reused with the same key */
-static void AES_CTR_xcrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, size_t length)
+// Answers of the backend, in any order and in as many pieces as the socket gives.
+static void crypto_core_remote_read(void *opaque)
 {
-  uint8_t buffer[AES_BLOCKLEN];
-  
-  size_t i;
-  int bi;
-  for (i = 0, bi = AES_BLOCKLEN; i < length; ++i, ++bi)
-  {
-    if (bi == AES_BLOCKLEN) /* we need to regen xor compliment in buffer */
-    {
-      
-      memcpy(buffer, ctx->Iv, AES_BLOCKLEN);
-      Cipher((state_t*)buffer,ctx->RoundKey);
-
-      /* Increment Iv and handle overflow */
-      for (bi = (AES_BLOCKLEN - 1); bi >= 0; --bi)
-      {
-	/* inc will overflow */
-        if (ctx->Iv[bi] == 255)
+	CryptoCoreState *cs = opaque;
+	uint8_t *done = cs->remote_in + CC_REMOTE_HDR_SIZE;
+	uint32_t id;
+	ssize_t n;
+
+	n = recv(cs->remote_fd, cs->remote_in + cs->remote_got,
+		sizeof(cs->remote_in) - cs->remote_got, MSG_DONTWAIT);
+	if(n < 0 && (errno == EAGAIN || errno == EINTR))
 	{
-          ctx->Iv[bi] = 0;
-          continue;
-        } 
-        ctx->Iv[bi] += 1;
-        break;   
-      }
-      bi = 0;
-    }
+		return;
+	}
+	if(n <= 0)
+	{
+		crypto_core_remote_close(cs);
+		return;
+	}
+	cs->remote_got += n;
+	if(cs->remote_got < sizeof(cs->remote_in))
+	{
+		return;
+	}
+	cs->remote_got = 0;
 
-    buf[i] = (buf[i] ^ buffer[bi]);
-  }
+	id = ldl_le_p(done + CC_RDONE_ID);
+	if(ldl_le_p(cs->remote_in) != CC_REMOTE_DONE || ldl_le_p(cs->remote_in + 4) != CC_RDONE_SIZE ||
+		id >= CRYPTO_CORE_BANKS || !cs->banks[id].remote)
+	{
+		error_report("crypto_core: bad message from the remote backend");
+		crypto_core_remote_close(cs);
+		return;
+	}
+	crypto_core_remote_done(&cs->banks[id], done);
 }
 
-#endif // #if defined(CTR) && (CTR == 1)
-
-static void uint32_to_uint8(const uint32_t input32, uint8_t *output8)
+static void crypto_core_start(CryptoCoreBank *s)
 {
-	output8[0] = (uint8_t)(input32 & 0xFF);
-	output8[1] = (uint8_t)((input32 >> 8) & 0xFF);
-	output8[2] = (uint8_t)((input32 >> 16) & 0xFF);
-	output8[3] = (uint8_t)((input32 >> 24) & 0xFF);
-}
+	CryptoCoreState *cs = s->core;
+
+	s->valid = 0;
+	s->job_key_exp = 0;
+	s->job_bytes = 0;
+	s->ts_submit = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	s->wl_gap = MIN(s->ts_submit - cs->wl_last_submit, UINT32_MAX);
+	cs->wl_last_submit = s->ts_submit;
+	s->ts_start = 0;
+	s->ts_done = 0;
+	cs->stats.starts += 1;
+	s->job_t0 = get_clock();
+	s->job_ns = 0;
+	s->job_key_ns = 0;
+	if(s->ctx_ctrl & CTX_RESTORE)
+	{
+		s->status = crypto_core_ctx_restore(s);
+		if(s->status)
+		{
+			s->valid = 1;
+			s->ts_done = s->ts_submit;
+			return;
+		}
+	}
 
-static uint32_t uint8_to_uint32(uint8_t *input8)
-{
-	uint32_t result = 0;
-	result |= (uint32_t)input8[0];
-	result |= ((uint32_t)input8[1] << 8);
-	result |= ((uint32_t)input8[2] << 16);
-	result |= ((uint32_t)input8[3] << 24);
+	if(crypto_core_job_too_long(s))
+	{
+		s->status = STATUS_BAD_LEN;
+		s->valid = 1;
+		s->ts_done = s->ts_submit;
+		return;
+	}
 
-	return result;
-}
+	if(crypto_core_remote_job(s) && crypto_core_remote_submit(s))
+	{
+		trace_crypto_core_job_start(s - cs->banks, s->format, s->mode, s->len, 1);
+		s->ts_start = s->ts_submit;
+		return;
+	}
 
+	s->job_cost = crypto_core_job_cost(s);
+	s->job_done = 0;
+	if(s->job_cost <= CC_SMALL_JOB && !crypto_core_is_batch(s) &&
+		(s->prio || cs->queued == 0))
+	{
+		trace_crypto_core_job_start(s - cs->banks, s->format, s->mode, s->len, 0);
+		s->ts_start = s->ts_submit;
+		crypto_core_run_job(s);
+		crypto_core_finish(s);
+		return;
+	}
 
-static uint64_t crypto_core_read(
+	s->job_unit = crypto_core_job_unit(s);
+	s->job_src = crypto_core_is_batch(s) ? s->desc_addr : s->src_addr;
+	s->job_dst = s->dst_addr;
+	s->job_len = crypto_core_is_batch(s) ? s->desc_count : s->len;
+	s->job_hash_ctrl = s->hash_ctrl;
+	s->job_status = 0;
+	s->deficit = 0;
+	s->busy = true;
+	trace_crypto_core_job_start(s - cs->banks, s->format, s->mode, s->len, 1);
+	cs->queued += 1;
+	cs->stats.queue_hwm = MAX(cs->stats.queue_hwm, cs->queued);
+	qemu_bh_schedule(cs->sched_bh);
+}
+
+static uint64_t crypto_core_read_reg(
 	void *opaque, hwaddr offset, unsigned int size
 )
 {
-	CryptoCoreState *s = (CryptoCoreState *)opaque;
+	CryptoCoreState *cs = (CryptoCoreState *)opaque;
+	CryptoCoreBank *s = &cs->banks[offset / CRYPTO_CORE_BANK_SIZE];
+
+	offset %= CRYPTO_CORE_BANK_SIZE;
 	switch(offset)
 	{
 		case REG_ID:
-			return (uint64_t)s->proc_id;
+			return (uint64_t)cs->proc_id;
+		case REG_BANK_COUNT:
+			return CRYPTO_CORE_BANKS;
+		case REG_BANK_WEIGHT:
+			return (uint64_t)s->weight;
+		case REG_BANK_PRIO:
+			return (uint64_t)s->prio;
+		case REG_TS_SUBMIT:
+			return (uint64_t)s->ts_submit;
+		case REG_TS_START:
+			return (uint64_t)s->ts_start;
+		case REG_TS_DONE:
+			return (uint64_t)s->ts_done;
+		case REG_TS_NOW:
+			return (uint64_t)qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+		case REG_STAT_STARTS:
+			return cs->stats.starts;
+		case REG_STAT_BYTES:
+			return cs->stats.bytes;
+		case REG_STAT_KEY_EXPANSIONS:
+			return cs->stats.key_expansions;
+		case REG_STAT_KEY_HITS:
+			return cs->stats.key_hits;
+		case REG_STAT_QUEUE_HWM:
+			return cs->stats.queue_hwm;
+		case REG_STAT_CIPHER_NS:
+			return cs->stats.cipher_ns;
 		case REG_MODE:
 			return (uint64_t)s->mode;
 		case REG_FORMAT:
@@ -698,18 +2072,95 @@ static uint64_t crypto_core_read(
 			return (uint64_t)s->in_char;
 		case REG_OUT_CHAR:
 			return (uint64_t)s->out_char;
+		case REG_KEY_LEN:
+			return (uint64_t)s->key_len;
+		case REG_KEY_SLOT:
+			return (uint64_t)(s->key_slot | (s->key_slot_preloaded ? KEY_SLOT_PRELOADED : 0));
+		case REG_SRC_ADDR:
+			return s->src_addr;
+		case REG_DST_ADDR:
+			return s->dst_addr;
+		case REG_LEN:
+			return s->len;
+		case REG_AAD_ADDR:
+			return s->aad_addr;
+		case REG_AAD_LEN:
+			return s->aad_len;
+		case REG_TAG_0:
+			return (uint64_t)s->tag_0;
+		case REG_TAG_1:
+			return (uint64_t)s->tag_1;
+		case REG_TAG_2:
+			return (uint64_t)s->tag_2;
+		case REG_TAG_3:
+			return (uint64_t)s->tag_3;
+		case REG_STATUS:
+			return (uint64_t)s->status;
+		case REG_SECTOR:
+			return (uint64_t)s->iv_0 | ((uint64_t)s->iv_1 << 32);
+		case REG_SECTOR_SIZE:
+			return (uint64_t)s->sector_size;
+		case REG_DESC_ADDR:
+			return s->desc_addr;
+		case REG_DESC_COUNT:
+			return (uint64_t)s->desc_count;
+		case REG_HASH_CTRL:
+			return (uint64_t)s->hash_ctrl;
+		case REG_DIGEST_0:
+		case REG_DIGEST_1:
+		case REG_DIGEST_2:
+		case REG_DIGEST_3:
+		case REG_DIGEST_4:
+		case REG_DIGEST_5:
+		case REG_DIGEST_6:
+		case REG_DIGEST_7:
+			return (uint64_t)crypto_core_digest_reg(s, (offset - REG_DIGEST_0) / 8);
+		case REG_HASH_COUNT:
+			return s->sha.count;
+		case REG_MAC_ALG:
+			return (uint64_t)s->mac_alg;
+		case REG_CTX_ADDR:
+			return s->ctx_addr;
+		case REG_CTX_CTRL:
+			return (uint64_t)s->ctx_ctrl;
+		case REG_STAT_BLOCKS ... REG_STAT_BLOCKS + CC_FORMATS * 16 - 8:
+			// the counters are 8 bytes wide, the offsets between them are not registers
+			if(offset % 8 != 0)
+			{
+				break;
+			}
+			return cs->stats.blocks[(offset - REG_STAT_BLOCKS) / 16][(offset - REG_STAT_BLOCKS) / 8 % 2];
 		default:
-			return 0xCCCCAAAA;
+			break;
 	
 	}
-	return 0;
+	return CC_NO_REG;
+}
+
+static uint64_t crypto_core_read(
+	void *opaque, hwaddr offset, unsigned int size
+)
+{
+	uint64_t value = crypto_core_read_reg(opaque, offset, size);
+
+	trace_crypto_core_read(offset, value, size);
+	return value;
 }
 
 static void crypto_core_write(
 	void *opaque, hwaddr offset, uint64_t value, unsigned int size
 )
 {
-	CryptoCoreState *s = (CryptoCoreState *)opaque;
+	CryptoCoreState *cs = (CryptoCoreState *)opaque;
+	CryptoCoreBank *s = &cs->banks[offset / CRYPTO_CORE_BANK_SIZE];
+
+	trace_crypto_core_write(offset, value, size);
+
+	offset %= CRYPTO_CORE_BANK_SIZE;
+	if(s->busy || s->pending || s->remote)
+	{
+		return;		// the job still reads these registers, or has not completed yet
+	}
 	switch(offset)
 	{
 		case REG_ID:
@@ -729,66 +2180,7 @@ static void crypto_core_write(
 			{
 				break;
 			}
-
-			uint32_to_uint8(s->key_0, key);
-			uint32_to_uint8(s->key_1, key+4);
-			uint32_to_uint8(s->key_2, key+8);
-			uint32_to_uint8(s->key_3, key+12);
-			uint32_to_uint8(s->key_4, key+16);
-			uint32_to_uint8(s->key_5, key+20);
-			uint32_to_uint8(s->key_6, key+24);
-			uint32_to_uint8(s->key_7, key+28);
-
-			uint32_to_uint8(s->iv_0, vec);
-			uint32_to_uint8(s->iv_1, vec+4);
-			uint32_to_uint8(s->iv_2, vec+8);
-			uint32_to_uint8(s->iv_3, vec+12);
-
-			uint32_to_uint8(s->in_0, to_enc_dec);
-			uint32_to_uint8(s->in_1, to_enc_dec+4);
-			uint32_to_uint8(s->in_2, to_enc_dec+8);
-			uint32_to_uint8(s->in_3, to_enc_dec+12);
-
-			AES_init_ctx_iv(&actx, key, vec);
-
-			// operation
-
-			if(s->mode == (uint32_t)0)	// encrypt
-			{
-				if(s->format == (uint32_t)0)			// ECB
-				{
-					AES_ECB_encrypt(&actx, to_enc_dec);
-				} else if (s->format == (uint32_t)1)		// CBC
-				{
-					AES_CBC_encrypt_buffer(&actx, to_enc_dec, 16);
-				} else						// CTR
-				{
-					AES_CTR_xcrypt_buffer(&actx, to_enc_dec, 16);
-				}
-
-
-			} else				// decrypt
-			{
-
-				if(s->format == (uint32_t)0)			// ECB
-				{
-					AES_ECB_decrypt(&actx, to_enc_dec);
-				} else if (s->format == (uint32_t)1)		// CBC
-				{
-					AES_CBC_decrypt_buffer(&actx, to_enc_dec, 16);
-				} else						// CTR
-				{
-					AES_CTR_xcrypt_buffer(&actx, to_enc_dec, 16);
-				}
-			}
-
-			// output writing
-
-			s->out_0 = uint8_to_uint32(to_enc_dec);
-			s->out_1 = uint8_to_uint32(to_enc_dec+4);
-			s->out_2 = uint8_to_uint32(to_enc_dec+8);
-			s->out_3 = uint8_to_uint32(to_enc_dec+12);
-
+			crypto_core_start(s);
 			break;
 
 		case REG_VALID:
@@ -829,18 +2221,22 @@ static void crypto_core_write(
 
 		case REG_IV_0:
 			s->iv_0 = (uint32_t)value;
+			s->ctr_used = 0;
 			break;
 
 		case REG_IV_1:
 			s->iv_1 = (uint32_t)value;
+			s->ctr_used = 0;
 			break;
 	
 		case REG_IV_2:
 			s->iv_2 = (uint32_t)value;
+			s->ctr_used = 0;
 			break;
 
 		case REG_IV_3:
 			s->iv_3 = (uint32_t)value;
+			s->ctr_used = 0;
 			break;
 
 		case REG_IN_0:
@@ -871,6 +2267,143 @@ static void crypto_core_write(
 			s->iv_char = (uint32_t)value;
 			break;
 
+		case REG_KEY_LEN:
+			s->key_len = (uint32_t)value;
+			break;
+
+		case REG_KEY_SLOT:
+			s->key_slot = ((uint32_t)value & ~KEY_SLOT_PRELOADED) % CC_KEY_SLOTS;
+			s->key_slot_preloaded = (value & KEY_SLOT_PRELOADED) != 0;
+			break;
+
+		case REG_SRC_ADDR:
+			s->src_addr = value;
+			break;
+
+		case REG_DST_ADDR:
+			s->dst_addr = value;
+			break;
+
+		case REG_LEN:
+			s->len = value;
+			break;
+
+		case REG_AAD_ADDR:
+			s->aad_addr = value;
+			break;
+
+		case REG_AAD_LEN:
+			s->aad_len = value;
+			break;
+
+		case REG_TAG_0:
+			s->tag_0 = (uint32_t)value;
+			break;
+
+		case REG_TAG_1:
+			s->tag_1 = (uint32_t)value;
+			break;
+
+		case REG_TAG_2:
+			s->tag_2 = (uint32_t)value;
+			break;
+
+		case REG_TAG_3:
+			s->tag_3 = (uint32_t)value;
+			break;
+
+		case REG_KEY2_0:
+			s->key2_0 = (uint32_t)value;
+			break;
+
+		case REG_KEY2_1:
+			s->key2_1 = (uint32_t)value;
+			break;
+
+		case REG_KEY2_2:
+			s->key2_2 = (uint32_t)value;
+			break;
+
+		case REG_KEY2_3:
+			s->key2_3 = (uint32_t)value;
+			break;
+
+		case REG_KEY2_4:
+			s->key2_4 = (uint32_t)value;
+			break;
+
+		case REG_KEY2_5:
+			s->key2_5 = (uint32_t)value;
+			break;
+
+		case REG_KEY2_6:
+			s->key2_6 = (uint32_t)value;
+			break;
+
+		case REG_KEY2_7:
+			s->key2_7 = (uint32_t)value;
+			break;
+
+		case REG_SECTOR:
+			s->iv_0 = (uint32_t)value;
+			s->iv_1 = (uint32_t)(value >> 32);
+			s->iv_2 = 0;
+			s->iv_3 = 0;
+			s->ctr_used = 0;
+			break;
+
+		case REG_SECTOR_SIZE:
+			s->sector_size = (uint32_t)value;
+			break;
+
+		case REG_DESC_ADDR:
+			s->desc_addr = value;
+			break;
+
+		case REG_DESC_COUNT:
+			s->desc_count = (uint32_t)value;
+			break;
+
+		case REG_HASH_CTRL:
+			s->hash_ctrl = (uint32_t)value;
+			break;
+
+		case REG_DIGEST_0:
+		case REG_DIGEST_1:
+		case REG_DIGEST_2:
+		case REG_DIGEST_3:
+		case REG_DIGEST_4:
+		case REG_DIGEST_5:
+		case REG_DIGEST_6:
+		case REG_DIGEST_7:
+			s->sha.H[(offset - REG_DIGEST_0) / 8] = bswap32((uint32_t)value);
+			break;
+
+		case REG_HASH_COUNT:
+			s->sha.count = value;
+			s->sha.buflen = 0;
+			break;
+
+		case REG_MAC_ALG:
+			s->mac_alg = (uint32_t)value;
+			break;
+
+		case REG_CTX_ADDR:
+			s->ctx_addr = value;
+			break;
+
+		case REG_CTX_CTRL:
+			s->ctx_ctrl = (uint32_t)value;
+			break;
+
+		case REG_BANK_WEIGHT:
+			s->weight = MIN(MAX((uint32_t)value, 1), CC_MAX_WEIGHT);
+			break;
+
+		case REG_BANK_PRIO:
+			s->prio = value ? 1 : 0;
+			break;
+
 		default:
 			break;
 	}
@@ -880,17 +2413,246 @@ static const MemoryRegionOps crypto_core_ops = {
 	.read = crypto_core_read,
 	.write = crypto_core_write,
 	.endianness = DEVICE_NATIVE_ENDIAN,
+	.valid = {
+		.min_access_size = 4,
+		.max_access_size = 8,	// 64 bit DMA address and length registers
+	},
+	.impl = {
+		.min_access_size = 4,
+		.max_access_size = 8,
+	},
 };
 
+static void crypto_core_add_stat_props(CryptoCoreState *s)
+{
+	Object *obj = OBJECT(s);
+	unsigned f;
+	char *name;
+
+	object_property_add_uint64_ptr(obj, "stat-starts", &s->stats.starts, OBJ_PROP_FLAG_READ);
+	object_property_add_uint64_ptr(obj, "stat-bytes", &s->stats.bytes, OBJ_PROP_FLAG_READ);
+	object_property_add_uint64_ptr(obj, "stat-key-expansions", &s->stats.key_expansions, OBJ_PROP_FLAG_READ);
+	object_property_add_uint64_ptr(obj, "stat-key-hits", &s->stats.key_hits, OBJ_PROP_FLAG_READ);
+	object_property_add_uint64_ptr(obj, "stat-queue-hwm", &s->stats.queue_hwm, OBJ_PROP_FLAG_READ);
+	object_property_add_uint64_ptr(obj, "stat-cipher-ns", &s->stats.cipher_ns, OBJ_PROP_FLAG_READ);
+	for(f = 0; f < CC_FORMATS; f += 1)
+	{
+		name = g_strdup_printf("stat-blocks-%s-enc", crypto_core_format_names[f]);
+		object_property_add_uint64_ptr(obj, name, &s->stats.blocks[f][0], OBJ_PROP_FLAG_READ);
+		g_free(name);
+		name = g_strdup_printf("stat-blocks-%s-dec", crypto_core_format_names[f]);
+		object_property_add_uint64_ptr(obj, name, &s->stats.blocks[f][1], OBJ_PROP_FLAG_READ);
+		g_free(name);
+	}
+}
+
+static int crypto_core_print_stats(Object *obj, void *opaque)
+{
+	CryptoCoreState *s = (CryptoCoreState *)object_dynamic_cast(obj, TYPE_CRYPTO_CORE);
+	GString *buf = opaque;
+	g_autofree char *path = NULL;
+	unsigned f, i;
+
+	if(!s)
+	{
+		return 0;
+	}
+	path = object_get_canonical_path(obj);
+	g_string_append_printf(buf, "%s: backend %s%s%s\n", path,
+		s->qcrypto ? "qcrypto" : AES_backend_name(AES_get_backend()),
+		s->remote_fd >= 0 ? ", remote " : "", s->remote_fd >= 0 ? s->remote_path : "");
+	g_string_append_printf(buf, "  starts %" PRIu64 ", bytes %" PRIu64 ", cipher time %" PRIu64 " ns\n",
+		s->stats.starts, s->stats.bytes, s->stats.cipher_ns);
+	g_string_append_printf(buf, "  key expansions %" PRIu64 ", key slot hits %" PRIu64 "\n",
+		s->stats.key_expansions, s->stats.key_hits);
+	g_string_append_printf(buf, "  queued banks now %u, high water mark %" PRIu64 "\n",
+		s->queued, s->stats.queue_hwm);
+	g_string_append_printf(buf, "  %-18s %14s %14s\n", "format", "enc blocks", "dec blocks");
+	for(f = 0; f < CC_FORMATS; f += 1)
+	{
+		g_string_append_printf(buf, "  %-18s %14" PRIu64 " %14" PRIu64 "\n", crypto_core_format_names[f],
+			s->stats.blocks[f][0], s->stats.blocks[f][1]);
+	}
+	g_string_append(buf, "  job latency, START to VALID:\n");
+	for(f = 0; f < CC_FORMATS; f += 1)
+	{
+		for(i = 0; i < CC_LAT_BUCKETS; i += 1)
+		{
+			if(s->stats.latency[f][i] != 0)
+			{
+				g_string_append_printf(buf, "  %-18s >= %12" PRIu64 " ns %12" PRIu64 "\n",
+					crypto_core_format_names[f], i ? (uint64_t)1 << i : 0, s->stats.latency[f][i]);
+			}
+		}
+	}
+	return 0;
+}
+
+// "info crypto-core"
+static HumanReadableText *crypto_core_hmp_info(Error **errp)
+{
+	g_autoptr(GString) buf = g_string_new("");
+
+	object_child_foreach_recursive(object_get_root(), crypto_core_print_stats, buf);
+	return human_readable_text_from_str(buf);
+}
+
 static void crypto_core_instance_init(Object *obj)
 {
 	CryptoCoreState *s = CRYPTO_CORE(obj);
+	unsigned i;
 
-	memory_region_init_io(&s->iomem, obj, &crypto_core_ops, s, TYPE_CRYPTO_CORE, 0x200);
+	memory_region_init_io(&s->iomem, obj, &crypto_core_ops, s, TYPE_CRYPTO_CORE, CRYPTO_CORE_MMIO_SIZE);
 	sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->iomem);
 
 	s->proc_id = 0xBACCCCAB;
-	s->start = 0x00000000;
+	for(i = 0; i < CRYPTO_CORE_BANKS; i += 1)
+	{
+		s->banks[i].core = s;
+		s->banks[i].start = 0x00000000;
+		s->banks[i].key_len = AES_DEFAULT_KEY_LEN;
+		s->banks[i].weight = 1;
+		SHA256_init(&s->banks[i].sha);
+	}
+	s->remote_fd = -1;
+	crypto_core_add_stat_props(s);
+}
+
+// Defaults: a 1 GHz core, one AES round per cycle plus load and store.
+static Property crypto_core_properties[] = {
+	DEFINE_PROP_BOOL("timing-model", CryptoCoreState, model, false),
+	DEFINE_PROP_UINT32("setup-ns", CryptoCoreState, model_setup_ns, 200),
+	DEFINE_PROP_UINT32("clock-mhz", CryptoCoreState, model_clock_mhz, 1000),
+	DEFINE_PROP_UINT32("key-expansion-cycles", CryptoCoreState, model_key_cycles, 44),
+	DEFINE_PROP_UINT32("lanes", CryptoCoreState, model_lanes, 1),
+	DEFINE_PROP_UINT32("cpb-ecb", CryptoCoreState, model_cpb[FORMAT_ECB], 16),
+	DEFINE_PROP_UINT32("cpb-cbc", CryptoCoreState, model_cpb[FORMAT_CBC], 16),
+	DEFINE_PROP_UINT32("cpb-ctr", CryptoCoreState, model_cpb[FORMAT_CTR], 16),
+	DEFINE_PROP_UINT32("cpb-gcm", CryptoCoreState, model_cpb[FORMAT_GCM], 18),
+	DEFINE_PROP_UINT32("cpb-xts", CryptoCoreState, model_cpb[FORMAT_XTS], 18),
+	DEFINE_PROP_UINT32("cpb-cmac", CryptoCoreState, model_cpb[FORMAT_CMAC], 16),
+	DEFINE_PROP_UINT32("cpb-cbc-mac", CryptoCoreState, model_cpb[FORMAT_CBC_MAC], 16),
+	DEFINE_PROP_UINT32("cpb-sha256", CryptoCoreState, model_cpb[FORMAT_SHA256], 20),
+	DEFINE_PROP_UINT32("cpb-chacha20-poly1305", CryptoCoreState, model_cpb[FORMAT_CHACHA20_POLY1305], 12),
+	DEFINE_PROP_UINT32("cpb-drbg", CryptoCoreState, model_cpb[FORMAT_DRBG], 16),
+	DEFINE_PROP_UINT32("cpb-keyload", CryptoCoreState, model_cpb[FORMAT_KEYLOAD], 0),
+	DEFINE_PROP_STRING("workload-trace", CryptoCoreState, wl_path),
+	DEFINE_PROP_STRING("backend", CryptoCoreState, backend),
+	DEFINE_PROP_STRING("remote", CryptoCoreState, remote_path),
+	DEFINE_PROP_END_OF_LIST(),
+};
+
+static void crypto_core_unrealize(DeviceState *dev)
+{
+	CryptoCoreState *s = CRYPTO_CORE(dev);
+	unsigned i;
+
+	// the listener stays registered after crypto_core_remote_close()
+	if(s->remote_listener.commit)
+	{
+		memory_listener_unregister(&s->remote_listener);
+	}
+	if(s->remote_fd >= 0)
+	{
+		qemu_set_fd_handler(s->remote_fd, NULL, NULL, NULL);
+		close(s->remote_fd);
+		s->remote_fd = -1;
+	}
+	if(s->wl_file)
+	{
+		fclose(s->wl_file);
+		s->wl_file = NULL;
+	}
+	for(i = 0; i < CRYPTO_CORE_BANKS; i += 1)
+	{
+		if(s->banks[i].model_timer)
+		{
+			timer_free(s->banks[i].model_timer);
+			s->banks[i].model_timer = NULL;
+		}
+	}
+	if(s->sched_bh)
+	{
+		qemu_bh_delete(s->sched_bh);
+		s->sched_bh = NULL;
+	}
+}
+
+static void crypto_core_realize(DeviceState *dev, Error **errp)
+{
+	CryptoCoreState *s = CRYPTO_CORE(dev);
+	uint8_t hdr[8];
+	unsigned i;
+
+	// "builtin" (default): crypto_core_aes.c. "qcrypto": ECB, CBC, CTR and XTS
+	// through QEMU's cipher layer (nettle, gcrypt or gnutls), the rest built-in.
+	if(s->backend && strcmp(s->backend, "qcrypto") == 0)
+	{
+		if(!qcrypto_cipher_supports(QCRYPTO_CIPHER_ALG_AES_256, QCRYPTO_CIPHER_MODE_ECB))
+		{
+			error_setg(errp, "crypto_core: backend=qcrypto, but QEMU was built without an AES cipher");
+			return;
+		}
+		s->qcrypto = true;
+	} else if(s->backend && strcmp(s->backend, "builtin") != 0)
+	{
+		error_setg(errp, "crypto_core: unknown backend '%s' (builtin, qcrypto)", s->backend);
+		return;
+	}
+
+	s->sched_bh = qemu_bh_new(crypto_core_sched_bh, s);
+	for(i = 0; i < CRYPTO_CORE_BANKS; i += 1)
+	{
+		s->banks[i].model_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, crypto_core_model_timer, &s->banks[i]);
+	}
+
+	if(s->remote_path)
+	{
+		s->remote_fd = unix_connect(s->remote_path, errp);
+		if(s->remote_fd < 0)
+		{
+			s->remote_fd = -1;
+			crypto_core_unrealize(dev);
+			return;
+		}
+		qemu_set_fd_handler(s->remote_fd, crypto_core_remote_read, NULL, s);
+		s->remote_listener = (MemoryListener) {
+			.name = "crypto_core-remote",
+			.begin = crypto_core_remote_begin,
+			.region_add = crypto_core_remote_region,
+			.region_nop = crypto_core_remote_region,
+			.commit = crypto_core_remote_commit,
+		};
+		memory_listener_register(&s->remote_listener, &address_space_memory);
+	}
+
+	if(!s->wl_path)
+	{
+		return;
+	}
+	s->wl_file = fopen(s->wl_path, "wb");
+	if(!s->wl_file)
+	{
+		error_setg_file_open(errp, errno, s->wl_path);
+		crypto_core_unrealize(dev);
+		return;
+	}
+	stl_le_p(hdr, CC_WL_MAGIC);
+	stl_le_p(hdr + 4, CC_WL_VERSION);
+	if(fwrite(hdr, sizeof(hdr), 1, s->wl_file) != 1)
+	{
+		error_setg_errno(errp, errno, "crypto_core: cannot write %s", s->wl_path);
+		crypto_core_unrealize(dev);
+	}
+}
+
+static void crypto_core_class_init(ObjectClass *klass, void *data)
+{
+	DeviceClass *dc = DEVICE_CLASS(klass);
+
+	dc->realize = crypto_core_realize;
+	dc->unrealize = crypto_core_unrealize;
+	device_class_set_props(dc, crypto_core_properties);
 }
 
 static const TypeInfo crypto_core_info = {
@@ -898,11 +2660,14 @@ static const TypeInfo crypto_core_info = {
 	.parent = TYPE_SYS_BUS_DEVICE,
 	.instance_size = sizeof(CryptoCoreState),
 	.instance_init = crypto_core_instance_init,
+	.class_init = crypto_core_class_init,
 };
 
 static void crypto_core_register_types(void)
 {
+	crypto_core_detect_host();
 	type_register_static(&crypto_core_info);
+	monitor_register_hmp_info_hrt("crypto-core", crypto_core_hmp_info);
 }
 
 type_init(crypto_core_register_types)
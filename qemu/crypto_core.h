@@ -3,6 +3,10 @@
 
 #include "qom/object.h"
 
+#define CRYPTO_CORE_BANKS 8
+#define CRYPTO_CORE_BANK_SIZE 0x1000
+#define CRYPTO_CORE_MMIO_SIZE (CRYPTO_CORE_BANKS * CRYPTO_CORE_BANK_SIZE)
+
 DeviceState *crypto_core_create(hwaddr);
 
 #endif
@@ -0,0 +1,2338 @@
+// Cipher, hash and DRBG code of the crypto_core device, see crypto_core_aes.h.
+
+#include <string.h> // CBC mode, for memset
+
+#include "crypto_core_aes.h"
+
+// Parts of the library to build. They are set here rather than in the header
+// so that their plain names do not clash with other headers of the callers
+// (SHA256 is also an OpenSSL function).
+#define CBC 1
+#define ECB 1
+#define CTR 1
+#define GCM 1
+#define XTS 1
+#define CMAC 1
+#define SHA256 1
+#define ETM 1
+#define CHACHAPOLY 1
+#define DRBG 1
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define CRYPTO_CORE_X86 1
+#endif
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+// The number of columns comprising a state in AES. This is a constant in AES. Value=4
+#define Nb 4
+
+// jcallan@github points out that declaring Multiply as a function 
+// reduces code size considerably with the Keil ARM compiler.
+// See this link for more information: https://github.com/kokke/tiny-AES-C/pull/3
+#ifndef MULTIPLY_AS_A_FUNCTION
+  #define MULTIPLY_AS_A_FUNCTION 0
+#endif
+
+
+/*****************************************************************************/
+/* Private variables:                                                        */
+/*****************************************************************************/
+// state - array holding the intermediate results during decryption.
+
+
+// The lookup-tables are marked const so they can be placed in read-only storage instead of RAM
+// The numbers below can be computed dynamically trading ROM for RAM - 
+// This can be useful in (embedded) bootloader applications, where ROM is often limited.
+static const uint8_t sbox[256] = {
+  //0     1    2      3     4    5     6     7      8    9     A      B    C     D     E     F
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+  0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+  0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+  0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+  0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+  0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+  0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+  0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+  0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+  0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+  0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16 };
+
+#if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
+static const uint8_t rsbox[256] = {
+  0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
+  0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
+  0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
+  0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
+  0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
+  0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
+  0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
+  0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
+  0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
+  0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
+  0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
+  0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
+  0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
+  0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
+  0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
+  0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d };
+#endif
+
+// The round constant word array, Rcon[i], contains the values given by 
+// x to the power (i-1) being powers of x (x is denoted as {02}) in the field GF(2^8)
+static const uint8_t Rcon[11] = {
+  0x8d, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+
+/*
+ * Jordan Goulder points out in PR #12 (https://github.com/kokke/tiny-AES-C/pull/12),
+ * that you can remove most of the elements in the Rcon array, because they are unused.
+ *
+ * From Wikipedia's article on the Rijndael key schedule @ https://en.wikipedia.org/wiki/Rijndael_key_schedule#Rcon
+ * 
+ * "Only the first some of these constants are actually used – up to rcon[10] for AES-128 (as 11 round keys are needed), 
+ *  up to rcon[8] for AES-192, up to rcon[7] for AES-256. rcon[0] is not used in AES algorithm."
+ */
+
+
+/*****************************************************************************/
+/* Private functions:                                                        */
+/*****************************************************************************/
+/*
+static uint8_t getSBoxValue(uint8_t num)
+{
+  return sbox[num];
+}
+*/
+#define getSBoxValue(num) (sbox[(num)])
+
+static unsigned host_features;	// HOST_* bits, filled in once by crypto_core_detect_host()
+
+
+// This function produces Nb(Nr+1) round keys. The round keys are used in each round to decrypt the states. 
+void KeyExpansion(uint8_t* RoundKey, const uint8_t* Key, unsigned Nk)
+{
+  const unsigned Nr = Nk + 6;
+  unsigned i, j, k;
+  uint8_t tempa[4]; // Used for the column/row operations
+  
+  // The first round key is the key itself.
+  for (i = 0; i < Nk; ++i)
+  {
+    RoundKey[(i * 4) + 0] = Key[(i * 4) + 0];
+    RoundKey[(i * 4) + 1] = Key[(i * 4) + 1];
+    RoundKey[(i * 4) + 2] = Key[(i * 4) + 2];
+    RoundKey[(i * 4) + 3] = Key[(i * 4) + 3];
+  }
+
+  // All other round keys are found from the previous round keys.
+  for (i = Nk; i < Nb * (Nr + 1); ++i)
+  {
+    {
+      k = (i - 1) * 4;
+      tempa[0]=RoundKey[k + 0];
+      tempa[1]=RoundKey[k + 1];
+      tempa[2]=RoundKey[k + 2];
+      tempa[3]=RoundKey[k + 3];
+
+    }
+
+    if (i % Nk == 0)
+    {
+      // This function shifts the 4 bytes in a word to the left once.
+      // [a0,a1,a2,a3] becomes [a1,a2,a3,a0]
+
+      // Function RotWord()
+      {
+        const uint8_t u8tmp = tempa[0];
+        tempa[0] = tempa[1];
+        tempa[1] = tempa[2];
+        tempa[2] = tempa[3];
+        tempa[3] = u8tmp;
+      }
+
+      // SubWord() is a function that takes a four-byte input word and 
+      // applies the S-box to each of the four bytes to produce an output word.
+
+      // Function Subword()
+      {
+        tempa[0] = getSBoxValue(tempa[0]);
+        tempa[1] = getSBoxValue(tempa[1]);
+        tempa[2] = getSBoxValue(tempa[2]);
+        tempa[3] = getSBoxValue(tempa[3]);
+      }
+
+      tempa[0] = tempa[0] ^ Rcon[i/Nk];
+    }
+    if (Nk == 8 && i % Nk == 4)	// AES-256 only
+    {
+      // Function Subword()
+      {
+        tempa[0] = getSBoxValue(tempa[0]);
+        tempa[1] = getSBoxValue(tempa[1]);
+        tempa[2] = getSBoxValue(tempa[2]);
+        tempa[3] = getSBoxValue(tempa[3]);
+      }
+    }
+    j = i * 4; k=(i - Nk) * 4;
+    RoundKey[j + 0] = RoundKey[k + 0] ^ tempa[0];
+    RoundKey[j + 1] = RoundKey[k + 1] ^ tempa[1];
+    RoundKey[j + 2] = RoundKey[k + 2] ^ tempa[2];
+    RoundKey[j + 3] = RoundKey[k + 3] ^ tempa[3];
+  }
+}
+
+// This function adds the round key to state.
+// The round key is added to the state by an XOR function.
+static void AddRoundKey(uint8_t round, state_t* state, const uint8_t* RoundKey)
+{
+  uint8_t i,j;
+  for (i = 0; i < 4; ++i)
+  {
+    for (j = 0; j < 4; ++j)
+    {
+      (*state)[i][j] ^= RoundKey[(round * Nb * 4) + (i * Nb) + j];
+    }
+  }
+}
+
+// The SubBytes Function Substitutes the values in the
+// state matrix with values in an S-box.
+static void SubBytes(state_t* state)
+{
+  uint8_t i, j;
+  for (i = 0; i < 4; ++i)
+  {
+    for (j = 0; j < 4; ++j)
+    {
+      (*state)[j][i] = getSBoxValue((*state)[j][i]);
+    }
+  }
+}
+
+// The ShiftRows() function shifts the rows in the state to the left.
+// Each row is shifted with different offset.
+// Offset = Row number. So the first row is not shifted.
+static void ShiftRows(state_t* state)
+{
+  uint8_t temp;
+
+  // Rotate first row 1 columns to left  
+  temp           = (*state)[0][1];
+  (*state)[0][1] = (*state)[1][1];
+  (*state)[1][1] = (*state)[2][1];
+  (*state)[2][1] = (*state)[3][1];
+  (*state)[3][1] = temp;
+
+  // Rotate second row 2 columns to left  
+  temp           = (*state)[0][2];
+  (*state)[0][2] = (*state)[2][2];
+  (*state)[2][2] = temp;
+
+  temp           = (*state)[1][2];
+  (*state)[1][2] = (*state)[3][2];
+  (*state)[3][2] = temp;
+
+  // Rotate third row 3 columns to left
+  temp           = (*state)[0][3];
+  (*state)[0][3] = (*state)[3][3];
+  (*state)[3][3] = (*state)[2][3];
+  (*state)[2][3] = (*state)[1][3];
+  (*state)[1][3] = temp;
+}
+
+static uint8_t xtime(uint8_t x)
+{
+  return ((x<<1) ^ (((x>>7) & 1) * 0x1b));
+}
+
+// MixColumns function mixes the columns of the state matrix
+static void MixColumns(state_t* state)
+{
+  uint8_t i;
+  uint8_t Tmp, Tm, t;
+  for (i = 0; i < 4; ++i)
+  {  
+    t   = (*state)[i][0];
+    Tmp = (*state)[i][0] ^ (*state)[i][1] ^ (*state)[i][2] ^ (*state)[i][3] ;
+    Tm  = (*state)[i][0] ^ (*state)[i][1] ; Tm = xtime(Tm);  (*state)[i][0] ^= Tm ^ Tmp ;
+    Tm  = (*state)[i][1] ^ (*state)[i][2] ; Tm = xtime(Tm);  (*state)[i][1] ^= Tm ^ Tmp ;
+    Tm  = (*state)[i][2] ^ (*state)[i][3] ; Tm = xtime(Tm);  (*state)[i][2] ^= Tm ^ Tmp ;
+    Tm  = (*state)[i][3] ^ t ;              Tm = xtime(Tm);  (*state)[i][3] ^= Tm ^ Tmp ;
+  }
+}
+
+// Multiply is used to multiply numbers in the field GF(2^8)
+// Note: The last call to xtime() is unneeded, but often ends up generating a smaller binary
+//       The compiler seems to be able to vectorize the operation better this way.
+//       See https://github.com/kokke/tiny-AES-c/pull/34
+#if MULTIPLY_AS_A_FUNCTION
+static uint8_t Multiply(uint8_t x, uint8_t y)
+{
+  return (((y & 1) * x) ^
+       ((y>>1 & 1) * xtime(x)) ^
+       ((y>>2 & 1) * xtime(xtime(x))) ^
+       ((y>>3 & 1) * xtime(xtime(xtime(x)))) ^
+       ((y>>4 & 1) * xtime(xtime(xtime(xtime(x)))))); /* this last call to xtime() can be omitted */
+  }
+#else
+#define Multiply(x, y)                                \
+      (  ((y & 1) * x) ^                              \
+      ((y>>1 & 1) * xtime(x)) ^                       \
+      ((y>>2 & 1) * xtime(xtime(x))) ^                \
+      ((y>>3 & 1) * xtime(xtime(xtime(x)))) ^         \
+      ((y>>4 & 1) * xtime(xtime(xtime(xtime(x))))))   \
+
+#endif
+
+#if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
+/*
+static uint8_t getSBoxInvert(uint8_t num)
+{
+  return rsbox[num];
+}
+*/
+#define getSBoxInvert(num) (rsbox[(num)])
+
+// MixColumns function mixes the columns of the state matrix.
+// The method used to multiply may be difficult to understand for the inexperienced.
+// Please use the references to gain more information.
+static void InvMixColumns(state_t* state)
+{
+  int i;
+  uint8_t a, b, c, d;
+  for (i = 0; i < 4; ++i)
+  { 
+    a = (*state)[i][0];
+    b = (*state)[i][1];
+    c = (*state)[i][2];
+    d = (*state)[i][3];
+
+    (*state)[i][0] = Multiply(a, 0x0e) ^ Multiply(b, 0x0b) ^ Multiply(c, 0x0d) ^ Multiply(d, 0x09);
+    (*state)[i][1] = Multiply(a, 0x09) ^ Multiply(b, 0x0e) ^ Multiply(c, 0x0b) ^ Multiply(d, 0x0d);
+    (*state)[i][2] = Multiply(a, 0x0d) ^ Multiply(b, 0x09) ^ Multiply(c, 0x0e) ^ Multiply(d, 0x0b);
+    (*state)[i][3] = Multiply(a, 0x0b) ^ Multiply(b, 0x0d) ^ Multiply(c, 0x09) ^ Multiply(d, 0x0e);
+  }
+}
+
+
+// The SubBytes Function Substitutes the values in the
+// state matrix with values in an S-box.
+static void InvSubBytes(state_t* state)
+{
+  uint8_t i, j;
+  for (i = 0; i < 4; ++i)
+  {
+    for (j = 0; j < 4; ++j)
+    {
+      (*state)[j][i] = getSBoxInvert((*state)[j][i]);
+    }
+  }
+}
+
+static void InvShiftRows(state_t* state)
+{
+  uint8_t temp;
+
+  // Rotate first row 1 columns to right  
+  temp = (*state)[3][1];
+  (*state)[3][1] = (*state)[2][1];
+  (*state)[2][1] = (*state)[1][1];
+  (*state)[1][1] = (*state)[0][1];
+  (*state)[0][1] = temp;
+
+  // Rotate second row 2 columns to right 
+  temp = (*state)[0][2];
+  (*state)[0][2] = (*state)[2][2];
+  (*state)[2][2] = temp;
+
+  temp = (*state)[1][2];
+  (*state)[1][2] = (*state)[3][2];
+  (*state)[3][2] = temp;
+
+  // Rotate third row 3 columns to right
+  temp = (*state)[0][3];
+  (*state)[0][3] = (*state)[1][3];
+  (*state)[1][3] = (*state)[2][3];
+  (*state)[2][3] = (*state)[3][3];
+  (*state)[3][3] = temp;
+}
+#endif // #if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
+
+// Cipher is the main function that encrypts the PlainText.
+// There is one version per key size with all the rounds written out, so the
+// round index is a constant and no loop over Nr is left at run time.
+// Every round but the last is SubBytes, ShiftRows, MixColumns, AddRoundKey;
+// the last one has no MixColumns().
+#define CIPHER_ROUND(round)                 \
+  SubBytes(state);                          \
+  ShiftRows(state);                         \
+  MixColumns(state);                        \
+  AddRoundKey((round), state, RoundKey)
+
+#define CIPHER_LAST_ROUND(round)            \
+  SubBytes(state);                          \
+  ShiftRows(state);                         \
+  AddRoundKey((round), state, RoundKey)
+
+static void Cipher128(state_t* state, const uint8_t* RoundKey)
+{
+  AddRoundKey(0, state, RoundKey);
+  CIPHER_ROUND(1);
+  CIPHER_ROUND(2);
+  CIPHER_ROUND(3);
+  CIPHER_ROUND(4);
+  CIPHER_ROUND(5);
+  CIPHER_ROUND(6);
+  CIPHER_ROUND(7);
+  CIPHER_ROUND(8);
+  CIPHER_ROUND(9);
+  CIPHER_LAST_ROUND(10);
+}
+
+static void Cipher192(state_t* state, const uint8_t* RoundKey)
+{
+  AddRoundKey(0, state, RoundKey);
+  CIPHER_ROUND(1);
+  CIPHER_ROUND(2);
+  CIPHER_ROUND(3);
+  CIPHER_ROUND(4);
+  CIPHER_ROUND(5);
+  CIPHER_ROUND(6);
+  CIPHER_ROUND(7);
+  CIPHER_ROUND(8);
+  CIPHER_ROUND(9);
+  CIPHER_ROUND(10);
+  CIPHER_ROUND(11);
+  CIPHER_LAST_ROUND(12);
+}
+
+static void Cipher256(state_t* state, const uint8_t* RoundKey)
+{
+  AddRoundKey(0, state, RoundKey);
+  CIPHER_ROUND(1);
+  CIPHER_ROUND(2);
+  CIPHER_ROUND(3);
+  CIPHER_ROUND(4);
+  CIPHER_ROUND(5);
+  CIPHER_ROUND(6);
+  CIPHER_ROUND(7);
+  CIPHER_ROUND(8);
+  CIPHER_ROUND(9);
+  CIPHER_ROUND(10);
+  CIPHER_ROUND(11);
+  CIPHER_ROUND(12);
+  CIPHER_ROUND(13);
+  CIPHER_LAST_ROUND(14);
+}
+
+#if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
+// InvCipher starts from the last round key and walks back to round 0,
+// which has no InvMixColumns().
+#define INV_CIPHER_ROUND(round)             \
+  InvShiftRows(state);                      \
+  InvSubBytes(state);                       \
+  AddRoundKey((round), state, RoundKey);    \
+  InvMixColumns(state)
+
+#define INV_CIPHER_LAST_ROUND()             \
+  InvShiftRows(state);                      \
+  InvSubBytes(state);                       \
+  AddRoundKey(0, state, RoundKey)
+
+static void InvCipher128(state_t* state, const uint8_t* RoundKey)
+{
+  AddRoundKey(10, state, RoundKey);
+  INV_CIPHER_ROUND(9);
+  INV_CIPHER_ROUND(8);
+  INV_CIPHER_ROUND(7);
+  INV_CIPHER_ROUND(6);
+  INV_CIPHER_ROUND(5);
+  INV_CIPHER_ROUND(4);
+  INV_CIPHER_ROUND(3);
+  INV_CIPHER_ROUND(2);
+  INV_CIPHER_ROUND(1);
+  INV_CIPHER_LAST_ROUND();
+}
+
+static void InvCipher192(state_t* state, const uint8_t* RoundKey)
+{
+  AddRoundKey(12, state, RoundKey);
+  INV_CIPHER_ROUND(11);
+  INV_CIPHER_ROUND(10);
+  INV_CIPHER_ROUND(9);
+  INV_CIPHER_ROUND(8);
+  INV_CIPHER_ROUND(7);
+  INV_CIPHER_ROUND(6);
+  INV_CIPHER_ROUND(5);
+  INV_CIPHER_ROUND(4);
+  INV_CIPHER_ROUND(3);
+  INV_CIPHER_ROUND(2);
+  INV_CIPHER_ROUND(1);
+  INV_CIPHER_LAST_ROUND();
+}
+
+static void InvCipher256(state_t* state, const uint8_t* RoundKey)
+{
+  AddRoundKey(14, state, RoundKey);
+  INV_CIPHER_ROUND(13);
+  INV_CIPHER_ROUND(12);
+  INV_CIPHER_ROUND(11);
+  INV_CIPHER_ROUND(10);
+  INV_CIPHER_ROUND(9);
+  INV_CIPHER_ROUND(8);
+  INV_CIPHER_ROUND(7);
+  INV_CIPHER_ROUND(6);
+  INV_CIPHER_ROUND(5);
+  INV_CIPHER_ROUND(4);
+  INV_CIPHER_ROUND(3);
+  INV_CIPHER_ROUND(2);
+  INV_CIPHER_ROUND(1);
+  INV_CIPHER_LAST_ROUND();
+}
+#endif // #if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
+
+// T-table backend. One round is 16 table lookups on 32 bit big-endian
+// columns: Te[j][x] is the MixColumns column of sbox[x] in row j, so the
+// tables do SubBytes, ShiftRows and MixColumns together, and Td[j] the same
+// for the inverse round. Built once from sbox and rsbox by aes_ttable_init().
+static uint32_t Te[4][256];
+static uint32_t Td[4][256];
+
+static void aes_ttable_init(void)
+{
+  uint32_t e, d;
+  uint8_t s, si;
+  unsigned i, j;
+
+  for (i = 0; i < 256; ++i)
+  {
+    s = sbox[i];
+    si = rsbox[i];
+    e = ((uint32_t)xtime(s) << 24) | ((uint32_t)s << 16) | ((uint32_t)s << 8) | (uint8_t)(xtime(s) ^ s);
+    d = ((uint32_t)(uint8_t)Multiply(si, 0x0e) << 24) | ((uint32_t)(uint8_t)Multiply(si, 0x09) << 16) |
+        ((uint32_t)(uint8_t)Multiply(si, 0x0d) << 8) | (uint8_t)Multiply(si, 0x0b);
+    for (j = 0; j < 4; ++j)
+    {
+      Te[j][i] = e;
+      Td[j][i] = d;
+      e = (e >> 8) | (e << 24);
+      d = (d >> 8) | (d << 24);
+    }
+  }
+}
+
+static inline uint32_t load_be32(const uint8_t* p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void store_be32(uint8_t* p, uint32_t v)
+{
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+#define TE_COL(a, b, c, d) \
+  (Te[0][(a) >> 24] ^ Te[1][((b) >> 16) & 0xff] ^ Te[2][((c) >> 8) & 0xff] ^ Te[3][(d) & 0xff])
+#define TD_COL(a, b, c, d) \
+  (Td[0][(a) >> 24] ^ Td[1][((b) >> 16) & 0xff] ^ Td[2][((c) >> 8) & 0xff] ^ Td[3][(d) & 0xff])
+#define BOX_COL(box, a, b, c, d)                                                  \
+  (((uint32_t)box[(a) >> 24] << 24) | ((uint32_t)box[((b) >> 16) & 0xff] << 16) | \
+   ((uint32_t)box[((c) >> 8) & 0xff] << 8) | box[(d) & 0xff])
+
+// Nr is a constant in every caller, so the round loop is unrolled.
+static inline void ttable_cipher(state_t* state, const uint8_t* RoundKey, unsigned Nr)
+{
+  uint8_t* b = (uint8_t*)state;
+  uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+  unsigned round;
+
+  s0 = load_be32(b) ^ load_be32(RoundKey);
+  s1 = load_be32(b + 4) ^ load_be32(RoundKey + 4);
+  s2 = load_be32(b + 8) ^ load_be32(RoundKey + 8);
+  s3 = load_be32(b + 12) ^ load_be32(RoundKey + 12);
+  for (round = 1; round < Nr; ++round)
+  {
+    RoundKey += AES_BLOCKLEN;
+    t0 = TE_COL(s0, s1, s2, s3) ^ load_be32(RoundKey);
+    t1 = TE_COL(s1, s2, s3, s0) ^ load_be32(RoundKey + 4);
+    t2 = TE_COL(s2, s3, s0, s1) ^ load_be32(RoundKey + 8);
+    t3 = TE_COL(s3, s0, s1, s2) ^ load_be32(RoundKey + 12);
+    s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+  }
+  RoundKey += AES_BLOCKLEN;
+  store_be32(b, BOX_COL(sbox, s0, s1, s2, s3) ^ load_be32(RoundKey));
+  store_be32(b + 4, BOX_COL(sbox, s1, s2, s3, s0) ^ load_be32(RoundKey + 4));
+  store_be32(b + 8, BOX_COL(sbox, s2, s3, s0, s1) ^ load_be32(RoundKey + 8));
+  store_be32(b + 12, BOX_COL(sbox, s3, s0, s1, s2) ^ load_be32(RoundKey + 12));
+}
+
+// DecKey is the equivalent inverse cipher schedule, see ttable_dec_schedule().
+static inline void ttable_inv_cipher(state_t* state, const uint8_t* DecKey, unsigned Nr)
+{
+  uint8_t* b = (uint8_t*)state;
+  uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+  unsigned round;
+
+  s0 = load_be32(b) ^ load_be32(DecKey);
+  s1 = load_be32(b + 4) ^ load_be32(DecKey + 4);
+  s2 = load_be32(b + 8) ^ load_be32(DecKey + 8);
+  s3 = load_be32(b + 12) ^ load_be32(DecKey + 12);
+  for (round = 1; round < Nr; ++round)
+  {
+    DecKey += AES_BLOCKLEN;
+    t0 = TD_COL(s0, s3, s2, s1) ^ load_be32(DecKey);
+    t1 = TD_COL(s1, s0, s3, s2) ^ load_be32(DecKey + 4);
+    t2 = TD_COL(s2, s1, s0, s3) ^ load_be32(DecKey + 8);
+    t3 = TD_COL(s3, s2, s1, s0) ^ load_be32(DecKey + 12);
+    s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+  }
+  DecKey += AES_BLOCKLEN;
+  store_be32(b, BOX_COL(rsbox, s0, s3, s2, s1) ^ load_be32(DecKey));
+  store_be32(b + 4, BOX_COL(rsbox, s1, s0, s3, s2) ^ load_be32(DecKey + 4));
+  store_be32(b + 8, BOX_COL(rsbox, s2, s1, s0, s3) ^ load_be32(DecKey + 8));
+  store_be32(b + 12, BOX_COL(rsbox, s3, s2, s1, s0) ^ load_be32(DecKey + 12));
+}
+
+// Equivalent inverse cipher (FIPS-197 5.3.5): the round keys in reverse
+// order, InvMixColumns applied to all but the first and the last.
+// Td[j][sbox[x]] is InvMixColumns of x in row j.
+static void ttable_dec_schedule(uint8_t* DecKey, const uint8_t* RoundKey, unsigned Nr)
+{
+  unsigned round, i;
+  uint32_t w;
+
+  memcpy(DecKey, RoundKey + Nr * AES_BLOCKLEN, AES_BLOCKLEN);
+  for (round = 1; round < Nr; ++round)
+  {
+    for (i = 0; i < AES_BLOCKLEN; i += 4)
+    {
+      w = load_be32(RoundKey + (Nr - round) * AES_BLOCKLEN + i);
+      store_be32(DecKey + round * AES_BLOCKLEN + i,
+                 Td[0][sbox[w >> 24]] ^ Td[1][sbox[(w >> 16) & 0xff]] ^
+                 Td[2][sbox[(w >> 8) & 0xff]] ^ Td[3][sbox[w & 0xff]]);
+    }
+  }
+  memcpy(DecKey + Nr * AES_BLOCKLEN, RoundKey, AES_BLOCKLEN);
+}
+
+static void TTableCipher128(state_t* state, const uint8_t* RoundKey) { ttable_cipher(state, RoundKey, 10); }
+static void TTableCipher192(state_t* state, const uint8_t* RoundKey) { ttable_cipher(state, RoundKey, 12); }
+static void TTableCipher256(state_t* state, const uint8_t* RoundKey) { ttable_cipher(state, RoundKey, 14); }
+static void TTableInvCipher128(state_t* state, const uint8_t* DecKey) { ttable_inv_cipher(state, DecKey, 10); }
+static void TTableInvCipher192(state_t* state, const uint8_t* DecKey) { ttable_inv_cipher(state, DecKey, 12); }
+static void TTableInvCipher256(state_t* state, const uint8_t* DecKey) { ttable_inv_cipher(state, DecKey, 14); }
+
+#ifdef CRYPTO_CORE_X86
+
+// AES-NI backend: one aesenc/aesdec per round. It decrypts with the same
+// equivalent inverse schedule as the T-tables, computed with aesimc.
+#define AESNI_TARGET __attribute__((target("aes,sse2")))
+
+static inline AESNI_TARGET void aesni_cipher(state_t* state, const uint8_t* RoundKey, unsigned Nr)
+{
+  const __m128i* rk = (const __m128i*)RoundKey;
+  __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*)state), _mm_loadu_si128(rk));
+  unsigned round;
+
+  for (round = 1; round < Nr; ++round)
+  {
+    b = _mm_aesenc_si128(b, _mm_loadu_si128(rk + round));
+  }
+  _mm_storeu_si128((__m128i*)state, _mm_aesenclast_si128(b, _mm_loadu_si128(rk + Nr)));
+}
+
+static inline AESNI_TARGET void aesni_inv_cipher(state_t* state, const uint8_t* DecKey, unsigned Nr)
+{
+  const __m128i* dk = (const __m128i*)DecKey;
+  __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*)state), _mm_loadu_si128(dk));
+  unsigned round;
+
+  for (round = 1; round < Nr; ++round)
+  {
+    b = _mm_aesdec_si128(b, _mm_loadu_si128(dk + round));
+  }
+  _mm_storeu_si128((__m128i*)state, _mm_aesdeclast_si128(b, _mm_loadu_si128(dk + Nr)));
+}
+
+static AESNI_TARGET void aesni_dec_schedule(uint8_t* DecKey, const uint8_t* RoundKey, unsigned Nr)
+{
+  const __m128i* rk = (const __m128i*)RoundKey;
+  __m128i* dk = (__m128i*)DecKey;
+  unsigned round;
+
+  _mm_storeu_si128(dk, _mm_loadu_si128(rk + Nr));
+  for (round = 1; round < Nr; ++round)
+  {
+    _mm_storeu_si128(dk + round, _mm_aesimc_si128(_mm_loadu_si128(rk + Nr - round)));
+  }
+  _mm_storeu_si128(dk + Nr, _mm_loadu_si128(rk));
+}
+
+static AESNI_TARGET void SimdCipher128(state_t* state, const uint8_t* RoundKey) { aesni_cipher(state, RoundKey, 10); }
+static AESNI_TARGET void SimdCipher192(state_t* state, const uint8_t* RoundKey) { aesni_cipher(state, RoundKey, 12); }
+static AESNI_TARGET void SimdCipher256(state_t* state, const uint8_t* RoundKey) { aesni_cipher(state, RoundKey, 14); }
+static AESNI_TARGET void SimdInvCipher128(state_t* state, const uint8_t* DecKey) { aesni_inv_cipher(state, DecKey, 10); }
+static AESNI_TARGET void SimdInvCipher192(state_t* state, const uint8_t* DecKey) { aesni_inv_cipher(state, DecKey, 12); }
+static AESNI_TARGET void SimdInvCipher256(state_t* state, const uint8_t* DecKey) { aesni_inv_cipher(state, DecKey, 14); }
+
+#endif // #ifdef CRYPTO_CORE_X86
+
+// Round functions of every backend for AES-128, -192 and -256.
+static const struct
+{
+  const char* name;
+  aes_block_fn Cipher[3];
+  aes_block_fn InvCipher[3];
+} aes_kernels[AES_BACKENDS] = {
+  [AES_BACKEND_REF] = { "reference", { Cipher128, Cipher192, Cipher256 },
+                        { InvCipher128, InvCipher192, InvCipher256 } },
+  [AES_BACKEND_TTABLE] = { "t-table", { TTableCipher128, TTableCipher192, TTableCipher256 },
+                           { TTableInvCipher128, TTableInvCipher192, TTableInvCipher256 } },
+#ifdef CRYPTO_CORE_X86
+  [AES_BACKEND_SIMD] = { "aes-ni", { SimdCipher128, SimdCipher192, SimdCipher256 },
+                         { SimdInvCipher128, SimdInvCipher192, SimdInvCipher256 } },
+#else
+  [AES_BACKEND_SIMD] = { "aes-ni" },
+#endif
+};
+
+static int aes_backend = AES_BACKEND_REF;	// set by crypto_core_detect_host()
+
+int AES_set_backend(int backend)
+{
+  if (backend < 0 || backend >= AES_BACKENDS || !aes_kernels[backend].Cipher[0])
+  {
+    return -1;
+  }
+#ifdef CRYPTO_CORE_X86
+  if (backend == AES_BACKEND_SIMD && !(host_features & HOST_AESNI))
+  {
+    return -1;
+  }
+#endif
+  if (backend == AES_BACKEND_TTABLE)
+  {
+    aes_ttable_init();
+  }
+  aes_backend = backend;
+  return 0;
+}
+
+int AES_get_backend(void)
+{
+  return aes_backend;
+}
+
+const char* AES_backend_name(int backend)
+{
+  return backend >= 0 && backend < AES_BACKENDS ? aes_kernels[backend].name : "?";
+}
+
+// Picks the round functions of the current backend matching the key length
+// (in bytes) and derives the decryption schedule from the expanded key.
+static void AES_ctx_set_kernels(struct AES_ctx* ctx, unsigned keylen)
+{
+  unsigned size = keylen == 16 ? 0 : keylen == 24 ? 1 : 2;
+  unsigned Nr = 10 + 2 * size;
+
+  ctx->Cipher = aes_kernels[aes_backend].Cipher[size];
+  ctx->InvCipher = aes_kernels[aes_backend].InvCipher[size];
+  switch (aes_backend)
+  {
+    case AES_BACKEND_TTABLE:
+      ttable_dec_schedule(ctx->DecKey, ctx->RoundKey, Nr);
+      break;
+#ifdef CRYPTO_CORE_X86
+    case AES_BACKEND_SIMD:
+      aesni_dec_schedule(ctx->DecKey, ctx->RoundKey, Nr);
+      break;
+#endif
+    default:
+      memcpy(ctx->DecKey, ctx->RoundKey, (Nr + 1) * AES_BLOCKLEN);
+      break;
+  }
+}
+
+void AES_init_ctx(struct AES_ctx* ctx, const uint8_t* key, unsigned keylen)
+{
+  KeyExpansion(ctx->RoundKey, key, keylen / 4);
+  AES_ctx_set_kernels(ctx, keylen);
+}
+
+#ifdef CRYPTO_CORE_X86
+
+// AES-NI key expansion for up to KEYX_LANES keys at a time. aeskeygenassist
+// has a latency of several cycles, so interleaving independent keys keeps
+// the unit busy where a single schedule would wait on every step.
+#define KEYX_LANES 4
+
+#define KEYX_MIX(k)                                         \
+  k = _mm_xor_si128(k, _mm_slli_si128(k, 4));               \
+  k = _mm_xor_si128(k, _mm_slli_si128(k, 4));               \
+  k = _mm_xor_si128(k, _mm_slli_si128(k, 4))
+
+#define KEYX128_STEP(rcon, r)                                                       \
+  for (j = 0; j < n; ++j)                                                           \
+  {                                                                                 \
+    t = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(k[j], rcon), 0xff);             \
+    KEYX_MIX(k[j]);                                                                 \
+    k[j] = _mm_xor_si128(k[j], t);                                                  \
+    _mm_storeu_si128((__m128i*)(rk[j] + 16 * (r)), k[j]);                           \
+  }
+
+static AESNI_TARGET void aesni_expand128(const uint8_t* keys, uint8_t* const* rk, int n)
+{
+  __m128i k[KEYX_LANES], t;
+  int j;
+
+  for (j = 0; j < n; ++j)
+  {
+    k[j] = _mm_loadu_si128((const __m128i*)(keys + 16 * j));
+    _mm_storeu_si128((__m128i*)rk[j], k[j]);
+  }
+  KEYX128_STEP(0x01, 1) KEYX128_STEP(0x02, 2) KEYX128_STEP(0x04, 3) KEYX128_STEP(0x08, 4)
+  KEYX128_STEP(0x10, 5) KEYX128_STEP(0x20, 6) KEYX128_STEP(0x40, 7) KEYX128_STEP(0x80, 8)
+  KEYX128_STEP(0x1b, 9) KEYX128_STEP(0x36, 10)
+}
+
+// AES-256 alternates a RotWord/SubWord/Rcon step on the even round keys with
+// a SubWord-only step on the odd ones.
+#define KEYX256_STEP(rcon, r, odd)                                                  \
+  for (j = 0; j < n; ++j)                                                           \
+  {                                                                                 \
+    t = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(k1[j], rcon), 0xff);            \
+    KEYX_MIX(k0[j]);                                                                \
+    k0[j] = _mm_xor_si128(k0[j], t);                                                \
+    _mm_storeu_si128((__m128i*)(rk[j] + 16 * (r)), k0[j]);                          \
+    if (odd)                                                                        \
+    {                                                                               \
+      t = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(k0[j], 0), 0xaa);             \
+      KEYX_MIX(k1[j]);                                                              \
+      k1[j] = _mm_xor_si128(k1[j], t);                                              \
+      _mm_storeu_si128((__m128i*)(rk[j] + 16 * ((r) + 1)), k1[j]);                  \
+    }                                                                               \
+  }
+
+static AESNI_TARGET void aesni_expand256(const uint8_t* keys, uint8_t* const* rk, int n)
+{
+  __m128i k0[KEYX_LANES], k1[KEYX_LANES], t;
+  int j;
+
+  for (j = 0; j < n; ++j)
+  {
+    k0[j] = _mm_loadu_si128((const __m128i*)(keys + 32 * j));
+    k1[j] = _mm_loadu_si128((const __m128i*)(keys + 32 * j + 16));
+    _mm_storeu_si128((__m128i*)rk[j], k0[j]);
+    _mm_storeu_si128((__m128i*)(rk[j] + 16), k1[j]);
+  }
+  KEYX256_STEP(0x01, 2, 1) KEYX256_STEP(0x02, 4, 1) KEYX256_STEP(0x04, 6, 1)
+  KEYX256_STEP(0x08, 8, 1) KEYX256_STEP(0x10, 10, 1) KEYX256_STEP(0x20, 12, 1)
+  KEYX256_STEP(0x40, 14, 0)
+}
+
+#endif // #ifdef CRYPTO_CORE_X86
+
+// Expands count keys of keylen bytes, packed back to back, into ctxs[0..count-1].
+// Only the AES-NI backend interleaves the expansions; the others expand every
+// key with AES_init_ctx, as they would one at a time.
+void AES_init_ctx_many(struct AES_ctx* const* ctxs, const uint8_t* keys, size_t count, unsigned keylen)
+{
+  size_t i = 0;
+
+#ifdef CRYPTO_CORE_X86
+  uint8_t* rk[KEYX_LANES];
+  int j, n;
+
+  if (aes_backend == AES_BACKEND_SIMD && keylen != 24)
+  {
+    for (; i < count; i += n)
+    {
+      n = (int)MIN(count - i, KEYX_LANES);
+      for (j = 0; j < n; ++j)
+      {
+        rk[j] = ctxs[i + j]->RoundKey;
+      }
+      if (keylen == 16)
+      {
+        aesni_expand128(keys + i * keylen, rk, n);
+      }
+      else
+      {
+        aesni_expand256(keys + i * keylen, rk, n);
+      }
+      for (j = 0; j < n; ++j)
+      {
+        AES_ctx_set_kernels(ctxs[i + j], keylen);
+      }
+    }
+  }
+#endif
+  for (; i < count; ++i)
+  {
+    AES_init_ctx(ctxs[i], keys + i * keylen, keylen);
+  }
+}
+
+#if (defined(CBC) && (CBC == 1)) || (defined(CTR) && (CTR == 1))
+void AES_ctx_set_iv(struct AES_ctx* ctx, const uint8_t* iv)
+{
+  memcpy (ctx->Iv, iv, AES_BLOCKLEN);
+}
+#endif
+
+/*****************************************************************************/
+/* Public functions:                                                         */
+/*****************************************************************************/
+#if defined(ECB) && (ECB == 1)
+
+
+void AES_ECB_encrypt(const struct AES_ctx* ctx, uint8_t* buf)
+{
+  // The next function call encrypts the PlainText with the Key using AES algorithm.
+  ctx->Cipher((state_t*)buf, ctx->RoundKey);
+}
+
+void AES_ECB_decrypt(const struct AES_ctx* ctx, uint8_t* buf)
+{
+  // The next function call decrypts the PlainText with the Key using AES algorithm.
+  ctx->InvCipher((state_t*)buf, ctx->DecKey);
+}
+
+
+#endif // #if defined(ECB) && (ECB == 1)
+
+
+
+
+
+#if defined(CBC) && (CBC == 1)
+
+
+static void XorWithIv(uint8_t* buf, const uint8_t* Iv)
+{
+  uint8_t i;
+  for (i = 0; i < AES_BLOCKLEN; ++i) // The block in AES is always 128bit no matter the key size
+  {
+    buf[i] ^= Iv[i];
+  }
+}
+
+void AES_CBC_encrypt_buffer(struct AES_ctx *ctx, uint8_t* buf, size_t length)
+{
+  size_t i;
+  uint8_t *Iv = ctx->Iv;
+  for (i = 0; i < length; i += AES_BLOCKLEN)
+  {
+    XorWithIv(buf, Iv);
+    ctx->Cipher((state_t*)buf, ctx->RoundKey);
+    Iv = buf;
+    buf += AES_BLOCKLEN;
+  }
+  /* store Iv in ctx for next call */
+  memcpy(ctx->Iv, Iv, AES_BLOCKLEN);
+}
+
+void AES_CBC_decrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, size_t length)
+{
+  size_t i;
+  uint8_t storeNextIv[AES_BLOCKLEN];
+  for (i = 0; i < length; i += AES_BLOCKLEN)
+  {
+    memcpy(storeNextIv, buf, AES_BLOCKLEN);
+    ctx->InvCipher((state_t*)buf, ctx->DecKey);
+    XorWithIv(buf, ctx->Iv);
+    memcpy(ctx->Iv, storeNextIv, AES_BLOCKLEN);
+    buf += AES_BLOCKLEN;
+  }
+
+}
+
+#endif // #if defined(CBC) && (CBC == 1)
+
+
+
+#if defined(CTR) && (CTR == 1)
+
+/* Symmetrical operation: same function for encrypting as for decrypting. Note any IV/nonce should never be reused with the same key */
+void AES_CTR_xcrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, size_t length)
+{
+  uint8_t buffer[AES_BLOCKLEN];
+  
+  size_t i;
+  int bi;
+  for (i = 0, bi = AES_BLOCKLEN; i < length; ++i, ++bi)
+  {
+    if (bi == AES_BLOCKLEN) /* we need to regen xor compliment in buffer */
+    {
+      
+      memcpy(buffer, ctx->Iv, AES_BLOCKLEN);
+      ctx->Cipher((state_t*)buffer,ctx->RoundKey);
+
+      /* Increment Iv and handle overflow */
+      for (bi = (AES_BLOCKLEN - 1); bi >= 0; --bi)
+      {
+        /* inc will overflow */
+        if (ctx->Iv[bi] == 255)
+        {
+          ctx->Iv[bi] = 0;
+          continue;
+        } 
+        ctx->Iv[bi] += 1;
+        break;   
+      }
+      bi = 0;
+    }
+
+    buf[i] = (buf[i] ^ buffer[bi]);
+  }
+}
+
+#endif // #if defined(CTR) && (CTR == 1)
+
+
+
+#if defined(GCM) && (GCM == 1)
+
+// GHASH multiplies in GF(2^128) with the bit-reflected convention of
+// SP 800-38D. The portable kernel is the 4-bit table method (Shoup); on x86
+// hosts with PCLMULQDQ a carry-less multiply kernel folds four blocks per
+// reduction using the powers of H cached in the key slot.
+
+static const uint64_t ghash_last4[16] = {
+  0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+  0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0 };
+
+static uint64_t load_be64(const uint8_t* p)
+{
+  return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+         ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+}
+
+static void store_be64(uint8_t* p, uint64_t v)
+{
+  uint8_t i;
+  for (i = 0; i < 8; ++i)
+  {
+    p[i] = (uint8_t)(v >> (56 - 8 * i));
+  }
+}
+
+static void ghash_gen_table(GHashKey* gk, const uint8_t* H)
+{
+  uint64_t vh = load_be64(H);
+  uint64_t vl = load_be64(H + 8);
+  int i, j;
+
+  gk->HH[0] = 0;
+  gk->HL[0] = 0;
+  gk->HH[8] = vh;
+  gk->HL[8] = vl;
+
+  // HH/HL[4], [2], [1] are H * x, x^2, x^3
+  for (i = 4; i > 0; i >>= 1)
+  {
+    uint32_t T = (uint32_t)(vl & 1) * 0xe1000000U;
+    vl = (vh << 63) | (vl >> 1);
+    vh = (vh >> 1) ^ ((uint64_t)T << 32);
+    gk->HH[i] = vh;
+    gk->HL[i] = vl;
+  }
+
+  // the other entries are sums of those
+  for (i = 2; i <= 8; i *= 2)
+  {
+    vh = gk->HH[i];
+    vl = gk->HL[i];
+    for (j = 1; j < i; ++j)
+    {
+      gk->HH[i + j] = vh ^ gk->HH[j];
+      gk->HL[i + j] = vl ^ gk->HL[j];
+    }
+  }
+}
+
+// X = X * H, four bits at a time.
+static void ghash_mult_table(const GHashKey* gk, uint8_t* X)
+{
+  uint8_t lo, hi, rem;
+  uint64_t zh, zl;
+  int i;
+
+  lo = X[15] & 0xf;
+  zh = gk->HH[lo];
+  zl = gk->HL[lo];
+
+  for (i = 15; i >= 0; --i)
+  {
+    lo = X[i] & 0xf;
+    hi = (X[i] >> 4) & 0xf;
+
+    if (i != 15)
+    {
+      rem = (uint8_t)zl & 0xf;
+      zl = (zh << 60) | (zl >> 4);
+      zh = (zh >> 4) ^ (ghash_last4[rem] << 48);
+      zh ^= gk->HH[lo];
+      zl ^= gk->HL[lo];
+    }
+
+    rem = (uint8_t)zl & 0xf;
+    zl = (zh << 60) | (zl >> 4);
+    zh = (zh >> 4) ^ (ghash_last4[rem] << 48);
+    zh ^= gk->HH[hi];
+    zl ^= gk->HL[hi];
+  }
+
+  store_be64(X, zh);
+  store_be64(X + 8, zl);
+}
+
+static void ghash_update_table(const GHashKey* gk, uint8_t* X, const uint8_t* data, size_t blocks)
+{
+  uint8_t i;
+  for (; blocks > 0; --blocks, data += AES_BLOCKLEN)
+  {
+    for (i = 0; i < AES_BLOCKLEN; ++i)
+    {
+      X[i] ^= data[i];
+    }
+    ghash_mult_table(gk, X);
+  }
+}
+
+#ifdef CRYPTO_CORE_X86
+
+#define GHASH_CLMUL __attribute__((target("pclmul,ssse3")))
+
+// Adds the unreduced 256 bit carry-less product a * b to hi:lo.
+static inline GHASH_CLMUL void ghash_clmul_acc(__m128i a, __m128i b, __m128i* lo, __m128i* hi)
+{
+  __m128i t0 = _mm_clmulepi64_si128(a, b, 0x00);
+  __m128i t1 = _mm_clmulepi64_si128(a, b, 0x10);
+  __m128i t2 = _mm_clmulepi64_si128(a, b, 0x01);
+  __m128i t3 = _mm_clmulepi64_si128(a, b, 0x11);
+
+  t1 = _mm_xor_si128(t1, t2);
+  *lo = _mm_xor_si128(*lo, _mm_xor_si128(t0, _mm_slli_si128(t1, 8)));
+  *hi = _mm_xor_si128(*hi, _mm_xor_si128(t3, _mm_srli_si128(t1, 8)));
+}
+
+// Shifts the bit-reflected product left by one and reduces it modulo
+// x^128 + x^7 + x^2 + x + 1, as in Intel's carry-less multiplication paper.
+static inline GHASH_CLMUL __m128i ghash_clmul_reduce(__m128i lo, __m128i hi)
+{
+  __m128i t7, t8, t9, t2, t4, t5;
+
+  t7 = _mm_srli_epi32(lo, 31);
+  t8 = _mm_srli_epi32(hi, 31);
+  lo = _mm_slli_epi32(lo, 1);
+  hi = _mm_slli_epi32(hi, 1);
+  t9 = _mm_srli_si128(t7, 12);
+  t8 = _mm_slli_si128(t8, 4);
+  t7 = _mm_slli_si128(t7, 4);
+  lo = _mm_or_si128(lo, t7);
+  hi = _mm_or_si128(hi, t8);
+  hi = _mm_or_si128(hi, t9);
+
+  t7 = _mm_slli_epi32(lo, 31);
+  t8 = _mm_slli_epi32(lo, 30);
+  t9 = _mm_slli_epi32(lo, 25);
+  t7 = _mm_xor_si128(t7, t8);
+  t7 = _mm_xor_si128(t7, t9);
+  t8 = _mm_srli_si128(t7, 4);
+  t7 = _mm_slli_si128(t7, 12);
+  lo = _mm_xor_si128(lo, t7);
+
+  t2 = _mm_srli_epi32(lo, 1);
+  t4 = _mm_srli_epi32(lo, 2);
+  t5 = _mm_srli_epi32(lo, 7);
+  t2 = _mm_xor_si128(t2, t4);
+  t2 = _mm_xor_si128(t2, t5);
+  t2 = _mm_xor_si128(t2, t8);
+  lo = _mm_xor_si128(lo, t2);
+  return _mm_xor_si128(hi, lo);
+}
+
+static GHASH_CLMUL void ghash_update_clmul(const GHashKey* gk, uint8_t* X, const uint8_t* data, size_t blocks)
+{
+  const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  const __m128i h1 = _mm_loadu_si128((const __m128i*)gk->Hpow[0]);
+  const __m128i h2 = _mm_loadu_si128((const __m128i*)gk->Hpow[1]);
+  const __m128i h3 = _mm_loadu_si128((const __m128i*)gk->Hpow[2]);
+  const __m128i h4 = _mm_loadu_si128((const __m128i*)gk->Hpow[3]);
+  __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)X), bswap);
+  __m128i lo, hi, c;
+
+  // X' = (X + C0) * H^4 + C1 * H^3 + C2 * H^2 + C3 * H, one reduction for four blocks
+  for (; blocks >= 4; blocks -= 4, data += 4 * AES_BLOCKLEN)
+  {
+    lo = _mm_setzero_si128();
+    hi = _mm_setzero_si128();
+    c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), bswap);
+    ghash_clmul_acc(_mm_xor_si128(x, c), h4, &lo, &hi);
+    c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), bswap);
+    ghash_clmul_acc(c, h3, &lo, &hi);
+    c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), bswap);
+    ghash_clmul_acc(c, h2, &lo, &hi);
+    c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), bswap);
+    ghash_clmul_acc(c, h1, &lo, &hi);
+    x = ghash_clmul_reduce(lo, hi);
+  }
+
+  for (; blocks > 0; --blocks, data += AES_BLOCKLEN)
+  {
+    lo = _mm_setzero_si128();
+    hi = _mm_setzero_si128();
+    c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), bswap);
+    ghash_clmul_acc(_mm_xor_si128(x, c), h1, &lo, &hi);
+    x = ghash_clmul_reduce(lo, hi);
+  }
+
+  _mm_storeu_si128((__m128i*)X, _mm_shuffle_epi8(x, bswap));
+}
+
+#endif // #ifdef CRYPTO_CORE_X86
+
+void GHASH_init_key(GHashKey* gk, const uint8_t* H)
+{
+  uint8_t P[AES_BLOCKLEN];
+  uint8_t i, j;
+
+  ghash_gen_table(gk, H);
+
+  memcpy(P, H, AES_BLOCKLEN);
+  for (i = 0; i < 4; ++i)
+  {
+    for (j = 0; j < AES_BLOCKLEN; ++j)
+    {
+      gk->Hpow[i][j] = P[AES_BLOCKLEN - 1 - j];
+    }
+    ghash_mult_table(gk, P);
+  }
+}
+
+static void ghash_update_blocks(const GHashKey* gk, uint8_t* X, const uint8_t* data, size_t blocks)
+{
+#ifdef CRYPTO_CORE_X86
+  if (host_features & HOST_PCLMUL)
+  {
+    ghash_update_clmul(gk, X, data, blocks);
+    return;
+  }
+#endif
+  ghash_update_table(gk, X, data, blocks);
+}
+
+// Absorbs length bytes into X, zero padding the last partial block.
+static void GHASH_update(const GHashKey* gk, uint8_t* X, const uint8_t* data, size_t length)
+{
+  size_t blocks = length / AES_BLOCKLEN;
+  size_t rest = length % AES_BLOCKLEN;
+  uint8_t last[AES_BLOCKLEN];
+
+  ghash_update_blocks(gk, X, data, blocks);
+  if (rest)
+  {
+    memset(last, 0, AES_BLOCKLEN);
+    memcpy(last, data + blocks * AES_BLOCKLEN, rest);
+    ghash_update_blocks(gk, X, last, 1);
+  }
+}
+
+// GCM counter mode only increments the low 32 bits of the counter block.
+static void GCM_ctr32(const struct AES_ctx* ctx, const uint8_t* J0, uint8_t* buf, size_t length)
+{
+  uint8_t cb[AES_BLOCKLEN];
+  uint8_t ks[AES_BLOCKLEN];
+  uint32_t ctr = ((uint32_t)J0[12] << 24) | ((uint32_t)J0[13] << 16) | ((uint32_t)J0[14] << 8) | J0[15];
+  size_t i, j, n;
+
+  memcpy(cb, J0, AES_BLOCKLEN);
+  for (i = 0; i < length; i += AES_BLOCKLEN)
+  {
+    ++ctr;
+    cb[12] = (uint8_t)(ctr >> 24);
+    cb[13] = (uint8_t)(ctr >> 16);
+    cb[14] = (uint8_t)(ctr >> 8);
+    cb[15] = (uint8_t)ctr;
+    memcpy(ks, cb, AES_BLOCKLEN);
+    ctx->Cipher((state_t*)ks, ctx->RoundKey);
+
+    n = MIN(AES_BLOCKLEN, length - i);
+    for (j = 0; j < n; ++j)
+    {
+      buf[i + j] ^= ks[j];
+    }
+  }
+}
+
+static void GCM_tag(const struct AES_ctx* ctx, const GHashKey* gk, const uint8_t* J0,
+                    const uint8_t* aad, size_t aad_len, const uint8_t* c, size_t length, uint8_t* tag)
+{
+  uint8_t X[AES_BLOCKLEN] = { 0 };
+  uint8_t lens[AES_BLOCKLEN];
+
+  GHASH_update(gk, X, aad, aad_len);
+  GHASH_update(gk, X, c, length);
+  store_be64(lens, (uint64_t)aad_len * 8);
+  store_be64(lens + 8, (uint64_t)length * 8);
+  GHASH_update(gk, X, lens, AES_BLOCKLEN);
+
+  memcpy(tag, J0, AES_BLOCKLEN);
+  ctx->Cipher((state_t*)tag, ctx->RoundKey);
+  XorWithIv(tag, X);
+}
+
+// Only 96 bit IVs are supported: J0 = IV || 0^31 || 1.
+static void GCM_J0(uint8_t* J0, const uint8_t* iv)
+{
+  memcpy(J0, iv, 12);
+  J0[12] = 0;
+  J0[13] = 0;
+  J0[14] = 0;
+  J0[15] = 1;
+}
+
+void AES_GCM_encrypt_buffer(const struct AES_ctx* ctx, const GHashKey* gk, const uint8_t* iv,
+                            const uint8_t* aad, size_t aad_len, uint8_t* buf, size_t length, uint8_t* tag)
+{
+  uint8_t J0[AES_BLOCKLEN];
+
+  GCM_J0(J0, iv);
+  GCM_ctr32(ctx, J0, buf, length);
+  GCM_tag(ctx, gk, J0, aad, aad_len, buf, length, tag);
+}
+
+// The tag is checked before anything is decrypted; returns 0 when it matches.
+int AES_GCM_decrypt_buffer(const struct AES_ctx* ctx, const GHashKey* gk, const uint8_t* iv,
+                           const uint8_t* aad, size_t aad_len, uint8_t* buf, size_t length, const uint8_t* tag)
+{
+  uint8_t J0[AES_BLOCKLEN];
+  uint8_t computed[AES_BLOCKLEN];
+  uint8_t diff = 0;
+  uint8_t i;
+
+  GCM_J0(J0, iv);
+  GCM_tag(ctx, gk, J0, aad, aad_len, buf, length, computed);
+  for (i = 0; i < AES_BLOCKLEN; ++i)
+  {
+    diff |= computed[i] ^ tag[i];
+  }
+  if (diff)
+  {
+    return -1;
+  }
+  GCM_ctr32(ctx, J0, buf, length);
+  return 0;
+}
+
+#endif // #if defined(GCM) && (GCM == 1)
+
+
+
+#if defined(XTS) && (XTS == 1)
+
+// Multiplies the tweak by alpha in GF(2^128), little-endian as in IEEE 1619.
+static void XTS_mul_alpha(uint8_t* T)
+{
+  uint8_t carry = 0, next;
+  uint8_t i;
+  for (i = 0; i < AES_BLOCKLEN; ++i)
+  {
+    next = T[i] >> 7;
+    T[i] = (uint8_t)(T[i] << 1) | carry;
+    carry = next;
+  }
+  if (carry)
+  {
+    T[0] ^= 0x87;
+  }
+}
+
+static void XTS_block(const struct AES_ctx* ctx, uint8_t* buf, const uint8_t* T, int encrypt)
+{
+  XorWithIv(buf, T);
+  if (encrypt)
+  {
+    ctx->Cipher((state_t*)buf, ctx->RoundKey);
+  }
+  else
+  {
+    ctx->InvCipher((state_t*)buf, ctx->DecKey);
+  }
+  XorWithIv(buf, T);
+}
+
+// Encrypts or decrypts one data unit of at least one block. A trailing
+// partial block is handled with ciphertext stealing.
+void AES_XTS_crypt_unit(const struct AES_ctx* ctx, const struct AES_ctx* tweak_ctx,
+                        const uint8_t* tweak_in, uint8_t* buf, size_t length, int encrypt)
+{
+  uint8_t T[AES_BLOCKLEN];
+  uint8_t T_last[AES_BLOCKLEN];
+  uint8_t cc[AES_BLOCKLEN];
+  size_t blocks = length / AES_BLOCKLEN;
+  size_t rest = length % AES_BLOCKLEN;
+  size_t i;
+
+  memcpy(T, tweak_in, AES_BLOCKLEN);
+  tweak_ctx->Cipher((state_t*)T, tweak_ctx->RoundKey);
+
+  if (rest)
+  {
+    --blocks;	// the last full block takes part in the stealing
+  }
+  for (i = 0; i < blocks; ++i, buf += AES_BLOCKLEN)
+  {
+    XTS_block(ctx, buf, T, encrypt);
+    XTS_mul_alpha(T);
+  }
+  if (rest == 0)
+  {
+    return;
+  }
+
+  // buf is the last full block, followed by rest bytes
+  memcpy(T_last, T, AES_BLOCKLEN);
+  XTS_mul_alpha(T_last);
+  XTS_block(ctx, buf, encrypt ? T : T_last, encrypt);
+  memcpy(cc, buf, AES_BLOCKLEN);
+  memcpy(buf, buf + AES_BLOCKLEN, rest);
+  memcpy(buf + AES_BLOCKLEN, cc, rest);
+  XTS_block(ctx, buf, encrypt ? T_last : T, encrypt);
+}
+
+// Moves the tweak input on to the next data unit.
+void XTS_next_unit(uint8_t* tweak_in)
+{
+  uint8_t i;
+  for (i = 0; i < AES_BLOCKLEN; ++i)
+  {
+    if (++tweak_in[i] != 0)
+    {
+      break;
+    }
+  }
+}
+
+#endif // #if defined(XTS) && (XTS == 1)
+
+
+
+#if defined(CMAC) && (CMAC == 1)
+
+// CBC-MAC over whole blocks; the chaining value is kept in ctx->Iv so a long
+// message can be fed in several pieces.
+void AES_CBC_MAC_update(struct AES_ctx* ctx, const uint8_t* buf, size_t length)
+{
+  size_t i;
+  for (i = 0; i < length; i += AES_BLOCKLEN)
+  {
+    XorWithIv(ctx->Iv, buf + i);
+    ctx->Cipher((state_t*)ctx->Iv, ctx->RoundKey);
+  }
+}
+
+// Doubling in GF(2^128) for the CMAC subkeys (RFC 4493).
+void CMAC_double(uint8_t* out, const uint8_t* in)
+{
+  uint8_t carry = in[0] >> 7;
+  uint8_t i;
+  for (i = 0; i < AES_BLOCKLEN - 1; ++i)
+  {
+    out[i] = (uint8_t)(in[i] << 1) | (in[i + 1] >> 7);
+  }
+  out[AES_BLOCKLEN - 1] = (uint8_t)(in[AES_BLOCKLEN - 1] << 1) ^ (carry * 0x87);
+}
+
+void AES_CMAC_subkeys(const struct AES_ctx* ctx, uint8_t* K1, uint8_t* K2)
+{
+  uint8_t L[AES_BLOCKLEN] = { 0 };
+  ctx->Cipher((state_t*)L, ctx->RoundKey);
+  CMAC_double(K1, L);
+  CMAC_double(K2, K1);
+}
+
+void AES_CMAC(struct AES_ctx* ctx, const uint8_t* K1, const uint8_t* K2,
+              const uint8_t* msg, size_t length, uint8_t* tag)
+{
+  uint8_t last[AES_BLOCKLEN];
+  size_t blocks = length ? (length + AES_BLOCKLEN - 1) / AES_BLOCKLEN : 1;
+  size_t rest = length - (blocks - 1) * AES_BLOCKLEN;
+
+  memset(ctx->Iv, 0, AES_BLOCKLEN);
+  AES_CBC_MAC_update(ctx, msg, (blocks - 1) * AES_BLOCKLEN);
+
+  // the last block is xored with K1 when complete, padded and xored with K2 otherwise
+  memset(last, 0, AES_BLOCKLEN);
+  memcpy(last, msg + (blocks - 1) * AES_BLOCKLEN, rest);
+  if (rest == AES_BLOCKLEN)
+  {
+    XorWithIv(last, K1);
+  }
+  else
+  {
+    last[rest] = 0x80;
+    XorWithIv(last, K2);
+  }
+  AES_CBC_MAC_update(ctx, last, AES_BLOCKLEN);
+  memcpy(tag, ctx->Iv, AES_BLOCKLEN);
+}
+
+#endif // #if defined(CMAC) && (CMAC == 1)
+
+
+
+#if defined(SHA256) && (SHA256 == 1)
+
+static const uint32_t sha256_K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+
+static const uint32_t sha256_H0[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_blocks_ref(uint32_t* H, const uint8_t* data, size_t blocks)
+{
+  uint32_t W[64];
+  uint32_t a, b, c, d, e, f, g, h, t1, t2;
+  int i;
+
+  for (; blocks > 0; --blocks, data += 64)
+  {
+    for (i = 0; i < 16; ++i)
+    {
+      W[i] = ((uint32_t)data[4 * i] << 24) | ((uint32_t)data[4 * i + 1] << 16) |
+             ((uint32_t)data[4 * i + 2] << 8) | data[4 * i + 3];
+    }
+    for (i = 16; i < 64; ++i)
+    {
+      W[i] = W[i - 16] + (ROTR32(W[i - 15], 7) ^ ROTR32(W[i - 15], 18) ^ (W[i - 15] >> 3)) +
+             W[i - 7] + (ROTR32(W[i - 2], 17) ^ ROTR32(W[i - 2], 19) ^ (W[i - 2] >> 10));
+    }
+
+    a = H[0]; b = H[1]; c = H[2]; d = H[3];
+    e = H[4]; f = H[5]; g = H[6]; h = H[7];
+    for (i = 0; i < 64; ++i)
+    {
+      t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_K[i] + W[i];
+      t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+    H[0] += a; H[1] += b; H[2] += c; H[3] += d;
+    H[4] += e; H[5] += f; H[6] += g; H[7] += h;
+  }
+}
+
+#ifdef CRYPTO_CORE_X86
+
+// SHA extensions: four rounds per pair of sha256rnds2, the message schedule
+// in four registers updated with sha256msg1/sha256msg2.
+static __attribute__((target("sha,sse4.1"))) void sha256_blocks_shani(uint32_t* H, const uint8_t* data, size_t blocks)
+{
+  const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, abef, cdgh, tmp;
+  __m128i msg[4];
+  int i;
+
+  tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&H[0]), 0xB1);	// CDAB
+  state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&H[4]), 0x1B);	// EFGH
+  state0 = _mm_alignr_epi8(tmp, state1, 8);					// ABEF
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);					// CDGH
+
+  for (; blocks > 0; --blocks, data += 64)
+  {
+    abef = state0;
+    cdgh = state1;
+
+    for (i = 0; i < 16; ++i)
+    {
+      if (i < 4)
+      {
+        msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * i)), bswap);
+      }
+      else
+      {
+        // W[t] = W[t-16] + s0(W[t-15]) + W[t-7] + s1(W[t-2]), four words at a time
+        tmp = _mm_sha256msg1_epu32(msg[i & 3], msg[(i + 1) & 3]);
+        tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(msg[(i + 3) & 3], msg[(i + 2) & 3], 4));
+        msg[i & 3] = _mm_sha256msg2_epu32(tmp, msg[(i + 3) & 3]);
+      }
+      tmp = _mm_add_epi32(msg[i & 3], _mm_loadu_si128((const __m128i*)&sha256_K[4 * i]));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, tmp);
+      tmp = _mm_shuffle_epi32(tmp, 0x0E);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, tmp);
+    }
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);		// FEBA
+  state1 = _mm_shuffle_epi32(state1, 0xB1);		// DCHG
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);	// DCBA
+  state1 = _mm_alignr_epi8(state1, tmp, 8);		// HGFE
+  _mm_storeu_si128((__m128i*)&H[0], state0);
+  _mm_storeu_si128((__m128i*)&H[4], state1);
+}
+
+#endif // #ifdef CRYPTO_CORE_X86
+
+static void sha256_blocks(uint32_t* H, const uint8_t* data, size_t blocks)
+{
+#ifdef CRYPTO_CORE_X86
+  if (host_features & HOST_SHA)
+  {
+    sha256_blocks_shani(H, data, blocks);
+    return;
+  }
+#endif
+  sha256_blocks_ref(H, data, blocks);
+}
+
+void SHA256_init(SHA256_ctx* ctx)
+{
+  memcpy(ctx->H, sha256_H0, sizeof(ctx->H));
+  ctx->count = 0;
+  ctx->buflen = 0;
+}
+
+void SHA256_update(SHA256_ctx* ctx, const uint8_t* data, size_t length)
+{
+  size_t n;
+
+  ctx->count += length;
+  if (ctx->buflen)
+  {
+    n = MIN(length, 64 - ctx->buflen);
+    memcpy(ctx->buf + ctx->buflen, data, n);
+    ctx->buflen += n;
+    data += n;
+    length -= n;
+    if (ctx->buflen < 64)
+    {
+      return;
+    }
+    sha256_blocks(ctx->H, ctx->buf, 1);
+    ctx->buflen = 0;
+  }
+
+  n = length / 64;
+  sha256_blocks(ctx->H, data, n);
+  data += n * 64;
+  length -= n * 64;
+
+  memcpy(ctx->buf, data, length);
+  ctx->buflen = length;
+}
+
+void SHA256_final(SHA256_ctx* ctx)
+{
+  uint8_t pad[128] = { 0x80 };
+  size_t padlen = (ctx->buflen < 56 ? 56 : 120) - ctx->buflen;
+  uint64_t bits = ctx->count * 8;
+
+  store_be64(pad + padlen, bits);
+  SHA256_update(ctx, pad, padlen + 8);
+}
+
+#endif // #if defined(SHA256) && (SHA256 == 1)
+
+
+
+#if defined(ETM) && (ETM == 1)
+
+// Encrypt-then-MAC runs the cipher and the MAC over the buffer in chunks of
+// one SHA-256 block, so every chunk is still in L1 when the second pass reads it.
+#define ETM_CHUNK 64
+
+// Precomputes the HMAC states after the ipad and opad blocks; the key is at most one block.
+void HMAC_SHA256_init_key(SHA256_ctx* inner, SHA256_ctx* outer, const uint8_t* key, size_t keylen)
+{
+  uint8_t pad[64];
+  size_t i;
+
+  memset(pad, 0x36, sizeof(pad));
+  for (i = 0; i < keylen; ++i)
+  {
+    pad[i] ^= key[i];
+  }
+  SHA256_init(inner);
+  SHA256_update(inner, pad, sizeof(pad));
+
+  for (i = 0; i < sizeof(pad); ++i)
+  {
+    pad[i] ^= 0x36 ^ 0x5c;
+  }
+  SHA256_init(outer);
+  SHA256_update(outer, pad, sizeof(pad));
+}
+
+void ETM_mac_update(ETM_mac* mac, const uint8_t* data, size_t length)
+{
+  size_t n;
+
+  if (mac->alg == MAC_HMAC_SHA256)
+  {
+    SHA256_update(&mac->sha, data, length);
+    return;
+  }
+
+  while (length > 0)
+  {
+    if (mac->lastlen == AES_BLOCKLEN)
+    {
+      XorWithIv(mac->X, mac->last);
+      mac->cmac->Cipher((state_t*)mac->X, mac->cmac->RoundKey);
+      mac->lastlen = 0;
+    }
+    n = MIN(length, AES_BLOCKLEN - mac->lastlen);
+    memcpy(mac->last + mac->lastlen, data, n);
+    mac->lastlen += n;
+    data += n;
+    length -= n;
+  }
+}
+
+void ETM_mac_final(ETM_mac* mac, uint8_t* tag)
+{
+  uint8_t digest[32];
+  int i;
+
+  if (mac->alg == MAC_HMAC_SHA256)
+  {
+    SHA256_final(&mac->sha);
+    for (i = 0; i < 8; ++i)
+    {
+      digest[4 * i] = (uint8_t)(mac->sha.H[i] >> 24);
+      digest[4 * i + 1] = (uint8_t)(mac->sha.H[i] >> 16);
+      digest[4 * i + 2] = (uint8_t)(mac->sha.H[i] >> 8);
+      digest[4 * i + 3] = (uint8_t)mac->sha.H[i];
+    }
+    mac->sha = *mac->outer;
+    SHA256_update(&mac->sha, digest, sizeof(digest));
+    SHA256_final(&mac->sha);
+    for (i = 0; i < 4; ++i)
+    {
+      tag[4 * i] = (uint8_t)(mac->sha.H[i] >> 24);
+      tag[4 * i + 1] = (uint8_t)(mac->sha.H[i] >> 16);
+      tag[4 * i + 2] = (uint8_t)(mac->sha.H[i] >> 8);
+      tag[4 * i + 3] = (uint8_t)mac->sha.H[i];
+    }
+    return;
+  }
+
+  // CMAC: a full last block takes K1, a padded one K2 (RFC 4493)
+  if (mac->lastlen == AES_BLOCKLEN)
+  {
+    XorWithIv(mac->last, mac->K1);
+  }
+  else
+  {
+    memset(mac->last + mac->lastlen, 0, AES_BLOCKLEN - mac->lastlen);
+    mac->last[mac->lastlen] = 0x80;
+    XorWithIv(mac->last, mac->K2);
+  }
+  XorWithIv(mac->X, mac->last);
+  mac->cmac->Cipher((state_t*)mac->X, mac->cmac->RoundKey);
+  memcpy(tag, mac->X, AES_BLOCKLEN);
+}
+
+// CBC or CTR over buf with the MAC taken over the ciphertext chunk by chunk.
+// CBC needs whole blocks; CTR restarts its keystream on every block boundary,
+// which the chunks always fall on.
+void AES_ETM_crypt_buffer(struct AES_ctx* ctx, ETM_mac* mac, uint8_t* buf, size_t length,
+                          int cbc, int encrypt)
+{
+  size_t i, n;
+
+  for (i = 0; i < length; i += n)
+  {
+    n = MIN(length - i, ETM_CHUNK);
+    if (!encrypt)
+    {
+      ETM_mac_update(mac, buf + i, n);
+    }
+    if (!cbc)
+    {
+      AES_CTR_xcrypt_buffer(ctx, buf + i, n);
+    }
+    else if (encrypt)
+    {
+      AES_CBC_encrypt_buffer(ctx, buf + i, n);
+    }
+    else
+    {
+      AES_CBC_decrypt_buffer(ctx, buf + i, n);
+    }
+    if (encrypt)
+    {
+      ETM_mac_update(mac, buf + i, n);
+    }
+  }
+}
+
+#endif // #if defined(ETM) && (ETM == 1)
+
+
+
+#if defined(CHACHAPOLY) && (CHACHAPOLY == 1)
+
+// ChaCha20 keystream (RFC 8439). The SIMD kernels keep one state word per
+// register with one block per lane (4 blocks with SSE2, 8 with AVX2) and
+// transpose back to byte order when the keystream is XORed in.
+
+#define CHACHA_BLOCKLEN 64
+
+static uint32_t load_le32(const uint8_t* p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t load_le64(const uint8_t* p)
+{
+  return (uint64_t)load_le32(p) | ((uint64_t)load_le32(p + 4) << 32);
+}
+
+static void store_le64(uint8_t* p, uint64_t v)
+{
+  int i;
+  for (i = 0; i < 8; ++i)
+  {
+    p[i] = (uint8_t)(v >> (8 * i));
+  }
+}
+
+static void chacha_init_state(uint32_t* x, const uint8_t* key, uint32_t counter, const uint8_t* nonce)
+{
+  int i;
+
+  x[0] = 0x61707865; x[1] = 0x3320646e; x[2] = 0x79622d32; x[3] = 0x6b206574;
+  for (i = 0; i < 8; ++i)
+  {
+    x[4 + i] = load_le32(key + 4 * i);
+  }
+  x[12] = counter;
+  x[13] = load_le32(nonce);
+  x[14] = load_le32(nonce + 4);
+  x[15] = load_le32(nonce + 8);
+}
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define CHACHA_QR(a, b, c, d)                     \
+  a += b; d ^= a; d = ROTL32(d, 16);              \
+  c += d; b ^= c; b = ROTL32(b, 12);              \
+  a += b; d ^= a; d = ROTL32(d, 8);               \
+  c += d; b ^= c; b = ROTL32(b, 7)
+
+static void chacha_block(const uint32_t* in, uint8_t* out)
+{
+  uint32_t x[16];
+  int i;
+
+  memcpy(x, in, sizeof(x));
+  for (i = 0; i < 10; ++i)
+  {
+    CHACHA_QR(x[0], x[4], x[8],  x[12]);
+    CHACHA_QR(x[1], x[5], x[9],  x[13]);
+    CHACHA_QR(x[2], x[6], x[10], x[14]);
+    CHACHA_QR(x[3], x[7], x[11], x[15]);
+    CHACHA_QR(x[0], x[5], x[10], x[15]);
+    CHACHA_QR(x[1], x[6], x[11], x[12]);
+    CHACHA_QR(x[2], x[7], x[8],  x[13]);
+    CHACHA_QR(x[3], x[4], x[9],  x[14]);
+  }
+  for (i = 0; i < 16; ++i)
+  {
+    x[i] += in[i];
+    out[4 * i] = (uint8_t)x[i];
+    out[4 * i + 1] = (uint8_t)(x[i] >> 8);
+    out[4 * i + 2] = (uint8_t)(x[i] >> 16);
+    out[4 * i + 3] = (uint8_t)(x[i] >> 24);
+  }
+}
+
+#ifdef CRYPTO_CORE_X86
+
+#define CHACHA_VQR(ADD, XOR, ROT, a, b, c, d)     \
+  a = ADD(a, b); d = ROT(XOR(d, a), 16);          \
+  c = ADD(c, d); b = ROT(XOR(b, c), 12);          \
+  a = ADD(a, b); d = ROT(XOR(d, a), 8);           \
+  c = ADD(c, d); b = ROT(XOR(b, c), 7)
+
+#define CHACHA_VROUNDS(ADD, XOR, ROT, v)                                \
+  for (i = 0; i < 10; ++i)                                              \
+  {                                                                     \
+    CHACHA_VQR(ADD, XOR, ROT, v[0], v[4], v[8],  v[12]);                \
+    CHACHA_VQR(ADD, XOR, ROT, v[1], v[5], v[9],  v[13]);                \
+    CHACHA_VQR(ADD, XOR, ROT, v[2], v[6], v[10], v[14]);                \
+    CHACHA_VQR(ADD, XOR, ROT, v[3], v[7], v[11], v[15]);                \
+    CHACHA_VQR(ADD, XOR, ROT, v[0], v[5], v[10], v[15]);                \
+    CHACHA_VQR(ADD, XOR, ROT, v[1], v[6], v[11], v[12]);                \
+    CHACHA_VQR(ADD, XOR, ROT, v[2], v[7], v[8],  v[13]);                \
+    CHACHA_VQR(ADD, XOR, ROT, v[3], v[4], v[9],  v[14]);                \
+  }
+
+#define ROTL128(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define ROTL256(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+// Four blocks from x[12], x[12] + 1, ... XORed into buf (256 bytes).
+static __attribute__((target("sse2"))) void chacha_4blocks_sse2(const uint32_t* x, uint8_t* buf)
+{
+  __m128i v[16], t0, t1, t2, t3, r[4];
+  int i, g, j;
+
+  for (i = 0; i < 16; ++i)
+  {
+    v[i] = _mm_set1_epi32((int)x[i]);
+  }
+  v[12] = _mm_add_epi32(v[12], _mm_set_epi32(3, 2, 1, 0));
+  const __m128i ctr = v[12];
+
+  CHACHA_VROUNDS(_mm_add_epi32, _mm_xor_si128, ROTL128, v)
+
+  for (i = 0; i < 16; ++i)
+  {
+    v[i] = _mm_add_epi32(v[i], i == 12 ? ctr : _mm_set1_epi32((int)x[i]));
+  }
+  // words 4g..4g+3 of the four blocks, transposed to one block per register
+  for (g = 0; g < 4; ++g)
+  {
+    t0 = _mm_unpacklo_epi32(v[4 * g], v[4 * g + 1]);
+    t1 = _mm_unpacklo_epi32(v[4 * g + 2], v[4 * g + 3]);
+    t2 = _mm_unpackhi_epi32(v[4 * g], v[4 * g + 1]);
+    t3 = _mm_unpackhi_epi32(v[4 * g + 2], v[4 * g + 3]);
+    r[0] = _mm_unpacklo_epi64(t0, t1);
+    r[1] = _mm_unpackhi_epi64(t0, t1);
+    r[2] = _mm_unpacklo_epi64(t2, t3);
+    r[3] = _mm_unpackhi_epi64(t2, t3);
+    for (j = 0; j < 4; ++j)
+    {
+      __m128i* p = (__m128i*)(buf + CHACHA_BLOCKLEN * j + 16 * g);
+      _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), r[j]));
+    }
+  }
+}
+
+// Eight blocks (512 bytes). Each 128 bit half works like the SSE2 kernel:
+// the low half holds blocks 0-3 and the high half blocks 4-7.
+static __attribute__((target("avx2"))) void chacha_8blocks_avx2(const uint32_t* x, uint8_t* buf)
+{
+  __m256i v[16], t0, t1, t2, t3, r[4];
+  int i, g, j;
+
+  for (i = 0; i < 16; ++i)
+  {
+    v[i] = _mm256_set1_epi32((int)x[i]);
+  }
+  v[12] = _mm256_add_epi32(v[12], _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+  const __m256i ctr = v[12];
+
+  CHACHA_VROUNDS(_mm256_add_epi32, _mm256_xor_si256, ROTL256, v)
+
+  for (i = 0; i < 16; ++i)
+  {
+    v[i] = _mm256_add_epi32(v[i], i == 12 ? ctr : _mm256_set1_epi32((int)x[i]));
+  }
+  for (g = 0; g < 4; ++g)
+  {
+    t0 = _mm256_unpacklo_epi32(v[4 * g], v[4 * g + 1]);
+    t1 = _mm256_unpacklo_epi32(v[4 * g + 2], v[4 * g + 3]);
+    t2 = _mm256_unpackhi_epi32(v[4 * g], v[4 * g + 1]);
+    t3 = _mm256_unpackhi_epi32(v[4 * g + 2], v[4 * g + 3]);
+    r[0] = _mm256_unpacklo_epi64(t0, t1);
+    r[1] = _mm256_unpackhi_epi64(t0, t1);
+    r[2] = _mm256_unpacklo_epi64(t2, t3);
+    r[3] = _mm256_unpackhi_epi64(t2, t3);
+    for (j = 0; j < 4; ++j)
+    {
+      __m128i* lo = (__m128i*)(buf + CHACHA_BLOCKLEN * j + 16 * g);
+      __m128i* hi = (__m128i*)(buf + CHACHA_BLOCKLEN * (j + 4) + 16 * g);
+      _mm_storeu_si128(lo, _mm_xor_si128(_mm_loadu_si128(lo), _mm256_castsi256_si128(r[j])));
+      _mm_storeu_si128(hi, _mm_xor_si128(_mm_loadu_si128(hi), _mm256_extracti128_si256(r[j], 1)));
+    }
+  }
+}
+
+#endif // #ifdef CRYPTO_CORE_X86
+
+// XORs the keystream starting at block x[12] into buf.
+static void ChaCha20_xor(uint32_t* x, uint8_t* buf, size_t length)
+{
+  uint8_t ks[CHACHA_BLOCKLEN];
+  size_t i;
+
+#ifdef CRYPTO_CORE_X86
+  if (host_features & HOST_AVX2)
+  {
+    for (; length >= 8 * CHACHA_BLOCKLEN; length -= 8 * CHACHA_BLOCKLEN, buf += 8 * CHACHA_BLOCKLEN)
+    {
+      chacha_8blocks_avx2(x, buf);
+      x[12] += 8;
+    }
+  }
+  if (host_features & HOST_SSE2)
+  {
+    for (; length >= 4 * CHACHA_BLOCKLEN; length -= 4 * CHACHA_BLOCKLEN, buf += 4 * CHACHA_BLOCKLEN)
+    {
+      chacha_4blocks_sse2(x, buf);
+      x[12] += 4;
+    }
+  }
+#endif
+  while (length > 0)
+  {
+    chacha_block(x, ks);
+    x[12] += 1;
+    for (i = 0; i < CHACHA_BLOCKLEN && i < length; ++i)
+    {
+      buf[i] ^= ks[i];
+    }
+    buf += i;
+    length -= i;
+  }
+}
+
+// Poly1305 with three 44/44/42 bit limbs, products in 128 bit (poly1305-donna-64).
+typedef struct Poly1305_ctx
+{
+  uint64_t r[3];
+  uint64_t h[3];
+  uint64_t pad[2];
+  uint8_t buf[16];
+  size_t leftover;
+} Poly1305_ctx;
+
+#define P1305_M44 0xfffffffffffULL
+#define P1305_M42 0x3ffffffffffULL
+
+static void Poly1305_init(Poly1305_ctx* st, const uint8_t* key)
+{
+  uint64_t t0 = load_le64(key), t1 = load_le64(key + 8);
+
+  st->r[0] = t0 & 0xffc0fffffffULL;
+  st->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+  st->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+  st->h[0] = st->h[1] = st->h[2] = 0;
+  st->pad[0] = load_le64(key + 16);
+  st->pad[1] = load_le64(key + 24);
+  st->leftover = 0;
+}
+
+static void Poly1305_blocks(Poly1305_ctx* st, const uint8_t* m, size_t length, uint64_t hibit)
+{
+  const uint64_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+  const uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+  uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+  unsigned __int128 d0, d1, d2;
+  uint64_t t0, t1, c;
+
+  for (; length >= 16; length -= 16, m += 16)
+  {
+    t0 = load_le64(m);
+    t1 = load_le64(m + 8);
+    h0 += t0 & P1305_M44;
+    h1 += ((t0 >> 44) | (t1 << 20)) & P1305_M44;
+    h2 += ((t1 >> 24) & P1305_M42) | hibit;
+
+    d0 = (unsigned __int128)h0 * r0 + (unsigned __int128)h1 * s2 + (unsigned __int128)h2 * s1;
+    d1 = (unsigned __int128)h0 * r1 + (unsigned __int128)h1 * r0 + (unsigned __int128)h2 * s2;
+    d2 = (unsigned __int128)h0 * r2 + (unsigned __int128)h1 * r1 + (unsigned __int128)h2 * r0;
+
+    c = (uint64_t)(d0 >> 44); h0 = (uint64_t)d0 & P1305_M44;
+    d1 += c; c = (uint64_t)(d1 >> 44); h1 = (uint64_t)d1 & P1305_M44;
+    d2 += c; c = (uint64_t)(d2 >> 42); h2 = (uint64_t)d2 & P1305_M42;
+    h0 += c * 5; c = h0 >> 44; h0 &= P1305_M44;
+    h1 += c;
+  }
+  st->h[0] = h0; st->h[1] = h1; st->h[2] = h2;
+}
+
+static void Poly1305_update(Poly1305_ctx* st, const uint8_t* m, size_t length)
+{
+  size_t n;
+
+  if (st->leftover)
+  {
+    n = MIN(length, 16 - st->leftover);
+    memcpy(st->buf + st->leftover, m, n);
+    st->leftover += n;
+    m += n;
+    length -= n;
+    if (st->leftover < 16)
+    {
+      return;
+    }
+    Poly1305_blocks(st, st->buf, 16, 1ULL << 40);
+    st->leftover = 0;
+  }
+  n = length & ~(size_t)15;
+  Poly1305_blocks(st, m, n, 1ULL << 40);
+  memcpy(st->buf, m + n, length - n);
+  st->leftover = length - n;
+}
+
+// Zero padding to the next 16 byte boundary, as the AEAD construction needs.
+static void Poly1305_pad16(Poly1305_ctx* st)
+{
+  static const uint8_t zero[16];
+  if (st->leftover)
+  {
+    Poly1305_update(st, zero, 16 - st->leftover);
+  }
+}
+
+static void Poly1305_final(Poly1305_ctx* st, uint8_t* tag)
+{
+  uint64_t h0, h1, h2, g0, g1, g2, c, t0, t1;
+
+  if (st->leftover)
+  {
+    st->buf[st->leftover] = 1;
+    memset(st->buf + st->leftover + 1, 0, 15 - st->leftover);
+    Poly1305_blocks(st, st->buf, 16, 0);
+  }
+  h0 = st->h[0]; h1 = st->h[1]; h2 = st->h[2];
+
+  c = h1 >> 44; h1 &= P1305_M44;
+  h2 += c; c = h2 >> 42; h2 &= P1305_M42;
+  h0 += c * 5; c = h0 >> 44; h0 &= P1305_M44;
+  h1 += c; c = h1 >> 44; h1 &= P1305_M44;
+  h2 += c; c = h2 >> 42; h2 &= P1305_M42;
+  h0 += c * 5; c = h0 >> 44; h0 &= P1305_M44;
+  h1 += c;
+
+  // h - p, kept if it did not borrow
+  g0 = h0 + 5; c = g0 >> 44; g0 &= P1305_M44;
+  g1 = h1 + c; c = g1 >> 44; g1 &= P1305_M44;
+  g2 = h2 + c - (1ULL << 42);
+  c = (g2 >> 63) - 1;
+  g0 &= c; g1 &= c; g2 &= c;
+  c = ~c;
+  h0 = (h0 & c) | g0; h1 = (h1 & c) | g1; h2 = (h2 & c) | g2;
+
+  t0 = st->pad[0]; t1 = st->pad[1];
+  h0 += t0 & P1305_M44; c = h0 >> 44; h0 &= P1305_M44;
+  h1 += (((t0 >> 44) | (t1 << 20)) & P1305_M44) + c; c = h1 >> 44; h1 &= P1305_M44;
+  h2 += ((t1 >> 24) & P1305_M42) + c; h2 &= P1305_M42;
+
+  store_le64(tag, h0 | (h1 << 44));
+  store_le64(tag + 8, (h1 >> 20) | (h2 << 24));
+}
+
+static void ChaChaPoly_mac(const uint8_t* otk, const uint8_t* aad, size_t aad_len,
+                           const uint8_t* ct, size_t length, uint8_t* tag)
+{
+  Poly1305_ctx st;
+  uint8_t lens[16];
+
+  Poly1305_init(&st, otk);
+  Poly1305_update(&st, aad, aad_len);
+  Poly1305_pad16(&st);
+  Poly1305_update(&st, ct, length);
+  Poly1305_pad16(&st);
+  store_le64(lens, aad_len);
+  store_le64(lens + 8, length);
+  Poly1305_update(&st, lens, sizeof(lens));
+  Poly1305_final(&st, tag);
+}
+
+// Block 0 gives the Poly1305 key, the data starts at block 1.
+static void ChaChaPoly_setup(uint32_t* x, const uint8_t* key, const uint8_t* nonce, uint8_t* otk)
+{
+  chacha_init_state(x, key, 0, nonce);
+  chacha_block(x, otk);
+  x[12] = 1;
+}
+
+void ChaChaPoly_encrypt_buffer(const uint8_t* key, const uint8_t* nonce, const uint8_t* aad, size_t aad_len,
+                               uint8_t* buf, size_t length, uint8_t* tag)
+{
+  uint32_t x[16];
+  uint8_t otk[CHACHA_BLOCKLEN];
+
+  ChaChaPoly_setup(x, key, nonce, otk);
+  ChaCha20_xor(x, buf, length);
+  ChaChaPoly_mac(otk, aad, aad_len, buf, length, tag);
+}
+
+// Checks the tag before decrypting; returns -1 and leaves buf alone on mismatch.
+int ChaChaPoly_decrypt_buffer(const uint8_t* key, const uint8_t* nonce, const uint8_t* aad, size_t aad_len,
+                              uint8_t* buf, size_t length, const uint8_t* tag)
+{
+  uint32_t x[16];
+  uint8_t otk[CHACHA_BLOCKLEN];
+  uint8_t calc[16];
+  uint8_t diff = 0;
+  int i;
+
+  ChaChaPoly_setup(x, key, nonce, otk);
+  ChaChaPoly_mac(otk, aad, aad_len, buf, length, calc);
+  for (i = 0; i < 16; ++i)
+  {
+    diff |= calc[i] ^ tag[i];
+  }
+  if (diff)
+  {
+    return -1;
+  }
+  ChaCha20_xor(x, buf, length);
+  return 0;
+}
+
+#endif // #if defined(CHACHAPOLY) && (CHACHAPOLY == 1)
+
+
+
+#if defined(DRBG) && (DRBG == 1)
+
+static void DRBG_inc(uint8_t* V)
+{
+  int i;
+  for (i = AES_BLOCKLEN - 1; i >= 0; --i)
+  {
+    if (++V[i] != 0)
+    {
+      break;
+    }
+  }
+}
+
+// CTR_DRBG_Update: a new key and V from three blocks of keystream XOR provided_data.
+static void DRBG_update(DRBG_ctx* drbg, const uint8_t* provided)
+{
+  uint8_t temp[DRBG_SEEDLEN];
+  int i;
+
+  for (i = 0; i < DRBG_SEEDLEN; i += AES_BLOCKLEN)
+  {
+    DRBG_inc(drbg->V);
+    memcpy(temp + i, drbg->V, AES_BLOCKLEN);
+    drbg->ctx.Cipher((state_t*)(temp + i), drbg->ctx.RoundKey);
+  }
+  if (provided)
+  {
+    for (i = 0; i < DRBG_SEEDLEN; ++i)
+    {
+      temp[i] ^= provided[i];
+    }
+  }
+  AES_init_ctx(&drbg->ctx, temp, DRBG_KEYLEN);
+  memcpy(drbg->V, temp + DRBG_KEYLEN, AES_BLOCKLEN);
+  memset(temp, 0, sizeof(temp));
+}
+
+// Instantiate (seeded == false) or reseed from seed_material = entropy XOR additional input.
+void DRBG_seed(DRBG_ctx* drbg, const uint8_t* seed)
+{
+  static const uint8_t zero_key[DRBG_KEYLEN];
+
+  if (!drbg->seeded)
+  {
+    AES_init_ctx(&drbg->ctx, zero_key, DRBG_KEYLEN);
+    memset(drbg->V, 0, AES_BLOCKLEN);
+    drbg->seeded = true;
+  }
+  DRBG_update(drbg, seed);
+  drbg->reseed_counter = 1;
+}
+
+// One generate request of at most DRBG_MAX_REQUEST bytes. addl is NULL or DRBG_SEEDLEN bytes.
+void DRBG_generate(DRBG_ctx* drbg, const uint8_t* addl, uint8_t* out, size_t length)
+{
+  uint8_t block[AES_BLOCKLEN];
+  size_t n;
+
+  if (addl)
+  {
+    DRBG_update(drbg, addl);
+  }
+  for (; length > 0; length -= n, out += n)
+  {
+    DRBG_inc(drbg->V);
+    n = MIN(length, AES_BLOCKLEN);
+    if (n == AES_BLOCKLEN)
+    {
+      memcpy(out, drbg->V, AES_BLOCKLEN);
+      drbg->ctx.Cipher((state_t*)out, drbg->ctx.RoundKey);
+    }
+    else
+    {
+      memcpy(block, drbg->V, AES_BLOCKLEN);
+      drbg->ctx.Cipher((state_t*)block, drbg->ctx.RoundKey);
+      memcpy(out, block, n);
+    }
+  }
+  DRBG_update(drbg, addl);
+  drbg->reseed_counter += 1;
+}
+
+#endif // #if defined(DRBG) && (DRBG == 1)
+
+#ifdef CRYPTO_CORE_X86
+static uint64_t crypto_core_xgetbv0(void)
+{
+  uint32_t lo, hi;
+  __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+  return ((uint64_t)hi << 32) | lo;
+}
+#endif
+
+unsigned crypto_core_detect_host(void)
+{
+#ifdef CRYPTO_CORE_X86
+  unsigned int eax, ebx, ecx, edx;
+  unsigned int ebx7 = 0, ecx7, edx7;
+
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+  {
+    __get_cpuid_count(7, 0, &eax, &ebx7, &ecx7, &edx7);   // leaves ebx7 at 0 without leaf 7
+    if ((ecx & bit_PCLMUL) && (ecx & bit_SSSE3))
+    {
+      host_features |= HOST_PCLMUL;
+    }
+    if (edx & bit_SSE2)
+    {
+      host_features |= HOST_SSE2;
+    }
+    if ((ecx & bit_AES) && (edx & bit_SSE2))
+    {
+      host_features |= HOST_AESNI;
+    }
+    // AVX2 also needs the OS to have enabled the XMM and YMM state in XCR0
+    if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX) && (crypto_core_xgetbv0() & 6) == 6 &&
+        (ebx7 & bit_AVX2))
+    {
+      host_features |= HOST_AVX2;
+    }
+    if ((ecx & bit_SSE4_1) && (ecx & bit_SSSE3) && (ebx7 & bit_SHA))
+    {
+      host_features |= HOST_SHA;
+    }
+  }
+#endif
+  aes_ttable_init();
+  aes_backend = (host_features & HOST_AESNI) ? AES_BACKEND_SIMD : AES_BACKEND_TTABLE;
+  return host_features;
+}
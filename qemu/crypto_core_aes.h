@@ -0,0 +1,157 @@
+#ifndef CRYPTO_CORE_AES_H
+#define CRYPTO_CORE_AES_H
+
+// Cipher, hash and DRBG code of the crypto_core device (tiny-AES based).
+// It has no QEMU dependency: the device links it from hw/misc and the host
+// tools in bench/ and replay/ build it as a plain C library.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define AES_BLOCKLEN 16
+
+#define AES_KEYLEN 32		// largest key (AES-256); shorter keys use the first bytes
+#define AES_keyExpSize 240	// round keys for AES-256, enough for every key size
+
+// Block cipher backends. All of them use the round keys of KeyExpansion();
+// the backend of a context is fixed when its key is expanded.
+#define AES_BACKEND_REF		0	// byte-wise tiny-AES rounds
+#define AES_BACKEND_TTABLE	1	// 32 bit columns with four lookup tables per direction
+#define AES_BACKEND_SIMD	2	// AES-NI
+#define AES_BACKENDS		3
+
+// crypto_core_detect_host() bits
+#define HOST_PCLMUL	(1 << 0)
+#define HOST_SHA	(1 << 1)
+#define HOST_AVX2	(1 << 2)	// also needs the OS to save the YMM state
+#define HOST_SSE2	(1 << 3)
+#define HOST_AESNI	(1 << 4)
+
+// MAC algorithms of the encrypt-then-MAC jobs (REG_MAC_ALG)
+#define MAC_NONE		0
+#define MAC_HMAC_SHA256		1	// truncated to 128 bits
+#define MAC_CMAC		2
+
+typedef uint8_t state_t[4][4];
+
+// Every key size has its own fully unrolled Cipher/InvCipher,
+// picked once when the key is expanded.
+typedef void (*aes_block_fn)(state_t* state, const uint8_t* RoundKey);
+
+// InvCipher takes DecKey: the round keys in the order and form the backend
+// decrypts with (a copy of RoundKey for the reference code, the equivalent
+// inverse cipher schedule for the others).
+struct AES_ctx
+{
+	uint8_t RoundKey[AES_keyExpSize];
+	uint8_t DecKey[AES_keyExpSize];
+	uint8_t Iv[AES_BLOCKLEN];
+	aes_block_fn Cipher;
+	aes_block_fn InvCipher;
+};
+
+// GHASH key for GCM: H = E(K, 0^128) in the two forms the kernels use.
+// HL/HH is the 4-bit table of the portable kernel, Hpow holds H^1..H^4
+// byte-reflected for the carry-less multiply kernel.
+typedef struct GHashKey
+{
+	uint64_t HL[16];
+	uint64_t HH[16];
+	uint8_t Hpow[4][16];
+} GHashKey;
+
+// Streaming SHA-256 state: init/update/final can be spread over several jobs.
+typedef struct SHA256_ctx
+{
+	uint32_t H[8];
+	uint64_t count;		// bytes absorbed so far
+	uint8_t buf[64];	// partial block
+	uint32_t buflen;
+} SHA256_ctx;
+
+// Encrypt-then-MAC state: HMAC-SHA256 or CMAC over the data the caller feeds it
+// (the device authenticates IV, AAD, ciphertext and both lengths).
+typedef struct ETM_mac
+{
+	uint32_t alg;
+	SHA256_ctx sha;			// HMAC: inner hash
+	const SHA256_ctx* outer;
+	const struct AES_ctx* cmac;	// CMAC: key, subkeys and running state
+	uint8_t K1[AES_BLOCKLEN];
+	uint8_t K2[AES_BLOCKLEN];
+	uint8_t X[AES_BLOCKLEN];
+	uint8_t last[AES_BLOCKLEN];	// held back until we know whether it is the final block
+	size_t lastlen;
+} ETM_mac;
+
+// SP 800-90A CTR_DRBG, AES-256 without derivation function. It is seeded
+// from the host on the first DRBG job and reseeded every DRBG_RESEED_INTERVAL
+// requests, which is far below the limit of the standard.
+typedef struct DRBG_ctx
+{
+	struct AES_ctx ctx;
+	uint8_t V[16];
+	uint64_t reseed_counter;
+	bool seeded;
+} DRBG_ctx;
+
+#define DRBG_KEYLEN		32
+#define DRBG_SEEDLEN		(DRBG_KEYLEN + AES_BLOCKLEN)
+#define DRBG_MAX_REQUEST	(1 << 16)	// 2^19 bits per generate request (SP 800-90A, table 3)
+
+// Fills in the host features the kernels dispatch on and picks the fastest
+// block cipher backend; returns the HOST_* bits. Call it once before anything else.
+unsigned crypto_core_detect_host(void);
+
+// Backend for the keys expanded from now on. Returns -1 if the host lacks it.
+int AES_set_backend(int backend);
+int AES_get_backend(void);
+const char* AES_backend_name(int backend);
+
+void KeyExpansion(uint8_t* RoundKey, const uint8_t* Key, unsigned Nk);
+void AES_init_ctx(struct AES_ctx* ctx, const uint8_t* key, unsigned keylen);
+void AES_init_ctx_many(struct AES_ctx* const* ctxs, const uint8_t* keys, size_t count, unsigned keylen);
+void AES_ctx_set_iv(struct AES_ctx* ctx, const uint8_t* iv);
+
+void AES_ECB_encrypt(const struct AES_ctx* ctx, uint8_t* buf);
+void AES_ECB_decrypt(const struct AES_ctx* ctx, uint8_t* buf);
+void AES_CBC_encrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, size_t length);
+void AES_CBC_decrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, size_t length);
+void AES_CTR_xcrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, size_t length);
+
+void GHASH_init_key(GHashKey* gk, const uint8_t* H);
+void AES_GCM_encrypt_buffer(const struct AES_ctx* ctx, const GHashKey* gk, const uint8_t* iv,
+	const uint8_t* aad, size_t aad_len, uint8_t* buf, size_t length, uint8_t* tag);
+int AES_GCM_decrypt_buffer(const struct AES_ctx* ctx, const GHashKey* gk, const uint8_t* iv,
+	const uint8_t* aad, size_t aad_len, uint8_t* buf, size_t length, const uint8_t* tag);
+
+void AES_XTS_crypt_unit(const struct AES_ctx* ctx, const struct AES_ctx* tweak_ctx,
+	const uint8_t* tweak_in, uint8_t* buf, size_t length, int encrypt);
+void XTS_next_unit(uint8_t* tweak_in);
+
+void AES_CBC_MAC_update(struct AES_ctx* ctx, const uint8_t* buf, size_t length);
+void CMAC_double(uint8_t* out, const uint8_t* in);
+void AES_CMAC_subkeys(const struct AES_ctx* ctx, uint8_t* K1, uint8_t* K2);
+void AES_CMAC(struct AES_ctx* ctx, const uint8_t* K1, const uint8_t* K2,
+	const uint8_t* msg, size_t length, uint8_t* tag);
+
+void SHA256_init(SHA256_ctx* ctx);
+void SHA256_update(SHA256_ctx* ctx, const uint8_t* data, size_t length);
+void SHA256_final(SHA256_ctx* ctx);
+
+void HMAC_SHA256_init_key(SHA256_ctx* inner, SHA256_ctx* outer, const uint8_t* key, size_t keylen);
+void ETM_mac_update(ETM_mac* mac, const uint8_t* data, size_t length);
+void ETM_mac_final(ETM_mac* mac, uint8_t* tag);
+void AES_ETM_crypt_buffer(struct AES_ctx* ctx, ETM_mac* mac, uint8_t* buf, size_t length,
+	int cbc, int encrypt);
+
+void ChaChaPoly_encrypt_buffer(const uint8_t* key, const uint8_t* nonce, const uint8_t* aad, size_t aad_len,
+	uint8_t* buf, size_t length, uint8_t* tag);
+int ChaChaPoly_decrypt_buffer(const uint8_t* key, const uint8_t* nonce, const uint8_t* aad, size_t aad_len,
+	uint8_t* buf, size_t length, const uint8_t* tag);
+
+void DRBG_seed(DRBG_ctx* drbg, const uint8_t* seed);
+void DRBG_generate(DRBG_ctx* drbg, const uint8_t* addl, uint8_t* out, size_t length);
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef CRYPTO_CORE_REGS_H
+#define CRYPTO_CORE_REGS_H
+
+// Register map, job formats and the binary formats of the crypto_core device
+// (saved contexts, descriptors, workload traces, remote backend protocol).
+// Only plain #defines, with no QEMU or libc dependency: the device includes
+// it, and so do the driver, the qtest benchmark and the host tools in replay/
+// and remote/.
+
+#define REG_ID 		0x0
+#define REG_MODE 	0x8
+#define REG_FORMAT 	0x10
+#define REG_START	0x18
+#define REG_VALID	0x20
+
+#define CC_NO_REG	0xCCCCAAAA	// read from an offset without a register
+
+#define REG_KEY_0	0x28
+#define REG_KEY_1	0x30
+#define REG_KEY_2	0x38
+#define REG_KEY_3	0x40
+#define REG_KEY_4	0x48
+#define REG_KEY_5	0x50
+#define REG_KEY_6	0x58
+#define REG_KEY_7	0x60	// each var is 32 bit. The key is 256 bit. So we need 8 vars
+
+#define REG_IV_0	0x68
+#define REG_IV_1	0x70
+#define REG_IV_2	0x78
+#define REG_IV_3	0x80	// IV is 128 bit only (16 byte)
+
+#define REG_IN_0	0x88
+#define REG_IN_1	0x90
+#define REG_IN_2	0x98
+#define REG_IN_3	0x100
+
+#define REG_OUT_0	0x108
+#define REG_OUT_1	0x110
+#define REG_OUT_2	0x118
+#define REG_OUT_3	0x120
+
+#define REG_KEY_CHAR	0x128
+#define REG_IV_CHAR	0x130
+#define REG_IN_CHAR	0x138
+#define REG_OUT_CHAR	0x140
+
+#define REG_KEY_LEN	0x148	// key length in bits: 128, 192 or 256
+#define REG_KEY_SLOT	0x150	// key slot used by START, see CryptoCoreKeySlot
+
+#define KEY_SLOT_PRELOADED	(1u << 31)	// REG_KEY_SLOT flag: use the key already in the
+						// slot (FORMAT_KEYLOAD) and ignore the key registers
+
+// DMA jobs: with REG_LEN != 0 START processes REG_LEN bytes from guest memory
+// at REG_SRC_ADDR into REG_DST_ADDR instead of the IN/OUT registers.
+// These registers are 64 bit wide.
+#define REG_SRC_ADDR	0x158
+#define REG_DST_ADDR	0x160
+#define REG_LEN		0x168
+#define REG_AAD_ADDR	0x170	// GCM additional authenticated data
+#define REG_AAD_LEN	0x178
+
+#define REG_TAG_0	0x180
+#define REG_TAG_1	0x188
+#define REG_TAG_2	0x190
+#define REG_TAG_3	0x198	// GCM tag: output of encryption, expected value for decryption
+
+#define REG_STATUS	0x1A0	// STATUS_* bits of the last operation
+
+#define REG_KEY2_0	0x1A8
+#define REG_KEY2_1	0x1B0
+#define REG_KEY2_2	0x1B8
+#define REG_KEY2_3	0x1C0
+#define REG_KEY2_4	0x1C8
+#define REG_KEY2_5	0x1D0
+#define REG_KEY2_6	0x1D8
+#define REG_KEY2_7	0x1E0	// XTS tweak key, same length as the data key
+
+// XTS: the IV registers hold the tweak input of the first data unit as a 128 bit
+// little-endian number, incremented for every following unit. REG_SECTOR is a
+// 64 bit view of it for plain sector numbers (writing clears IV_2 and IV_3).
+#define REG_SECTOR	0x1E8
+#define REG_SECTOR_SIZE	0x1F0	// bytes per data unit, 0 = the whole job is one unit
+
+// Batch jobs: with REG_DESC_COUNT != 0 START walks an array of descriptors
+// at REG_DESC_ADDR instead of running a single job: CC_MAC_DESC_* for the MAC
+// formats, CC_PKT_DESC_* for the ciphers.
+#define REG_DESC_ADDR	0x200
+#define REG_DESC_COUNT	0x208
+
+// SHA-256 unit. It uses the DMA registers like the ciphers, but REG_LEN may be
+// 0 and the IN/OUT registers are not used. The digest registers hold the
+// running state as digest bytes; writing them (and REG_HASH_COUNT) restores a
+// state saved at a 64 byte boundary.
+#define REG_HASH_CTRL	0x210	// HASH_* bits for the next START
+#define REG_DIGEST_0	0x218
+#define REG_DIGEST_1	0x220
+#define REG_DIGEST_2	0x228
+#define REG_DIGEST_3	0x230
+#define REG_DIGEST_4	0x238
+#define REG_DIGEST_5	0x240
+#define REG_DIGEST_6	0x248
+#define REG_DIGEST_7	0x250
+#define REG_HASH_COUNT	0x258	// bytes hashed since HASH_INIT, 64 bit
+
+#define HASH_INIT	(1 << 0)	// start a new message before absorbing the data
+#define HASH_FINAL	(1 << 1)	// pad the message and leave the digest after it
+
+// Encrypt-then-MAC: with a MAC_* algorithm selected, CBC and CTR jobs also
+// authenticate IV || AAD || ciphertext || be64(AAD length) || be64(ciphertext
+// length), lengths in bytes, in the same pass over the data. The MAC key
+// is in the KEY2 registers (all 32 bytes for HMAC, KEY_LEN bits for CMAC) and
+// the 128 bit tag uses the tag registers as in GCM: MODE 0 writes it, MODE 1
+// checks it before anything is written back.
+#define REG_MAC_ALG	0x260	// MAC_* in crypto_core_aes.h
+
+// Stream contexts: START with CTX_RESTORE first reloads the job registers and
+// stream state from the CC_CTX_* block at REG_CTX_ADDR, and with CTX_SAVE
+// writes them back there once the job succeeded. A guest can so keep one
+// block per stream and interleave long CBC/CTR streams with other users.
+// The key stays in its slot: a restore whose slot no longer holds a key of
+// that length fails with STATUS_BAD_CTX.
+#define REG_CTX_ADDR	0x268
+#define REG_CTX_CTRL	0x270
+
+// The register file above is one bank. The MMIO window holds
+// CRYPTO_CORE_BANKS of them, CRYPTO_CORE_BANK_SIZE apart, each with its own
+// job registers, START and VALID; the key slots and the DRBG are shared.
+// ID is the same in every bank.
+#define REG_BANK_COUNT	0x278	// read only
+
+// Scheduling. A job whose cost (bytes to process) is at most CC_SMALL_JOB
+// completes before the START write returns if its bank is in the latency
+// class or nothing else is queued. Any other job is queued: VALID reads 0 and
+// the bank ignores writes until it is done. Queued jobs are served by
+// deficit round robin over the banks, REG_BANK_WEIGHT quanta per round, and
+// bulk ECB/CBC/CTR/XTS/SHA-256/DRBG jobs are cut into CC_SCHED_CHUNK slices so
+// one large job cannot hold the device while other banks wait. Descriptor
+// batches are always queued and run one descriptor per slice. Every other job,
+// and every descriptor, can only run whole: it may be at most CC_SCHED_CHUNK
+// bytes long (AAD included, and XTS only beyond that with REG_SECTOR_SIZE), or
+// it fails with STATUS_BAD_LEN.
+#define REG_BANK_WEIGHT	0x280	// 1 to CC_MAX_WEIGHT, default 1
+#define REG_BANK_PRIO	0x288	// 1 = latency class
+
+// QEMU_CLOCK_VIRTUAL time in ns of the last job of the bank: START written,
+// processing begun, VALID set. Reset to 0 by START until the event happens.
+#define REG_TS_SUBMIT	0x290
+#define REG_TS_START	0x298
+#define REG_TS_DONE	0x2A0
+#define REG_TS_NOW	0x2A8	// current time, to measure the completion delivery
+
+// Timing model (property timing-model, off by default). The result of a job
+// is computed as before, but VALID is only set when a QEMU_CLOCK_VIRTUAL
+// timer fires at the completion time of a pipeline with "lanes" parallel
+// lanes: setup-ns, plus cpb-<format> cycles per 16 byte block and
+// key-expansion-cycles per key schedule at clock-mhz, on the first free lane.
+#define CC_MAX_LANES		16
+
+// Workload trace (property workload-trace=FILE): CC_WL_MAGIC and CC_WL_VERSION
+// as little-endian 32 bit words, then one record per job in completion order,
+// for the host replay tool in replay/.
+#define CC_WL_MAGIC		0x4c574343	// "CCWL"
+#define CC_WL_VERSION		1
+#define CC_WL_GAP		0x00	// 32 bit virtual ns since the previous START, saturated
+#define CC_WL_BYTES		0x04	// 32 bit bytes processed
+#define CC_WL_FORMAT		0x08
+#define CC_WL_MODE		0x09
+#define CC_WL_KEY_LEN		0x0A	// REG_KEY_LEN / 64
+#define CC_WL_KEY_EXP		0x0B	// key schedules expanded, saturated; 0 = the key slot was reused
+#define CC_WL_MAC_ALG		0x0C
+#define CC_WL_BANK		0x0D
+#define CC_WL_SECTOR		0x0E	// 16 bit REG_SECTOR_SIZE / 16
+#define CC_WL_REC_SIZE		0x10
+
+// Remote backend (property remote=SOCKET): the DMA jobs of the cipher and MAC
+// formats go over a UNIX socket to a separate process, remote/cc_remote, which
+// maps guest RAM from the fds sent with CC_REMOTE_MEM_TABLE. Every message is
+// a CC_REMOTE_HDR_SIZE header (32 bit request, 32 bit payload size) and its
+// payload, little-endian. The job's bank completes when CC_REMOTE_DONE comes
+// back; jobs on memory that is not shared (RAM without an fd, e.g. without
+// memory-backend-memfd) or with other formats run in QEMU as before.
+#define CC_REMOTE_MEM_TABLE	1	// QEMU -> backend, one fd per region
+#define CC_REMOTE_JOB		2	// QEMU -> backend
+#define CC_REMOTE_DONE		3	// backend -> QEMU
+#define CC_REMOTE_HDR_SIZE	8
+#define CC_REMOTE_MAX_REGIONS	8
+
+// CC_REMOTE_MEM_TABLE: 32 bit region count, 32 bit padding, then the regions
+#define CC_RMEM_GPA		0x00	// 64 bit guest physical address
+#define CC_RMEM_SIZE		0x08
+#define CC_RMEM_OFFSET		0x10	// 64 bit offset of the region in its fd
+#define CC_RMEM_LEN		0x18
+#define CC_RMEM_TABLE_SIZE	(8 + CC_REMOTE_MAX_REGIONS * CC_RMEM_LEN)
+
+// CC_REMOTE_JOB: the job registers of a bank
+#define CC_RJOB_ID		0x00	// 32 bit bank, returned in CC_REMOTE_DONE
+#define CC_RJOB_FORMAT		0x04
+#define CC_RJOB_MODE		0x08
+#define CC_RJOB_KEY_SLOT	0x0C	// the backend keeps its own schedules per slot
+#define CC_RJOB_KEY_LEN		0x10	// 32 bit key bytes
+#define CC_RJOB_SECTOR_SIZE	0x14
+#define CC_RJOB_SRC		0x18
+#define CC_RJOB_DST		0x20
+#define CC_RJOB_LEN		0x28
+#define CC_RJOB_AAD_ADDR	0x30
+#define CC_RJOB_AAD_LEN		0x38
+#define CC_RJOB_KEY		0x40	// 32 bytes: key of the slot, or the key registers for ChaCha20
+#define CC_RJOB_KEY2		0x60	// 32 bytes
+#define CC_RJOB_IV		0x80
+#define CC_RJOB_TAG		0x90	// expected tag of MODE 1
+#define CC_RJOB_KEYSTREAM	0xA0	// CTR keystream left by the previous job
+#define CC_RJOB_KEYSTREAM_USED	0xB0
+#define CC_RJOB_SIZE		0xB8
+
+// CC_REMOTE_DONE
+#define CC_RDONE_ID		0x00
+#define CC_RDONE_STATUS		0x04	// STATUS_* bits
+#define CC_RDONE_NS		0x08	// 64 bit host time the backend spent on the job
+#define CC_RDONE_IV		0x10	// next chaining value
+#define CC_RDONE_TAG		0x20	// tag of MODE 0
+#define CC_RDONE_KEYSTREAM	0x30
+#define CC_RDONE_KEYSTREAM_USED	0x40
+#define CC_RDONE_SIZE		0x48
+
+#define CC_SMALL_JOB		4096
+#define CC_SCHED_QUANTUM	(64 * 1024)	// bytes per weight unit and round
+#define CC_SCHED_CHUNK		(64 * 1024)	// largest slice of a split job
+#define CC_SCHED_BUDGET		(1024 * 1024)	// bytes per bottom half run before yielding
+#define CC_MAX_WEIGHT		64
+
+// Performance counters, shared by all the banks and read only. Also readable
+// from the host as QOM properties and with the "info crypto-core" monitor command.
+#define REG_STAT_STARTS		0x400
+#define REG_STAT_BYTES		0x408
+#define REG_STAT_KEY_EXPANSIONS	0x410
+#define REG_STAT_KEY_HITS	0x418	// jobs that found their schedule in the key slot
+#define REG_STAT_QUEUE_HWM	0x420	// most banks ever queued at once
+#define REG_STAT_CIPHER_NS	0x428	// host time spent running jobs
+#define REG_STAT_BLOCKS		0x500	// 16 byte blocks, 8 bytes per counter:
+					// 0x500 + (FORMAT * 2 + decrypt) * 8
+
+// Job latency histograms, START to VALID in host time, one per format.
+// Bucket i counts the jobs that took [2^i, 2^(i+1)) ns, the last one everything above.
+#define CC_LAT_BUCKETS		32
+
+#define CTX_SAVE	(1 << 0)
+#define CTX_RESTORE	(1 << 1)
+
+#define FORMAT_ECB	0
+#define FORMAT_CBC	1
+#define FORMAT_CTR	2	// also used for any value without a format of its own
+#define FORMAT_GCM	3
+#define FORMAT_XTS	4
+#define FORMAT_CMAC	5	// MAC formats: MODE 0 writes the tag registers,
+#define FORMAT_CBC_MAC	6	// MODE 1 compares against them. No data is output.
+#define FORMAT_SHA256	7
+#define FORMAT_CHACHA20_POLY1305	8	// RFC 8439 AEAD: 256 bit key from the key registers,
+						// 96 bit nonce in IV_0..IV_2, AAD and tag as in GCM
+#define FORMAT_DRBG	9	// REG_LEN random bytes to REG_DST_ADDR; MODE 1 reseeds first.
+				// REG_AAD_* may give up to 48 bytes of additional input.
+#define FORMAT_KEYLOAD	10	// REG_LEN bytes of packed KEY_LEN keys at REG_SRC_ADDR are
+				// expanded into the slots from REG_KEY_SLOT on
+#define CC_FORMATS	11
+
+#define STATUS_AUTH_FAIL	(1 << 0)	// GCM tag mismatch, nothing was written
+#define STATUS_DMA_ERROR	(1 << 1)
+#define STATUS_BAD_LEN		(1 << 2)	// length not allowed for the format
+#define STATUS_BAD_CTX		(1 << 3)	// REG_CTX_ADDR does not hold a saved context
+
+#define CC_KEY_SLOTS		256
+#define CC_MAX_JOB_LEN		(64 * 1024 * 1024)
+#define CC_MAX_DESC		65536
+
+// MAC batch descriptor, little-endian in guest memory. The device fills
+// in the status word of every descriptor with that message's STATUS_* bits.
+#define CC_MAC_DESC_SRC		0x00	// 64 bit message address
+#define CC_MAC_DESC_TAG		0x08	// 64 bit address of the 16 byte tag
+#define CC_MAC_DESC_LEN		0x10	// 32 bit message length
+#define CC_MAC_DESC_STATUS	0x14	// 32 bit, written by the device
+#define CC_MAC_DESC_SIZE	0x18
+
+// Packet batch descriptor (ESP style), all packets under the current key slot
+// and format. The first OFFSET bytes of a packet are copied through unchanged
+// and are the AAD of the AEAD formats, the LEN bytes after them are processed.
+// AEAD packets carry their 16 byte tag right after the payload: it is read
+// from the source when decrypting and appended to the output when encrypting.
+#define CC_PKT_DESC_SRC		0x00	// 64 bit packet address
+#define CC_PKT_DESC_DST		0x08	// 64 bit output address, may equal SRC
+#define CC_PKT_DESC_IV		0x10	// 16 byte IV / nonce of this packet
+#define CC_PKT_DESC_OFFSET	0x20	// 32 bit header length
+#define CC_PKT_DESC_LEN		0x24	// 32 bit payload length
+#define CC_PKT_DESC_STATUS	0x28	// 32 bit, written by the device
+#define CC_PKT_DESC_SIZE	0x30
+
+// Saved stream context, little-endian. The key itself stays in its slot and
+// is used as KEY_SLOT_PRELOADED after a restore.
+#define CC_CTX_MAGIC		0x31584343	// "CCX1"
+#define CC_CTX_MAGIC_OFF	0x00
+#define CC_CTX_KEY_SLOT		0x04
+#define CC_CTX_KEY_LEN		0x08
+#define CC_CTX_MODE		0x0C
+#define CC_CTX_FORMAT		0x10
+#define CC_CTX_MAC_ALG		0x14
+#define CC_CTX_IV		0x18	// 16 bytes: next chaining value or counter
+#define CC_CTX_KEYSTREAM	0x28	// 16 bytes: CTR keystream of a partial block
+#define CC_CTX_KEYSTREAM_USED	0x38	// bytes of it already used, 0 if none
+#define CC_CTX_SECTOR_SIZE	0x3C
+#define CC_CTX_SIZE		0x40
+
+#define CC_FORMAT_NAMES { \
+	"ecb", "cbc", "ctr", "gcm", "xts", "cmac", "cbc-mac", \
+	"sha256", "chacha20-poly1305", "drbg", "keyload", \
+}
+
+#endif
@@ -0,0 +1,626 @@
+// Reference remote backend of crypto_core (property remote=SOCKET): runs the
+// jobs QEMU forwards with the same cipher code as the device, on guest RAM
+// mapped from the fds of CC_REMOTE_MEM_TABLE. QEMU must give the guest shared
+// memory, e.g. -object memory-backend-memfd,id=mem,size=1G,share=on
+// -machine memory-backend=mem.
+//
+//	cc_remote [-c CPU] [-b BACKEND] SOCKET
+//
+//	-c	pin the backend to host CPU
+//	-b	AES block cipher backend: reference, t-table or aes-ni (default: the
+//		fastest the host supports, as in the device)
+//
+// Every connection, i.e. every crypto_core device, is served by a process of its own.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../qemu/crypto_core_aes.h"
+#include "../qemu/crypto_core_regs.h"
+
+// the device's key slot, for the jobs of this backend
+struct remote_slot
+{
+	bool valid;
+	unsigned keylen;
+	uint8_t key[AES_KEYLEN];
+	struct AES_ctx ctx;
+	bool tweak_valid;
+	uint8_t key2[AES_KEYLEN];
+	struct AES_ctx tweak;
+	bool ghash_valid;
+	GHashKey gk;
+	bool cmac_valid;
+	uint8_t K1[AES_BLOCKLEN];
+	uint8_t K2[AES_BLOCKLEN];
+};
+
+struct remote_region
+{
+	uint64_t gpa;
+	uint64_t size;
+	uint8_t *host;		// gpa mapped here
+	void *map;		// whole mapping, page aligned
+	size_t map_len;
+};
+
+static struct remote_slot slots[CC_KEY_SLOTS];
+static struct remote_region regions[CC_REMOTE_MAX_REGIONS];
+static unsigned nregions;
+
+static uint32_t ld32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t ld64(const uint8_t *p)
+{
+	return ld32(p) | (uint64_t)ld32(p + 4) << 32;
+}
+
+static void st32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void st64(uint8_t *p, uint64_t v)
+{
+	st32(p, v);
+	st32(p + 4, v >> 32);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	uint8_t *p = buf;
+	ssize_t n;
+
+	while(len > 0)
+	{
+		n = read(fd, p, len);
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(n <= 0)
+		{
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	ssize_t n;
+
+	while(len > 0)
+	{
+		n = write(fd, p, len);
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(n <= 0)
+		{
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void unmap_regions(void)
+{
+	unsigned i;
+
+	for(i = 0; i < nregions; i += 1)
+	{
+		munmap(regions[i].map, regions[i].map_len);
+	}
+	nregions = 0;
+}
+
+// Replaces the memory table; the fds are closed once mapped.
+static int map_regions(const uint8_t *table, const int *fds, unsigned nfds)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	uint32_t n = ld32(table);
+	const uint8_t *r;
+	uint64_t offset, delta;
+	unsigned i;
+	int ret = 0;
+
+	unmap_regions();
+	if(n > CC_REMOTE_MAX_REGIONS || n != nfds)
+	{
+		fprintf(stderr, "cc_remote: memory table with %u regions and %u fds\n", n, nfds);
+		ret = -1;
+		n = 0;
+	}
+	for(i = 0, r = table + 8; i < n; i += 1, r += CC_RMEM_LEN)
+	{
+		offset = ld64(r + CC_RMEM_OFFSET);
+		delta = offset % page;
+		regions[i].gpa = ld64(r + CC_RMEM_GPA);
+		regions[i].size = ld64(r + CC_RMEM_SIZE);
+		regions[i].map_len = regions[i].size + delta;
+		regions[i].map = mmap(NULL, regions[i].map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fds[i], offset - delta);
+		if(regions[i].map == MAP_FAILED)
+		{
+			perror("cc_remote: mmap");
+			ret = -1;
+			break;
+		}
+		regions[i].host = (uint8_t *)regions[i].map + delta;
+		nregions = i + 1;
+	}
+	for(i = 0; i < nfds; i += 1)
+	{
+		close(fds[i]);
+	}
+	return ret;
+}
+
+// Host address of [gpa, gpa + len), NULL if it is not in one region.
+static uint8_t *guest_ptr(uint64_t gpa, uint64_t len)
+{
+	unsigned i;
+
+	for(i = 0; i < nregions; i += 1)
+	{
+		if(gpa >= regions[i].gpa && len <= regions[i].size && gpa - regions[i].gpa <= regions[i].size - len)
+		{
+			return regions[i].host + (gpa - regions[i].gpa);
+		}
+	}
+	return NULL;
+}
+
+static struct remote_slot *load_key(const uint8_t *job)
+{
+	struct remote_slot *slot = &slots[ld32(job + CC_RJOB_KEY_SLOT) % CC_KEY_SLOTS];
+	unsigned keylen = ld32(job + CC_RJOB_KEY_LEN);
+
+	if(keylen != 16 && keylen != 24)
+	{
+		keylen = AES_KEYLEN;
+	}
+	if(!slot->valid || slot->keylen != keylen || memcmp(slot->key, job + CC_RJOB_KEY, keylen) != 0)
+	{
+		memcpy(slot->key, job + CC_RJOB_KEY, keylen);
+		slot->keylen = keylen;
+		AES_init_ctx(&slot->ctx, slot->key, keylen);
+		slot->tweak_valid = false;
+		slot->ghash_valid = false;
+		slot->cmac_valid = false;
+		slot->valid = true;
+	}
+	return slot;
+}
+
+static const struct AES_ctx *load_tweak_key(struct remote_slot *slot, const uint8_t *job)
+{
+	if(!slot->tweak_valid || memcmp(slot->key2, job + CC_RJOB_KEY2, slot->keylen) != 0)
+	{
+		memcpy(slot->key2, job + CC_RJOB_KEY2, slot->keylen);
+		AES_init_ctx(&slot->tweak, slot->key2, slot->keylen);
+		slot->tweak_valid = true;
+	}
+	return &slot->tweak;
+}
+
+static const GHashKey *ghash_key(struct remote_slot *slot)
+{
+	uint8_t H[AES_BLOCKLEN] = { 0 };
+
+	if(!slot->ghash_valid)
+	{
+		slot->ctx.Cipher((state_t*)H, slot->ctx.RoundKey);
+		GHASH_init_key(&slot->gk, H);
+		slot->ghash_valid = true;
+	}
+	return &slot->gk;
+}
+
+static bool tag_equal(const uint8_t *a, const uint8_t *b)
+{
+	uint8_t diff = 0;
+	size_t i;
+
+	for(i = 0; i < AES_BLOCKLEN; i += 1)
+	{
+		diff |= a[i] ^ b[i];
+	}
+	return diff == 0;
+}
+
+// CTR over a stream split into jobs, as crypto_core_ctr_stream().
+static void ctr_stream(struct AES_ctx *ctx, uint8_t *ks, uint32_t *used, uint8_t *buf, size_t length)
+{
+	size_t i = 0, full;
+
+	for(; i < length && *used != 0 && *used < AES_BLOCKLEN; i += 1)
+	{
+		buf[i] ^= ks[(*used)++];
+	}
+	full = (length - i) & ~(size_t)(AES_BLOCKLEN - 1);
+	AES_CTR_xcrypt_buffer(ctx, buf + i, full);
+	i += full;
+	if(i < length)
+	{
+		memset(ks, 0, AES_BLOCKLEN);
+		AES_CTR_xcrypt_buffer(ctx, ks, AES_BLOCKLEN);
+		for(*used = 0; i < length; i += 1)
+		{
+			buf[i] ^= ks[(*used)++];
+		}
+	}
+}
+
+// One job, as crypto_core_run_dma() and crypto_core_process() run it in the
+// device. Fills in the status, IV, tag and keystream of the answer.
+static void run_job(const uint8_t *job, uint8_t *done)
+{
+	uint32_t format = ld32(job + CC_RJOB_FORMAT);
+	bool encrypt = ld32(job + CC_RJOB_MODE) == 0;
+	uint64_t len = ld64(job + CC_RJOB_LEN);
+	uint64_t aad_len = ld64(job + CC_RJOB_AAD_LEN);
+	uint32_t sector = ld32(job + CC_RJOB_SECTOR_SIZE);
+	uint32_t used = ld32(job + CC_RJOB_KEYSTREAM_USED);
+	const uint8_t *iv = job + CC_RJOB_IV;
+	uint8_t *src = guest_ptr(ld64(job + CC_RJOB_SRC), len);
+	uint8_t *dst = guest_ptr(ld64(job + CC_RJOB_DST), len);
+	const uint8_t *aad = aad_len ? guest_ptr(ld64(job + CC_RJOB_AAD_ADDR), aad_len) : NULL;
+	bool mac = format == FORMAT_CMAC || format == FORMAT_CBC_MAC;
+	uint8_t *tag = done + CC_RDONE_TAG;
+	uint8_t ks[AES_BLOCKLEN];
+	struct remote_slot *slot = NULL;
+	const struct AES_ctx *tweak;
+	struct AES_ctx *ctx = NULL;
+	uint32_t status = 0;
+	uint8_t *buf;
+	size_t i, unit;
+
+	if(!src || (!mac && !dst) || (aad_len && !aad))
+	{
+		st32(done + CC_RDONE_STATUS, STATUS_DMA_ERROR);
+		return;
+	}
+	if(len > CC_MAX_JOB_LEN)
+	{
+		st32(done + CC_RDONE_STATUS, STATUS_BAD_LEN);
+		return;
+	}
+
+	// ChaCha20-Poly1305 takes the key registers, the others the key of the slot
+	if(format != FORMAT_CHACHA20_POLY1305)
+	{
+		slot = load_key(job);
+		ctx = &slot->ctx;
+		AES_ctx_set_iv(ctx, iv);
+	}
+	memcpy(ks, job + CC_RJOB_KEYSTREAM, AES_BLOCKLEN);
+	// the guest may rewrite the source while we work: use a copy, like the device
+	buf = malloc(len);
+	memcpy(buf, src, len);
+
+	switch(format)
+	{
+		case FORMAT_ECB:
+			if(len % AES_BLOCKLEN)
+			{
+				status = STATUS_BAD_LEN;
+				break;
+			}
+			for(i = 0; i < len; i += AES_BLOCKLEN)
+			{
+				if(encrypt)
+				{
+					AES_ECB_encrypt(ctx, buf + i);
+				} else
+				{
+					AES_ECB_decrypt(ctx, buf + i);
+				}
+			}
+			break;
+
+		case FORMAT_CBC:
+			if(len % AES_BLOCKLEN)
+			{
+				status = STATUS_BAD_LEN;
+			} else if(encrypt)
+			{
+				AES_CBC_encrypt_buffer(ctx, buf, len);
+			} else
+			{
+				AES_CBC_decrypt_buffer(ctx, buf, len);
+			}
+			break;
+
+		case FORMAT_CTR:
+			ctr_stream(ctx, ks, &used, buf, len);
+			break;
+
+		case FORMAT_GCM:
+			if(encrypt)
+			{
+				AES_GCM_encrypt_buffer(ctx, ghash_key(slot), iv, aad, aad_len, buf, len, tag);
+			} else if(AES_GCM_decrypt_buffer(ctx, ghash_key(slot), iv, aad, aad_len, buf, len,
+				job + CC_RJOB_TAG))
+			{
+				status = STATUS_AUTH_FAIL;
+			}
+			break;
+
+		case FORMAT_XTS:
+			unit = sector ? sector : len;
+			if(unit < AES_BLOCKLEN || len % unit || (unit % AES_BLOCKLEN && unit != len))
+			{
+				status = STATUS_BAD_LEN;
+				break;
+			}
+			tweak = load_tweak_key(slot, job);
+			for(i = 0; i < len; i += unit)
+			{
+				AES_XTS_crypt_unit(ctx, tweak, ctx->Iv, buf + i, unit, encrypt);
+				XTS_next_unit(ctx->Iv);
+			}
+			break;
+
+		case FORMAT_CMAC:
+			if(!slot->cmac_valid)
+			{
+				AES_CMAC_subkeys(ctx, slot->K1, slot->K2);
+				slot->cmac_valid = true;
+			}
+			AES_CMAC(ctx, slot->K1, slot->K2, buf, len, tag);
+			break;
+
+		case FORMAT_CBC_MAC:
+			if(len == 0 || len % AES_BLOCKLEN)
+			{
+				status = STATUS_BAD_LEN;
+				break;
+			}
+			AES_CBC_MAC_update(ctx, buf, len);
+			memcpy(tag, ctx->Iv, AES_BLOCKLEN);
+			break;
+
+		case FORMAT_CHACHA20_POLY1305:
+			if(encrypt)
+			{
+				ChaChaPoly_encrypt_buffer(job + CC_RJOB_KEY, iv, aad, aad_len, buf, len, tag);
+			} else if(ChaChaPoly_decrypt_buffer(job + CC_RJOB_KEY, iv, aad, aad_len, buf, len,
+				job + CC_RJOB_TAG))
+			{
+				status = STATUS_AUTH_FAIL;
+			}
+			break;
+
+		default:
+			status = STATUS_BAD_LEN;
+			break;
+	}
+
+	if(status == 0 && mac && !encrypt)
+	{
+		status = tag_equal(tag, job + CC_RJOB_TAG) ? 0 : STATUS_AUTH_FAIL;
+	}
+	if(status == 0 && !mac)
+	{
+		memcpy(dst, buf, len);
+	}
+	free(buf);
+
+	st32(done + CC_RDONE_STATUS, status);
+	memcpy(done + CC_RDONE_IV, ctx ? ctx->Iv : iv, AES_BLOCKLEN);
+	memcpy(done + CC_RDONE_KEYSTREAM, ks, AES_BLOCKLEN);
+	st32(done + CC_RDONE_KEYSTREAM_USED, used);
+}
+
+// Reads one message; the fds of a memory table come with its header.
+static int read_msg(int fd, uint32_t *request, uint8_t *payload, uint32_t max, int *fds, unsigned *nfds)
+{
+	uint8_t hdr[CC_REMOTE_HDR_SIZE];
+	union
+	{
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * CC_REMOTE_MAX_REGIONS)];
+	} control;
+	struct iovec iov = { .iov_base = hdr, .iov_len = sizeof(hdr) };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = control.buf, .msg_controllen = sizeof(control.buf) };
+	struct cmsghdr *cmsg;
+	uint32_t size;
+	ssize_t n;
+
+	do
+	{
+		n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+	} while(n < 0 && errno == EINTR);
+	if(n <= 0 || (n < (ssize_t)sizeof(hdr) && read_full(fd, hdr + n, sizeof(hdr) - n) < 0))
+	{
+		return -1;
+	}
+
+	*nfds = 0;
+	for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		{
+			*nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), *nfds * sizeof(int));
+		}
+	}
+
+	*request = ld32(hdr);
+	size = ld32(hdr + 4);
+	if(size > max)
+	{
+		fprintf(stderr, "cc_remote: message %u of %u bytes\n", *request, size);
+		return -1;
+	}
+	return read_full(fd, payload, size) < 0 ? -1 : (int)size;
+}
+
+static void serve(int fd)
+{
+	uint8_t in[CC_RMEM_TABLE_SIZE > CC_RJOB_SIZE ? CC_RMEM_TABLE_SIZE : CC_RJOB_SIZE];
+	uint8_t out[CC_REMOTE_HDR_SIZE + CC_RDONE_SIZE];
+	uint8_t *done = out + CC_REMOTE_HDR_SIZE;
+	int fds[CC_REMOTE_MAX_REGIONS];
+	uint64_t jobs = 0, t0;
+	unsigned nfds, i;
+	uint32_t request;
+	int size;
+
+	while((size = read_msg(fd, &request, in, sizeof(in), fds, &nfds)) >= 0)
+	{
+		if(request == CC_REMOTE_MEM_TABLE && size == CC_RMEM_TABLE_SIZE)
+		{
+			if(map_regions(in, fds, nfds) < 0)
+			{
+				break;
+			}
+			continue;
+		}
+		for(i = 0; i < nfds; i += 1)
+		{
+			close(fds[i]);
+		}
+		if(request != CC_REMOTE_JOB || size != CC_RJOB_SIZE)
+		{
+			fprintf(stderr, "cc_remote: unexpected message %u\n", request);
+			break;
+		}
+
+		memset(out, 0, sizeof(out));
+		st32(out, CC_REMOTE_DONE);
+		st32(out + 4, CC_RDONE_SIZE);
+		st32(done + CC_RDONE_ID, ld32(in + CC_RJOB_ID));
+		t0 = now_ns();
+		run_job(in, done);
+		st64(done + CC_RDONE_NS, now_ns() - t0);
+		if(write_full(fd, out, sizeof(out)) < 0)
+		{
+			break;
+		}
+		jobs += 1;
+	}
+	printf("cc_remote: connection closed after %llu jobs\n", (unsigned long long)jobs);
+	fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int backend = -1, cpu = -1, opt, lfd, fd, b;
+	cpu_set_t set;
+
+	while((opt = getopt(argc, argv, "b:c:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'b':
+				for(b = 0; b < AES_BACKENDS && strcmp(optarg, AES_backend_name(b)) != 0; b += 1)
+				{
+				}
+				if(b == AES_BACKENDS)
+				{
+					fprintf(stderr, "unknown backend %s\n", optarg);
+					return 1;
+				}
+				backend = b;
+				break;
+			case 'c':
+				cpu = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-c CPU] [-b BACKEND] SOCKET\n", argv[0]);
+				return 1;
+		}
+	}
+	if(optind != argc - 1 || strlen(argv[optind]) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "usage: %s [-c CPU] [-b BACKEND] SOCKET\n", argv[0]);
+		return 1;
+	}
+
+	crypto_core_detect_host();
+	if(backend >= 0 && AES_set_backend(backend) < 0)
+	{
+		fprintf(stderr, "backend %s not supported by this host\n", AES_backend_name(backend));
+		return 1;
+	}
+	if(cpu >= 0)
+	{
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if(sched_setaffinity(0, sizeof(set), &set) < 0)
+		{
+			perror("sched_setaffinity");
+			return 1;
+		}
+	}
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGCHLD, SIG_IGN);
+
+	strcpy(addr.sun_path, argv[optind]);
+	unlink(addr.sun_path);
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 1) < 0)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	printf("cc_remote: %s backend, waiting on %s\n", AES_backend_name(AES_get_backend()), addr.sun_path);
+	fflush(stdout);
+
+	for(;;)
+	{
+		fd = accept(lfd, NULL, NULL);
+		if(fd < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			perror("accept");
+			return 1;
+		}
+		fflush(stdout);
+		if(fork() == 0)
+		{
+			close(lfd);
+			serve(fd);
+			return 0;
+		}
+		close(fd);
+	}
+}
@@ -0,0 +1,382 @@
+// Replays a crypto_core workload trace (property workload-trace) on the host,
+// with the same cipher code the device runs, and reports the time spent per format.
+//
+//	cc_replay [-p] [-n LOOPS] [-b BACKEND] TRACE
+//
+//	-p	keep the recorded gaps between jobs instead of running back to back
+//	-n	replay the trace LOOPS times
+//	-b	AES block cipher backend: reference, t-table or aes-ni (default: the
+//		fastest the host supports, as in the device)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../qemu/crypto_core_aes.h"
+#include "../qemu/crypto_core_regs.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+static const char *const crypto_core_format_names[CC_FORMATS] = CC_FORMAT_NAMES;
+
+struct replay_stats
+{
+	uint64_t jobs;
+	uint64_t bytes;
+	uint64_t key_exp;
+	uint64_t ns;
+};
+
+// what the device keeps in one key slot, for the job being replayed
+struct replay_state
+{
+	struct AES_ctx ctx;
+	struct AES_ctx tweak;
+	GHashKey gk;
+	uint8_t K1[AES_BLOCKLEN];
+	uint8_t K2[AES_BLOCKLEN];
+	SHA256_ctx hmac_inner;
+	SHA256_ctx hmac_outer;
+	DRBG_ctx drbg;
+	uint8_t key[AES_KEYLEN];
+	unsigned keylen;
+	uint32_t key_seq;
+};
+
+static uint32_t load32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// A new key, as after a key change in the guest: the schedule and everything derived from it.
+static void replay_new_key(struct replay_state *st, unsigned keylen)
+{
+	uint8_t H[AES_BLOCKLEN] = { 0 };
+	unsigned i;
+
+	st->key_seq += 1;
+	for(i = 0; i < AES_KEYLEN; i += 1)
+	{
+		st->key[i] = (uint8_t)(st->key_seq * 131 + i * 7);
+	}
+	st->keylen = keylen;
+	AES_init_ctx(&st->ctx, st->key, keylen);
+	AES_init_ctx(&st->tweak, st->key + AES_KEYLEN - keylen, keylen);
+	st->ctx.Cipher((state_t*)H, st->ctx.RoundKey);
+	GHASH_init_key(&st->gk, H);
+	AES_CMAC_subkeys(&st->ctx, st->K1, st->K2);
+	HMAC_SHA256_init_key(&st->hmac_inner, &st->hmac_outer, st->key, keylen);
+}
+
+static void replay_etm(struct replay_state *st, const uint8_t *rec, uint8_t *buf, size_t len)
+{
+	uint8_t L[AES_BLOCKLEN] = { 0 };
+	uint8_t tag[AES_BLOCKLEN];
+	uint8_t lens[16] = { 0 };
+	ETM_mac mac;
+
+	memset(&mac, 0, sizeof(mac));
+	mac.alg = rec[CC_WL_MAC_ALG];
+	if(mac.alg == MAC_HMAC_SHA256)
+	{
+		mac.sha = st->hmac_inner;
+		mac.outer = &st->hmac_outer;
+	} else
+	{
+		mac.cmac = &st->tweak;
+		mac.cmac->Cipher((state_t*)L, mac.cmac->RoundKey);
+		CMAC_double(mac.K1, L);
+		CMAC_double(mac.K2, mac.K1);
+	}
+	// the device also authenticates the IV and the two lengths
+	ETM_mac_update(&mac, st->ctx.Iv, AES_BLOCKLEN);
+	AES_ETM_crypt_buffer(&st->ctx, &mac, buf, len, rec[CC_WL_FORMAT] == FORMAT_CBC, rec[CC_WL_MODE] == 0);
+	ETM_mac_update(&mac, lens, sizeof(lens));
+	ETM_mac_final(&mac, tag);
+}
+
+// Runs one recorded job. AEAD decryption is replayed as encryption: the
+// device authenticates first and then decrypts, which costs the same.
+static void replay_job(struct replay_state *st, const uint8_t *rec, uint8_t *buf, struct AES_ctx **many, uint8_t *keys)
+{
+	uint32_t len = load32(rec + CC_WL_BYTES);
+	unsigned keylen = rec[CC_WL_KEY_LEN] * 8;
+	unsigned nexp = rec[CC_WL_KEY_EXP];
+	bool encrypt = rec[CC_WL_MODE] == 0;
+	size_t unit = (size_t)(rec[CC_WL_SECTOR] | rec[CC_WL_SECTOR + 1] << 8) * AES_BLOCKLEN;
+	uint8_t iv[AES_BLOCKLEN] = { 0 };
+	uint8_t tag[AES_BLOCKLEN];
+	SHA256_ctx sha;
+	size_t i, n;
+
+	if(keylen != 16 && keylen != 24 && keylen != 32)
+	{
+		keylen = 32;
+	}
+	if(rec[CC_WL_FORMAT] == FORMAT_KEYLOAD)
+	{
+		for(i = 0; i < nexp; i += 1)
+		{
+			memset(keys + i * keylen, (int)(st->key_seq + i), keylen);
+		}
+		AES_init_ctx_many(many, keys, nexp, keylen);
+		return;
+	}
+	if(nexp != 0 || st->keylen != keylen)
+	{
+		replay_new_key(st, keylen);
+	}
+
+	AES_ctx_set_iv(&st->ctx, iv);
+	switch(rec[CC_WL_FORMAT])
+	{
+		case FORMAT_ECB:
+			for(i = 0; i + AES_BLOCKLEN <= len; i += AES_BLOCKLEN)
+			{
+				if(encrypt)
+				{
+					AES_ECB_encrypt(&st->ctx, buf + i);
+				} else
+				{
+					AES_ECB_decrypt(&st->ctx, buf + i);
+				}
+			}
+			break;
+
+		case FORMAT_CBC:
+			if(rec[CC_WL_MAC_ALG] != MAC_NONE)
+			{
+				replay_etm(st, rec, buf, len);
+			} else if(encrypt)
+			{
+				AES_CBC_encrypt_buffer(&st->ctx, buf, len & ~(AES_BLOCKLEN - 1));
+			} else
+			{
+				AES_CBC_decrypt_buffer(&st->ctx, buf, len & ~(AES_BLOCKLEN - 1));
+			}
+			break;
+
+		case FORMAT_GCM:
+			AES_GCM_encrypt_buffer(&st->ctx, &st->gk, iv, NULL, 0, buf, len, tag);
+			break;
+
+		case FORMAT_XTS:
+			if(unit == 0 || len % unit)
+			{
+				unit = len;
+			}
+			for(i = 0; unit >= AES_BLOCKLEN && i < len; i += unit)
+			{
+				AES_XTS_crypt_unit(&st->ctx, &st->tweak, iv, buf + i, unit, encrypt);
+				XTS_next_unit(iv);
+			}
+			break;
+
+		case FORMAT_CMAC:
+			AES_CMAC(&st->ctx, st->K1, st->K2, buf, len, tag);
+			break;
+
+		case FORMAT_CBC_MAC:
+			AES_CBC_MAC_update(&st->ctx, buf, len & ~(AES_BLOCKLEN - 1));
+			break;
+
+		case FORMAT_SHA256:
+			SHA256_init(&sha);
+			SHA256_update(&sha, buf, len);
+			SHA256_final(&sha);
+			break;
+
+		case FORMAT_CHACHA20_POLY1305:
+			ChaChaPoly_encrypt_buffer(st->key, iv, NULL, 0, buf, len, tag);
+			break;
+
+		case FORMAT_DRBG:
+			for(i = 0; i < len; i += n)
+			{
+				n = MIN(len - i, DRBG_MAX_REQUEST);
+				DRBG_generate(&st->drbg, NULL, buf + i, n);
+			}
+			break;
+
+		default:	// CTR
+			if(rec[CC_WL_MAC_ALG] != MAC_NONE)
+			{
+				replay_etm(st, rec, buf, len);
+			} else
+			{
+				AES_CTR_xcrypt_buffer(&st->ctx, buf, len);
+			}
+			break;
+	}
+}
+
+static void wait_until(uint64_t t)
+{
+	struct timespec ts;
+	uint64_t now = now_ns();
+
+	if(t > now)
+	{
+		ts.tv_sec = (t - now) / 1000000000u;
+		ts.tv_nsec = (t - now) % 1000000000u;
+		nanosleep(&ts, NULL);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct replay_stats stats[CC_FORMATS] = { { 0 } };
+	struct replay_state st;
+	struct AES_ctx *many[CC_KEY_SLOTS];
+	uint8_t seed[DRBG_SEEDLEN] = { 0 };
+	uint8_t hdr[8], *trace, *buf, *keys;
+	uint64_t t, t0, due, total_ns = 0, total_bytes = 0;
+	size_t size, count, i, max_len = AES_BLOCKLEN;
+	unsigned loops = 1, loop, f;
+	bool pace = false;
+	const char *backend = NULL;
+	unsigned features;
+	FILE *fp;
+	int opt, b;
+
+	while((opt = getopt(argc, argv, "pn:b:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'p':
+				pace = true;
+				break;
+			case 'n':
+				loops = (unsigned)strtoul(optarg, NULL, 0);
+				break;
+			case 'b':
+				backend = optarg;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-p] [-n loops] [-b backend] trace\n", argv[0]);
+				return 1;
+		}
+	}
+	if(optind != argc - 1)
+	{
+		fprintf(stderr, "usage: %s [-p] [-n loops] [-b backend] trace\n", argv[0]);
+		return 1;
+	}
+
+	features = crypto_core_detect_host();
+	for(b = 0; backend && b < AES_BACKENDS; b += 1)
+	{
+		if(strcmp(backend, AES_backend_name(b)) == 0)
+		{
+			break;
+		}
+	}
+	if(backend && AES_set_backend(b) != 0)
+	{
+		fprintf(stderr, "%s: backend not available on this host\n", backend);
+		return 1;
+	}
+
+	fp = fopen(argv[optind], "rb");
+	if(!fp)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	if(fread(hdr, sizeof(hdr), 1, fp) != 1 || load32(hdr) != CC_WL_MAGIC || load32(hdr + 4) != CC_WL_VERSION)
+	{
+		fprintf(stderr, "%s: not a crypto_core workload trace\n", argv[optind]);
+		fclose(fp);
+		return 1;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = (size_t)ftell(fp) - sizeof(hdr);
+	fseek(fp, sizeof(hdr), SEEK_SET);
+	count = size / CC_WL_REC_SIZE;
+	trace = malloc(count * CC_WL_REC_SIZE + 1);
+	if(!trace || fread(trace, CC_WL_REC_SIZE, count, fp) != count)
+	{
+		fprintf(stderr, "%s: read error\n", argv[optind]);
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+
+	for(i = 0; i < count; i += 1)
+	{
+		max_len = MAX(max_len, load32(trace + i * CC_WL_REC_SIZE + CC_WL_BYTES));
+	}
+	buf = calloc(1, max_len + AES_BLOCKLEN);
+	keys = calloc(CC_KEY_SLOTS, AES_KEYLEN);
+	for(i = 0; i < CC_KEY_SLOTS; i += 1)
+	{
+		many[i] = malloc(sizeof(struct AES_ctx));
+	}
+
+	memset(&st, 0, sizeof(st));
+	DRBG_seed(&st.drbg, seed);
+
+	for(loop = 0; loop < loops; loop += 1)
+	{
+		due = now_ns();
+		for(i = 0; i < count; i += 1)
+		{
+			const uint8_t *rec = trace + i * CC_WL_REC_SIZE;
+
+			f = rec[CC_WL_FORMAT] < CC_FORMATS ? rec[CC_WL_FORMAT] : FORMAT_CTR;
+			if(pace)
+			{
+				due += load32(rec + CC_WL_GAP);
+				wait_until(due);
+			}
+			t0 = now_ns();
+			replay_job(&st, rec, buf, many, keys);
+			t = now_ns() - t0;
+
+			stats[f].jobs += 1;
+			stats[f].bytes += load32(rec + CC_WL_BYTES);
+			stats[f].key_exp += rec[CC_WL_KEY_EXP];
+			stats[f].ns += t;
+			total_ns += t;
+			total_bytes += load32(rec + CC_WL_BYTES);
+		}
+	}
+
+	printf("%zu jobs x %u, host features 0x%x, %s backend\n", count, loops, features,
+		AES_backend_name(AES_get_backend()));
+	printf("%-18s %10s %14s %10s %12s %10s %10s\n", "format", "jobs", "bytes", "key exp", "ns", "ns/op", "MB/s");
+	for(f = 0; f < CC_FORMATS; f += 1)
+	{
+		if(stats[f].jobs == 0)
+		{
+			continue;
+		}
+		printf("%-18s %10llu %14llu %10llu %12llu %10llu %10.1f\n", crypto_core_format_names[f],
+			(unsigned long long)stats[f].jobs, (unsigned long long)stats[f].bytes,
+			(unsigned long long)stats[f].key_exp, (unsigned long long)stats[f].ns,
+			(unsigned long long)(stats[f].ns / stats[f].jobs),
+			stats[f].ns ? stats[f].bytes * 1e3 / stats[f].ns : 0.0);
+	}
+	printf("total: %llu bytes in %llu ns, %.1f MB/s\n", (unsigned long long)total_bytes,
+		(unsigned long long)total_ns, total_ns ? total_bytes * 1e3 / total_ns : 0.0);
+
+	for(i = 0; i < CC_KEY_SLOTS; i += 1)
+	{
+		free(many[i]);
+	}
+	free(keys);
+	free(buf);
+	free(trace);
+	return 0;
+}
@@ -5,59 +5,51 @@
 #include <stdint.h>
 #include <string.h>
 
-#define DEVICE_DIR 	"/sys/bus/platform/devices/crypto_core@8000000"
-#define DIR_PROC_ID 	"/proc_id"
-#define DIR_MODE	"/mode"
-#define DIR_FORMAT	"/format"
-#define DIR_START	"/start"
-#define DIR_VALID	"/valid"
-#define DIR_KEY		"/key_char"
-#define DIR_IV		"/iv_char"
-#define DIR_IN		"/in_char"
-#define DIR_OUT		"/out_char"
-
-char file_path[100];
-
-static int dev_file_open(char *subdir, int flag);
-static uint32_t uint8_to_uint32(const uint8_t *input8);
-static void print_buf_char(const uint8_t *buf, size_t len);
+#include <sys/ioctl.h>
+
+#include "../driver/crypto-core.h"
+
+static int format_has_tag(uint32_t format);
+static int parse_hex(const char *str, uint8_t *buf, size_t len);
 static void print_buf_uint(const uint8_t *buf, size_t len);
+static void print_buf_hex(const uint8_t *buf, size_t len);
 static void check_op(ssize_t op);
 
 int main(int argc, char **argv)
 {
-	// argv[1] is the key
+	// argv[1] is the key (16, 24 or 32 characters: AES-128, AES-192, AES-256)
 	// argv[2] is the init vector
 	// argv[3] is the input string
-	// argv[4] is the mode (0 for encrypt, other for decrypt)
-	// argv[5] is the format (0 for ECB, 1 for CBC, other for CTR)
-
-	int fd[10];
-	char proc_id[8];
-	ssize_t readB, writeB;
-	char write_buf[12];
-	char read_buf[100];
-	char start_buf[3] = "1\0";
-	char mode_buf[3] = "0\0";
-	char format_buf[3] = "0\0";
+	// argv[4] is the mode (0 to encrypt or compute the tag, 1 to decrypt or verify it)
+	// argv[5] is the format (0 for ECB, 1 for CBC, 2 for CTR, 3 for GCM, 5 for CMAC, 6 for CBC-MAC, 8 for ChaCha20-Poly1305)
+	// argv[6] is the expected tag as 32 hex digits, as printed by mode 0: mode 1 with formats 3, 5, 6 and 8 only
+
+	int fd;
+	uint32_t mode, format;
+	size_t key_len;
 
 	uint8_t key[33];
 	uint8_t in_str[17];
 	uint8_t iv[17];
+	uint8_t tag[16];
+	uint8_t out[16];
 
-	// TO-DO: better input check!
+	struct cc_op op;
+	struct cc_batch batch;
 
-	if(argc != 6)
+	if(argc != 6 && argc != 7)
 	{
 		printf("Invalid number of arguments.\n");
 		exit(EXIT_FAILURE);
 	}
 
-	if(strlen(argv[1]) != 32)
+	key_len = strlen(argv[1]);
+	if(key_len != 16 && key_len != 24 && key_len != 32)
 	{
 		printf("Key argument of invalid length.\n");
 		exit(EXIT_FAILURE);
 	}
+	memset(key, 0, sizeof(key));
 	sscanf(argv[1], "%s", key);
 
 	if(strlen(argv[2]) != 16)
@@ -74,145 +66,144 @@ int main(int argc, char **argv)
 	}
 	sscanf(argv[3], "%s", in_str);
 
-	if(strlen(argv[4]) != 1)
+	if(strcmp(argv[4], "0") != 0 && strcmp(argv[4], "1") != 0)
 	{
-		printf("Mode argument of invalid length.\n");
+		printf("Mode argument must be 0 or 1.\n");
 		exit(EXIT_FAILURE);
 	}
-	sscanf(argv[4], "%s", mode_buf);
+	mode = (uint32_t)atoi(argv[4]);
 
-	if(strlen(argv[5]) != 1)
+	if(strlen(argv[5]) != 1 || strchr("0123568", argv[5][0]) == NULL)
+	{
+		printf("Format argument must be 0, 1, 2, 3, 5, 6 or 8.\n");
+		exit(EXIT_FAILURE);
+	}
+	format = (uint32_t)atoi(argv[5]);
+
+	if(format == 8 && key_len != 32)
+	{
+		printf("Format 8 (ChaCha20-Poly1305) takes a key of 32 characters.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// verifying a tag needs the one encryption printed
+	if(mode == 1 && format_has_tag(format))
+	{
+		if(argc != 7 || parse_hex(argv[6], tag, sizeof(tag)) != 0)
+		{
+			printf("Mode 1 with format %u takes the expected tag as 32 hex digits.\n", format);
+			exit(EXIT_FAILURE);
+		}
+	} else if(argc != 6)
 	{
-		printf("Format argument of invalid length.\n");
+		printf("Only mode 1 with format 3, 5, 6 or 8 takes a tag argument.\n");
 		exit(EXIT_FAILURE);
 	}
-	sscanf(argv[5], "%s", format_buf);
 
 	printf("Starting program with arguments:\n");
 	printf("[1] %s\n", key);
 	printf("[2] %s\n", iv);
 	printf("[3] %s\n", in_str);
-	printf("[4] %s\n", mode_buf);
-	printf("[5] %s\n", format_buf);
-
-	printf("Opening device files...\n");
-
-	fd[0] = dev_file_open(DIR_PROC_ID,	O_RDONLY);
-	fd[1] = dev_file_open(DIR_MODE,		O_RDWR);
-	fd[2] = dev_file_open(DIR_FORMAT, 	O_RDWR);
-	fd[3] = dev_file_open(DIR_START, 	O_RDWR);
-	fd[4] = dev_file_open(DIR_VALID,	O_RDWR);
-	fd[5] = dev_file_open(DIR_KEY,		O_WRONLY);
-	fd[6] = dev_file_open(DIR_IV,		O_WRONLY);
-	fd[7] = dev_file_open(DIR_IN,		O_RDWR);
-	fd[8] = dev_file_open(DIR_OUT,		O_RDONLY);
-	
-	printf("Device files opened with no issues.\n");
-
-	// LETTURA ID
-
-	printf("Reading processor ID...\n");
-	readB = read(fd[0], proc_id, sizeof(readB));
-	check_op(readB);
-	printf("Processor ID successfully read.\n");
-	print_buf_char(proc_id, 8);
-
-	// SCRITTURA CHIAVE
-
-	printf("Writing key into registers.\n");
-	writeB = write(fd[5], key, 32);
-	check_op(writeB);
-
-	// SCRITTURA IV
-	printf("Writing IV into registers.\n");
-	writeB =write(fd[6], iv, 16);
-	check_op(writeB);
-
-	// SCRITTURA INPUT
-
-	printf("Writing input string into registers.\n");
-	writeB = write(fd[7], in_str, 16);
-	check_op(writeB);
-
-	// PARAMETRI
+	printf("[4] %u\n", mode);
+	printf("[5] %u\n", format);
+	if(argc == 7)
+	{
+		printf("[6] %s\n", argv[6]);
+	}
 
-	printf("Writing mode and format configuration into registers.\n");
-	//	MODE: 	0 to encrypt, !=0 to decrypt
-	//	FORMAT:	0 for ECB, 1 for CBC, other for CTR
-	writeB = write(fd[1], mode_buf, 2);
-	check_op(writeB);
-	writeB = write(fd[2], format_buf, 2);
-	check_op(writeB);
+	printf("Opening %s...\n", CC_DEV_PATH);
+	fd = open(CC_DEV_PATH, O_RDWR);
+	check_op(fd);
+
+	// the whole operation is one struct cc_op, run by a single ioctl
+	//	MODE: 	0 to encrypt, 1 to decrypt
+	//	FORMAT:	0 for ECB, 1 for CBC, 2 for CTR, 3 for GCM, 5 for CMAC, 6 for CBC-MAC, 8 for ChaCha20-Poly1305
+	memset(&op, 0, sizeof(op));
+	op.format = format;
+	op.mode = mode;
+	op.key_len = key_len * 8;
+	op.len = 16;
+	memcpy(op.key, key, key_len);
+	memcpy(op.iv, iv, 16);
+	if(argc == 7)
+	{
+		memcpy(op.tag, tag, sizeof(tag));
+	}
+	op.in = (uintptr_t)in_str;
+	op.out = (uintptr_t)out;
 
-	// AVVIO CONVERSIONE
+	memset(&batch, 0, sizeof(batch));
+	batch.ops = (uintptr_t)&op;
+	batch.count = 1;
 
 	printf("Starting operation.\n");
-	writeB = write(fd[3], start_buf, 3);
-	check_op(writeB);
-
-	for(uint32_t k = 0; k < 100000; k += 2) {k -= 1;}	// aspetta la conversione
-
-	// LETTURA OUTPUT
-
-	printf("Reading output registers.\n");
-
-	readB = read(fd[8], read_buf, 100);
-	check_op(readB);
-
-	for(uint8_t i = 0; i < 100; i += 1)
+	check_op(ioctl(fd, CC_IOC_BATCH, &batch));
+	if(op.status != 0)
 	{
-		printf("%c", read_buf[i]);
+		printf("Operation failed, device status %x.\n", op.status);
+		exit(EXIT_FAILURE);
 	}
-	printf("\n");
-
 
-	for(uint8_t i = 0; i < 9; i += 1)
+	if(op.format != 5 && op.format != 6)
+	{
+		printf("Output:\n");
+		print_buf_uint(out, 16);
+	}
+	if(format_has_tag(op.format))
 	{
-		close(fd[i]);
+		if(op.mode == 0)
+		{
+			printf("Tag:\n");
+			print_buf_hex(op.tag, 16);
+		} else
+		{
+			printf("Tag verified.\n");
+		}
 	}
 
+	close(fd);
+
 	return 0;
 }
 
 
 
-static int dev_file_open(char *subdir, int flag)
+static int format_has_tag(uint32_t format)
 {
-	int fd;
-	sprintf(file_path, "%s%s", DEVICE_DIR, subdir);
-	fd = open(file_path, flag);
-	if(fd == -1)
-	{
-		exit(EXIT_FAILURE);
-	}
-	return fd;
+	return format == 3 || format == 5 || format == 6 || format == 8;
 }
 
-uint32_t uint8_to_uint32(const uint8_t *input8)
+// Reads exactly 2 * len hex digits from str into buf. Returns 0 on success.
+static int parse_hex(const char *str, uint8_t *buf, size_t len)
 {
-        uint32_t result = 0;
-        result |= (uint32_t)input8[0];
-        result |= ((uint32_t)input8[1] << 8);
-        result |= ((uint32_t)input8[2] << 16);
-        result |= ((uint32_t)input8[3] << 24);
+	unsigned int byte;
 
-        return result;
+	if(strlen(str) != 2 * len || strspn(str, "0123456789abcdefABCDEF") != 2 * len)
+	{
+		return -1;
+	}
+	for(size_t i = 0; i < len; i += 1)
+	{
+		sscanf(str + 2 * i, "%2x", &byte);
+		buf[i] = (uint8_t)byte;
+	}
+	return 0;
 }
 
-static void print_buf_char(const uint8_t *buf, size_t len)
+static void print_buf_uint(const uint8_t *buf, size_t len)
 {
 	for(size_t i = 0; i < len; i += 1)
 	{
-		printf("%c ", (char)buf[i]);
+		printf("%u ", (uint8_t)buf[i]);
 	}
 	printf("\n");
 }
 
-static void print_buf_uint(const uint8_t *buf, size_t len)
+static void print_buf_hex(const uint8_t *buf, size_t len)
 {
 	for(size_t i = 0; i < len; i += 1)
 	{
-		printf("%u ", (uint8_t)buf[i]);
+		printf("%02x", buf[i]);
 	}
 	printf("\n");
 }